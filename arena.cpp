@@ -0,0 +1,68 @@
+#include "mini3d.h"
+
+#define ARENA_MIN_EXTRA             65536   // 溢出块的最小容量
+
+static void arena_alloc_main(arena_t *arena, size_t size) {
+    arena->mem = (char*)malloc(size + 64);
+    assert(arena->mem);
+    arena->base = (char*)(((size_t)arena->mem + 63) & ~(size_t)63);
+    arena->size = size;
+}
+
+// 释放所有溢出块
+static void arena_free_extra(arena_t *arena) {
+    while (arena->extra) {
+        arena_block_t *next = arena->extra->next;
+        free(arena->extra);
+        arena->extra = next;
+    }
+}
+
+void arena_init(arena_t *arena, size_t size) {
+    memset(arena, 0, sizeof(arena_t));
+    arena_alloc_main(arena, size);
+}
+
+void arena_destroy(arena_t *arena) {
+    arena_free_extra(arena);
+    if (arena->mem) free(arena->mem);
+    memset(arena, 0, sizeof(arena_t));
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_block_t *block = arena->extra;
+    char *ptr;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena->total += size;
+    if (arena->used + size <= arena->size) {
+        ptr = arena->base + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+    if (block == NULL || block->used + size > block->size) {
+        size_t cap = (size > ARENA_MIN_EXTRA) ? size : ARENA_MIN_EXTRA;
+        if (cap < arena->size) cap = arena->size;
+        block = (arena_block_t*)malloc(sizeof(arena_block_t) + cap + ARENA_ALIGN);
+        assert(block);
+        block->ptr = (char*)(((size_t)(block + 1) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+        block->size = cap;
+        block->used = 0;
+        block->next = arena->extra;
+        arena->extra = block;
+    }
+    ptr = block->ptr + block->used;
+    block->used += size;
+    return ptr;
+}
+
+// 有过溢出时释放溢出块，主块换成这一帧用量的 1.5 倍，下一帧同样的用量不会再溢出
+void arena_reset(arena_t *arena) {
+    if (arena->extra) {
+        size_t size = arena->total + arena->total / 2;
+        arena_free_extra(arena);
+        free(arena->mem);
+        arena_alloc_main(arena, size);
+    }
+    arena->used = 0;
+    arena->total = 0;
+}
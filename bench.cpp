@@ -0,0 +1,727 @@
+#include <chrono>
+#include <vector>
+
+#include "mini3d.h"
+#include "offscreen.h"
+
+// 帧性能测试：生成可缩放的合成场景，按渲染状态统计 fps / 三角形 / 像素吞吐，
+// 并把一帧拆成 clear / transform / setup / scanline 四段分别计时。
+// 输出为 CSV，一行一个 (场景, 渲染状态)，方便在不同版本之间 diff。
+//
+// 分段计时不在渲染循环里插桩：transform 段只跑 transform_apply、
+// transform_check_cvv 和 transform_homogenize；setup 段在此基础上再跑
+// trapezoid_init_triangle 以及 device_render_trap 的逐行边步进；完整的一帧
+// 减去 setup 段得到 device_draw_scanline 的耗时。
+// 以 MINI3D_STATS 编译时，额外输出预热帧的管线统计列。
+// -threads n 使用分块多线程光栅化（n 个线程），-raster halfspace 使用边函数光栅化，
+// 分段计时始终是单线程扫描线的参考路径。
+// 场景都是索引网格，默认用 draw_indexed 提交；-draw primitive 按索引逐个三角形调用
+// device_draw_primitive，每个角点各变换一次，用来对比顶点共享的收益。
+// -cull cw|ccw 打开背面剔除，场景的正面在屏幕上都是顺时针，剔除背面用 ccw。
+// -tex size 换成 size x size 的棋盘纹理（默认 256，与 init_texture 相同），看大纹理缩小时 mip 的效果。
+// -filter bilinear|trilinear、-address wrap|mirror 设置纹理采样器，对比过滤的开销。
+// -shade visibility 使用可见性缓存，每个像素只着色一次，对比 overdraw 高的场景。
+// -bvh on 把每个 draw 当作一个物体放进 BVH，先按视锥剔除整个物体再提交（总是 draw_indexed）；
+// field 场景的大部分物体在屏幕外，对比剔除前后的 transform 段。
+// -lod on 为每个网格生成细节层次，按屏幕大小选层（隐含 -bvh on）；spheres 场景由近到远摆放
+// 细分的球体，对比三角形数和 setup 段。
+// -list on 每个 (场景, 渲染状态) 把 draw 记录进一个命令列表，之后每帧只按摄像机排序再回放
+// （总是 draw_indexed，优先于 -bvh / -lod）；quads 场景排成由近到远之后与 walls 相同，对比层次 z 的收益。
+// -depth 16|24 换成定点深度缓存，16 位格式的深度读写流量减半，对比 overdraw 高的场景和 clear 段。
+
+
+//=====================================================================
+// 合成场景
+//=====================================================================
+// 一个 draw：世界矩阵，顶点区间 [vfirst, vfirst + vcount)，索引从 first 开始共 count 个三角形，
+// 索引相对 vfirst
+typedef struct Draw { matrix_t world; int vfirst, vcount, first, count; } draw_t;
+
+struct Scene {
+    const char *name;
+    float eye;                      // 摄像机位置 (eye, 0, 0)，看向原点
+    std::vector<vertex_t> verts;    // 顶点
+    std::vector<int> indices;       // 三个索引一个三角形
+    std::vector<draw_t> draws;      // 每个 draw 一个世界矩阵
+    std::vector<mesh_t> meshes;     // 每个 draw 的顶点、索引区间，BVH 里的物体引用它们
+    std::vector<mesh_lod_t> lods;   // -lod on 时每个不同的顶点、索引区间一份
+    bvh_t bvh;                      // 物体编号与 draws 的下标相同
+};
+
+static unsigned int bench_seed = 0x12345678;
+
+// 固定种子的随机数，保证每次运行场景一致
+static float bench_rand(float lo, float hi) {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return lo + (hi - lo) * (float)((bench_seed >> 8) & 0xffff) / 65535.0f;
+}
+
+static void scene_add_tri(Scene *scene, int base, int a, int b, int c) {
+    scene->indices.push_back(a - base);
+    scene->indices.push_back(b - base);
+    scene->indices.push_back(c - base);
+}
+
+// 把 vfirst 之后的顶点、first 之后的索引作为一个 draw
+static void scene_add_draw(Scene *scene, const matrix_t *world, int vfirst, int first) {
+    draw_t draw;
+    draw.world = *world;
+    draw.vfirst = vfirst;
+    draw.vcount = (int)scene->verts.size() - vfirst;
+    draw.first = first;
+    draw.count = ((int)scene->indices.size() - first) / 3;
+    scene->draws.push_back(draw);
+}
+
+// 与 Device::draw_box 相同的立方体，每个面 4 个顶点、两个三角形
+// 索引相对立方体的第一个顶点，与 scene_add_tri 一样
+static void scene_add_cube(Scene *scene) {
+    scene->verts.insert(scene->verts.end(), box_vertices, box_vertices + BOX_VERTICES);
+    scene->indices.insert(scene->indices.end(), box_indices, box_indices + BOX_INDICES);
+}
+
+// 在 yz 平面 x = d 处生成一个网格，横向 nx 格、纵向 ny 格，相邻格子共享顶点，
+// base 为当前 draw 的第一个顶点
+static void scene_add_grid(Scene *scene, int base, float d, float hw, float hh, int nx, int ny) {
+    static const color_t colors[4] = {
+        { 1.0f, 0.2f, 0.2f }, { 0.2f, 1.0f, 0.2f }, { 1.0f, 0.2f, 1.0f }, { 0.2f, 0.2f, 1.0f },
+    };
+    int first = (int)scene->verts.size(), i, j;
+    for (j = 0; j <= ny; j++) {
+        for (i = 0; i <= nx; i++) {
+            vertex_t p = { { d, -hw + 2 * hw * i / nx, hh - 2 * hh * j / ny, 1 },
+                { (float)i / nx, (float)j / ny }, colors[(i & 1) + (j & 1) * 2], 1 };
+            scene->verts.push_back(p);
+        }
+    }
+    for (j = 0; j < ny; j++) {
+        for (i = 0; i < nx; i++) {
+            int p1 = first + j * (nx + 1) + i, p2 = p1 + 1;
+            int p4 = p1 + nx + 1, p3 = p4 + 1;
+            scene_add_tri(scene, base, p1, p4, p3);
+            scene_add_tri(scene, base, p3, p2, p1);
+        }
+    }
+}
+
+// 大量随机摆放的小立方体：几何与三角形设置为主
+static void scene_init_cubes(Scene *scene, int count) {
+    matrix_t m, r, s;
+    int i;
+    scene->name = "cubes";
+    scene->eye = 12.0f;
+    scene_add_cube(scene);
+    for (i = 0; i < count; i++) {
+        float x = bench_rand(-20.0f, 6.0f);
+        float d = 12.0f - x;
+        matrix_set_rotate(&r, bench_rand(-1, 1), bench_rand(-1, 1), 1, bench_rand(0, 6.28f));
+        matrix_set_scale(&s, 0.3f, 0.3f, 0.3f);
+        matrix_mul(&m, &s, &r);
+        m.m[3][0] = x;
+        m.m[3][1] = bench_rand(-0.9f, 0.9f) * d * 1.2f;
+        m.m[3][2] = bench_rand(-0.9f, 0.9f) * d * 0.9f;
+        draw_t draw;
+        draw.world = m;
+        draw.vfirst = 0;
+        draw.vcount = BOX_VERTICES;
+        draw.first = 0;
+        draw.count = BOX_INDICES / 3;
+        scene->draws.push_back(draw);
+    }
+}
+
+// 散布在很大范围里的小立方体，只有摄像机前方的一小部分在视锥内：物体剔除为主
+static void scene_init_field(Scene *scene, int count) {
+    matrix_t m, r, s;
+    int i;
+    scene->name = "field";
+    scene->eye = 12.0f;
+    scene_add_cube(scene);
+    for (i = 0; i < count; i++) {
+        matrix_set_rotate(&r, bench_rand(-1, 1), bench_rand(-1, 1), 1, bench_rand(0, 6.28f));
+        matrix_set_scale(&s, 0.3f, 0.3f, 0.3f);
+        matrix_mul(&m, &s, &r);
+        m.m[3][0] = bench_rand(-30.0f, 30.0f);
+        m.m[3][1] = bench_rand(-300.0f, 300.0f);
+        m.m[3][2] = bench_rand(-300.0f, 300.0f);
+        draw_t draw;
+        draw.world = m;
+        draw.vfirst = 0;
+        draw.vcount = BOX_VERTICES;
+        draw.first = 0;
+        draw.count = BOX_INDICES / 3;
+        scene->draws.push_back(draw);
+    }
+}
+
+// 经纬细分的单位球：nu 条经线、nv 条纬线，经度 0 / 360 处的顶点纹理坐标不同，拆成两份
+static void scene_add_sphere(Scene *scene, int nu, int nv) {
+    int base = (int)scene->verts.size(), i, j;
+    for (j = 0; j <= nv; j++) {
+        float b = 3.1415926f * j / nv;
+        for (i = 0; i <= nu; i++) {
+            float a = 2 * 3.1415926f * i / nu;
+            vertex_t p = { { sinf(b) * cosf(a), sinf(b) * sinf(a), cosf(b), 1 },
+                { (float)i / nu, (float)j / nv }, { 0.5f + 0.5f * cosf(a), 0.5f + 0.5f * sinf(a), 0.5f + 0.5f * cosf(b) }, 1 };
+            // 两极只用一个顶点
+            if ((j == 0 || j == nv) && i > 0) break;
+            if (j == 0 || j == nv) p.tc.u = 0.5f;
+            scene->verts.push_back(p);
+        }
+    }
+    for (j = 0; j < nv; j++) {
+        for (i = 0; i < nu; i++) {
+            int p1 = (j == 0) ? base : base + 1 + (j - 1) * (nu + 1) + i;
+            int p2 = (j == 0) ? base : p1 + 1;
+            int p4 = (j == nv - 1) ? base + 1 + (nv - 1) * (nu + 1) : base + 1 + j * (nu + 1) + i;
+            int p3 = (j == nv - 1) ? p4 : p4 + 1;
+            if (j > 0) scene_add_tri(scene, base, p1, p4, p2);
+            if (j < nv - 1) scene_add_tri(scene, base, p2, p4, p3);
+        }
+    }
+}
+
+// 由近到远摆放的细分球体，远处的球只占几个像素：三角形设置为主，细节层次的收益最大
+static void scene_init_spheres(Scene *scene, int count) {
+    matrix_t m;
+    int i;
+    scene->name = "spheres";
+    scene->eye = 12.0f;
+    scene_add_sphere(scene, 32, 16);
+    for (i = 0; i < count; i++) {
+        float x = 8.0f - 300.0f * (float)(i + 1) / count;
+        float d = 12.0f - x;
+        matrix_set_identity(&m);
+        m.m[3][0] = x;
+        m.m[3][1] = bench_rand(-0.9f, 0.9f) * d * 1.2f;
+        m.m[3][2] = bench_rand(-0.9f, 0.9f) * d * 0.9f;
+        scene_add_draw(scene, &m, 0, 0);
+        scene->draws.back().vcount = (int)scene->verts.size();
+        scene->draws.back().count = (int)scene->indices.size() / 3;
+    }
+}
+
+// 若干层几乎铺满屏幕的大矩形：填充率为主，overdraw = count。
+// quads 从后往前画，每层都通过深度测试；walls 从前往后画，除了第一层全部被遮挡
+static void scene_init_quads(Scene *scene, int count, float aspect, int front) {
+    matrix_t m;
+    int i;
+    scene->name = front ? "walls" : "quads";
+    scene->eye = 2.0f;
+    matrix_set_identity(&m);
+    for (i = 0; i < count; i++) {
+        float d = 2.0f + 1.0f * (front ? i + 1 : count - i);
+        scene_add_grid(scene, 0, 2.0f - d, d * 0.9f * aspect, d * 0.9f, 1, 1);
+    }
+    scene_add_draw(scene, &m, 0, 0);
+}
+
+// 铺满屏幕的细小三角形网格：每格约 cell 个像素，三角形设置为主
+static void scene_init_tiny(Scene *scene, int width, int height, int cell, float aspect) {
+    matrix_t m;
+    int nx = width / cell, ny = height / cell;
+    scene->name = "tiny";
+    scene->eye = 2.0f;
+    matrix_set_identity(&m);
+    scene_add_grid(scene, 0, 0.0f, 2.0f * 0.95f * aspect, 2.0f * 0.95f, nx, ny);
+    scene_add_draw(scene, &m, 0, 0);
+}
+
+// 每个 draw 一个网格，按世界矩阵放进 BVH；lod 不为 0 时顶点、索引区间相同的 draw 共用一份细节层次
+static void scene_build_bvh(Scene *scene, int lod) {
+    std::vector<int> lod_of(scene->draws.size());
+    size_t i, k;
+    scene->meshes.resize(scene->draws.size());
+    bvh_init(&scene->bvh);
+    for (i = 0; i < scene->draws.size(); i++) {
+        const draw_t *draw = &scene->draws[i];
+        mesh_t *mesh = &scene->meshes[i];
+        mesh->vertices = &scene->verts[draw->vfirst];
+        mesh->count = draw->vcount;
+        mesh->indices = &scene->indices[draw->first * 3];
+        mesh->icount = draw->count * 3;
+        mesh_update_bounds(mesh);
+        if (lod == 0) continue;
+        for (k = 0; k < scene->lods.size(); k++) {
+            const mesh_t *level = &scene->lods[k].level[0];
+            if (level->vertices == mesh->vertices && level->indices == mesh->indices &&
+                level->icount == mesh->icount) break;
+        }
+        if (k == scene->lods.size()) {
+            mesh_lod_t levels;
+            mesh_lod_build(&levels, mesh, MESH_LODS);
+            scene->lods.push_back(levels);
+        }
+        lod_of[i] = (int)k;
+    }
+    for (i = 0; i < scene->draws.size(); i++) {
+        if (lod) bvh_add_lod(&scene->bvh, &scene->lods[lod_of[i]], &scene->draws[i].world);
+        else bvh_add(&scene->bvh, &scene->meshes[i], &scene->draws[i].world);
+    }
+    bvh_build(&scene->bvh);
+}
+
+
+//=====================================================================
+// 计时
+//=====================================================================
+typedef std::chrono::steady_clock bench_clock;
+
+static double bench_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+typedef struct BenchResult {
+    double frame_ms, clear_ms, transform_ms, setup_ms;
+    long submitted, triangles, pixels;
+#ifdef MINI3D_STATS
+    device_stats_t stats;
+#endif
+} bench_result_t;
+
+static void bench_camera(Device *device, const Scene *scene) {
+    device->camera_at_zero(scene->eye, 0, 0);
+}
+
+static void bench_world(Device *device, const draw_t *draw) {
+    device->transform.world = draw->world;
+    transform_update(&device->transform);
+}
+
+static int bench_indexed = 1;
+static int bench_bvh = 0;
+static int bench_lod = 0;
+static int bench_list = 0;
+static cmdlist_t bench_cmds;            // -list on 时当前 (场景, 渲染状态) 的命令，跨帧保留
+
+// 这一帧要画的 draw：-bvh on 时为与视锥相交的物体，否则为全部。返回个数
+static int bench_visible(Device *device, const Scene *scene, std::vector<int> *list) {
+    int i, n = (int)scene->draws.size();
+    list->resize(n);
+    if (bench_bvh) {
+        matrix_set_identity(&device->transform.world);
+        transform_update(&device->transform);
+        return (n > 0) ? bvh_cull(&scene->bvh, &device->transform.transform, &(*list)[0]) : 0;
+    }
+    for (i = 0; i < n; i++) (*list)[i] = i;
+    return n;
+}
+
+// 完整的一帧
+static void bench_frame(Device *device, const Scene *scene) {
+    size_t i;
+    int k;
+    bench_camera(device, scene);
+    if (bench_list) {
+        cmdlist_sort(&bench_cmds, &device->transform.view);
+        device->draw_list(&bench_cmds);
+        device->device_flush();
+        return;
+    }
+    if (bench_bvh) {
+        device->draw_bvh(&scene->bvh);
+        device->device_flush();
+        return;
+    }
+    for (i = 0; i < scene->draws.size(); i++) {
+        const draw_t *draw = &scene->draws[i];
+        const vertex_t *v = &scene->verts[draw->vfirst];
+        const int *idx = &scene->indices[draw->first * 3];
+        bench_world(device, draw);
+        if (bench_indexed) {
+            device->draw_indexed(v, draw->vcount, idx, draw->count * 3);
+            continue;
+        }
+        for (k = 0; k < draw->count; k++, idx += 3)
+            device->device_draw_primitive(&v[idx[0]], &v[idx[1]], &v[idx[2]]);
+    }
+    device->device_flush();
+}
+
+// 一个屏幕坐标已经算好的三角形：与 device_draw_triangle 一样先剔除，setup != 0 时再做三角形设置，
+// 扫描线只统计屏幕内的像素，不画出来。返回 1 为没有被剔除
+static int bench_setup(Device *device, const vertex_t *v1, const vertex_t *v2, const vertex_t *v3,
+    const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3, int setup, long *pixels) {
+    vertex_t t1, t2, t3;
+    trapezoid_t traps[2];
+    int n, m;
+    if (device->device_check_cull(&q1->screen, &q2->screen, &q3->screen)) return 0;
+    if (setup == 0) return 1;
+    if ((device->render_state & (RENDER_STATE_TEXTURE | RENDER_STATE_COLOR)) == 0) return 1;
+    t1 = *v1, t2 = *v2, t3 = *v3;
+    t1.pos = q1->screen, t2.pos = q2->screen, t3.pos = q3->screen;
+    t1.pos.w = q1->clip.w, t2.pos.w = q2->clip.w, t3.pos.w = q3->clip.w;
+    vertex_rhw_init(&t1);
+    vertex_rhw_init(&t2);
+    vertex_rhw_init(&t3);
+    n = trapezoid_init_triangle(traps, &t1, &t2, &t3);
+    for (m = 0; m < n; m++) {
+        trapezoid_t *trap = &traps[m];
+        scanline_t scanline;
+        int j;
+        trapezoid_edge_start(trap, trap->top);
+        for (j = trap->top; j < trap->bottom; j++, trapezoid_edge_step(trap)) {
+            if (j >= 0 && j < device->height) {
+                int x0, x1;
+                trapezoid_init_scan_line(trap, &scanline, j);
+                x0 = (scanline.x < 0) ? 0 : scanline.x;
+                x1 = scanline.x + scanline.w;
+                if (x1 > device->width) x1 = device->width;
+                if (x1 > x0) *pixels += x1 - x0;
+            }
+            if (j >= device->height) break;
+        }
+    }
+    return 1;
+}
+
+// 只跑几何阶段（setup == 0）或者几何加三角形设置（setup != 0），
+// 与 draw_indexed / device_draw_primitive / device_draw_post 一致：三个顶点都在同一个平面外面才丢弃，
+// 保护带内的直接设置，其余经 device_clip_fan 裁剪，但不画扫描线。
+// 返回送进光栅化的三角形数量，pixels 为扫描线覆盖的屏幕内像素数
+static long bench_stages(Device *device, const Scene *scene, int setup, long *pixels) {
+    static std::vector<int> list;
+    long visible = 0;
+    int i, k, count;
+    bench_camera(device, scene);
+    count = bench_visible(device, scene, &list);
+    for (i = 0; i < count; i++) {
+        const mesh_t *mesh = &scene->meshes[list[i]];
+        const vertex_t *v;
+        const int *idx;
+        bench_world(device, &scene->draws[list[i]]);
+        if (bench_lod) {
+            const mesh_lod_t *lod = scene->bvh.objects[list[i]].lod;
+            mesh = &lod->level[mesh_lod_select(lod, &device->transform)];
+        }
+        v = mesh->vertices;
+        idx = mesh->indices;
+        if (bench_indexed || bench_bvh)
+            device->device_transform_batch(v, mesh->count);
+        for (k = 0; k < mesh->icount / 3; k++, idx += 3) {
+            const vertex_t *v1 = &v[idx[0]], *v2 = &v[idx[1]], *v3 = &v[idx[2]];
+            post_vertex_t q[3], cp[CLIP_VERTICES];
+            vertex_t cv[CLIP_VERTICES];
+            int n, m;
+            if (bench_indexed || bench_bvh) {
+                device->device_post_fetch(&q[0], idx[0]);
+                device->device_post_fetch(&q[1], idx[1]);
+                device->device_post_fetch(&q[2], idx[2]);
+            } else {
+                device->device_transform_vertex(&q[0], v1);
+                device->device_transform_vertex(&q[1], v2);
+                device->device_transform_vertex(&q[2], v3);
+            }
+            if ((q[0].cvv | q[1].cvv | q[2].cvv) == 0) {
+                visible += bench_setup(device, v1, v2, v3, &q[0], &q[1], &q[2], setup, pixels);
+                continue;
+            }
+            if ((q[0].cvv & q[1].cvv & q[2].cvv) != 0) continue;
+            n = device->device_clip_fan(cv, cp, v1, v2, v3, &q[0], &q[1], &q[2]);
+            for (m = 1; m + 1 < n; m++)
+                visible += bench_setup(device, &cv[0], &cv[m], &cv[m + 1], &cp[0], &cp[m], &cp[m + 1], setup, pixels);
+        }
+    }
+    return visible;
+}
+
+static void bench_run(Device *device, const Scene *scene, int frames, bench_result_t *result) {
+    bench_clock::time_point start;
+    long pixels = 0;
+    int i;
+
+    // 命令列表只记录一次，之后每帧复用
+    if (bench_list) {
+        cmdlist_reset(&bench_cmds);
+        for (i = 0; i < (int)scene->draws.size(); i++)
+            cmdlist_draw(&bench_cmds, &scene->meshes[i], &scene->draws[i].world, NULL, device->render_state);
+    }
+
+    // 预热一帧，顺便统计三角形与像素
+#ifdef MINI3D_STATS
+    device->device_stats_reset();
+#endif
+    device->device_clear(1);
+    bench_frame(device, scene);
+#ifdef MINI3D_STATS
+    result->stats = device->stats;
+#endif
+    result->submitted = 0;
+    for (i = 0; i < (int)scene->draws.size(); i++) result->submitted += scene->draws[i].count;
+    result->triangles = bench_stages(device, scene, 1, &pixels);
+    result->pixels = pixels;
+
+    start = bench_clock::now();
+    for (i = 0; i < frames; i++) device->device_clear(1);
+    result->clear_ms = bench_ms(start) / frames;
+
+    start = bench_clock::now();
+    for (i = 0; i < frames; i++) bench_stages(device, scene, 0, &pixels);
+    result->transform_ms = bench_ms(start) / frames;
+
+    start = bench_clock::now();
+    for (i = 0; i < frames; i++) bench_stages(device, scene, 1, &pixels);
+    result->setup_ms = bench_ms(start) / frames - result->transform_ms;
+    if (result->setup_ms < 0) result->setup_ms = 0;
+
+    start = bench_clock::now();
+    for (i = 0; i < frames; i++) {
+        device->device_clear(1);
+        bench_frame(device, scene);
+    }
+    result->frame_ms = bench_ms(start) / frames;
+}
+
+
+//=====================================================================
+// 主程序
+//=====================================================================
+static void usage(void) {
+    printf("usage: Mini3DBench [-w width] [-h height] [-n frames]\n");
+    printf("                   [-scene all|cubes|quads|walls|tiny|field|spheres]\n");
+    printf("                   [-cubes count] [-quads layers] [-tiny cellsize] [-field count]\n");
+    printf("                   [-threads n] [-raster scanline|halfspace]\n");
+    printf("                   [-draw indexed|primitive] [-cull none|cw|ccw]\n");
+    printf("                   [-tex size] [-filter nearest|bilinear|trilinear]\n");
+    printf("                   [-address clamp|wrap|mirror] [-shade forward|visibility]\n");
+    printf("                   [-bvh on|off] [-lod on|off] [-spheres count] [-list on|off]\n");
+    printf("                   [-depth float|16|24]\n");
+}
+
+static const char *state_name(int state) {
+    switch (state) {
+    case RENDER_STATE_TEXTURE: return "texture";
+    case RENDER_STATE_COLOR: return "color";
+    case RENDER_STATE_WIREFRAME: return "wireframe";
+    }
+    return "unknown";
+}
+
+// size x size 的棋盘纹理，8x8 个格子，颜色与 init_texture 相同
+static void bench_texture(Device *device, int size) {
+    std::vector<UINT32> bits((size_t)size * size);
+    int i, j;
+    for (j = 0; j < size; j++) {
+        for (i = 0; i < size; i++) {
+            int x = i * 8 / size, y = j * 8 / size;
+            bits[(size_t)j * size + i] = ((x + y) & 1) ? 0xffffff : 0x3fbcef;
+        }
+    }
+    device->device_set_texture(&bits[0], size * 4, size, size);
+}
+
+// 选项的值拼错时返回 -1，不要悄悄换成默认值测出另一种配置的数据
+static int parse_raster(const char *name) {
+    if (strcmp(name, "scanline") == 0) return RASTERIZER_SCANLINE;
+    if (strcmp(name, "halfspace") == 0) return RASTERIZER_HALFSPACE;
+    return -1;
+}
+
+static int parse_cull(const char *name) {
+    if (strcmp(name, "none") == 0) return CULL_NONE;
+    if (strcmp(name, "cw") == 0) return CULL_CW;
+    if (strcmp(name, "ccw") == 0) return CULL_CCW;
+    return -1;
+}
+
+static int parse_filter(const char *name) {
+    if (strcmp(name, "nearest") == 0) return SAMPLER_NEAREST;
+    if (strcmp(name, "bilinear") == 0) return SAMPLER_BILINEAR;
+    if (strcmp(name, "trilinear") == 0) return SAMPLER_TRILINEAR;
+    return -1;
+}
+
+static int parse_address(const char *name) {
+    if (strcmp(name, "clamp") == 0) return SAMPLER_CLAMP;
+    if (strcmp(name, "wrap") == 0) return SAMPLER_WRAP;
+    if (strcmp(name, "mirror") == 0) return SAMPLER_MIRROR;
+    return -1;
+}
+
+static int parse_shade(const char *name) {
+    if (strcmp(name, "forward") == 0) return 0;
+    if (strcmp(name, "visibility") == 0) return 1;
+    return -1;
+}
+
+static int parse_draw(const char *name) {
+    if (strcmp(name, "primitive") == 0) return 0;
+    if (strcmp(name, "indexed") == 0) return 1;
+    return -1;
+}
+
+static int parse_depth(const char *name) {
+    if (strcmp(name, "float") == 0) return DEPTH_FLOAT;
+    if (strcmp(name, "16") == 0) return DEPTH_16;
+    if (strcmp(name, "24") == 0) return DEPTH_24;
+    return -1;
+}
+
+static int parse_switch(const char *name) {
+    if (strcmp(name, "off") == 0) return 0;
+    if (strcmp(name, "on") == 0) return 1;
+    return -1;
+}
+
+// -scene 的值：all 或者某个场景的名字
+static int parse_scene(const char *name) {
+    static const char *names[] = { "all", "cubes", "quads", "walls", "tiny", "field", "spheres" };
+    int i;
+    for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (strcmp(name, names[i]) == 0) return i;
+    return -1;
+}
+
+static const char *filter_name(int filter) {
+    switch (filter) {
+    case SAMPLER_BILINEAR: return "bilinear";
+    case SAMPLER_TRILINEAR: return "trilinear";
+    }
+    return "nearest";
+}
+
+static const char *address_name(int address) {
+    switch (address) {
+    case SAMPLER_WRAP: return "wrap";
+    case SAMPLER_MIRROR: return "mirror";
+    }
+    return "clamp";
+}
+
+static const char *depth_name(int format) {
+    switch (format) {
+    case DEPTH_16: return "16";
+    case DEPTH_24: return "24";
+    }
+    return "float";
+}
+
+static const char *cull_name(int cull) {
+    switch (cull) {
+    case CULL_CW: return "cw";
+    case CULL_CCW: return "ccw";
+    }
+    return "none";
+}
+
+int main(int argc, char *argv[])
+{
+    int width = 800, height = 600, frames = 20;
+    int cubes = 2000, quads = 8, tiny = 3, field = 10000, spheres = 200, threads = 0, tex = 256;
+    int raster = RASTERIZER_SCANLINE, cull = CULL_NONE;
+    int filter = SAMPLER_NEAREST, address = SAMPLER_CLAMP, shade = 0, zformat = DEPTH_FLOAT;
+    const char *which = "all";
+    int states[] = { RENDER_STATE_TEXTURE, RENDER_STATE_COLOR, RENDER_STATE_WIREFRAME };
+    Scene scenes[6];
+    float aspect;
+    int i, k;
+
+    for (i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (arg == NULL) { usage(); return -1; }
+        if (strcmp(opt, "-w") == 0) width = atoi(arg);
+        else if (strcmp(opt, "-h") == 0) height = atoi(arg);
+        else if (strcmp(opt, "-n") == 0) frames = atoi(arg);
+        else if (strcmp(opt, "-scene") == 0) which = arg;
+        else if (strcmp(opt, "-cubes") == 0) cubes = atoi(arg);
+        else if (strcmp(opt, "-quads") == 0) quads = atoi(arg);
+        else if (strcmp(opt, "-tiny") == 0) tiny = atoi(arg);
+        else if (strcmp(opt, "-field") == 0) field = atoi(arg);
+        else if (strcmp(opt, "-spheres") == 0) spheres = atoi(arg);
+        else if (strcmp(opt, "-threads") == 0) threads = atoi(arg);
+        else if (strcmp(opt, "-raster") == 0) raster = parse_raster(arg);
+        else if (strcmp(opt, "-cull") == 0) cull = parse_cull(arg);
+        else if (strcmp(opt, "-draw") == 0) bench_indexed = parse_draw(arg);
+        else if (strcmp(opt, "-tex") == 0) tex = atoi(arg);
+        else if (strcmp(opt, "-filter") == 0) filter = parse_filter(arg);
+        else if (strcmp(opt, "-address") == 0) address = parse_address(arg);
+        else if (strcmp(opt, "-shade") == 0) shade = parse_shade(arg);
+        else if (strcmp(opt, "-bvh") == 0) bench_bvh = parse_switch(arg);
+        else if (strcmp(opt, "-lod") == 0) bench_lod = parse_switch(arg);
+        else if (strcmp(opt, "-list") == 0) bench_list = parse_switch(arg);
+        else if (strcmp(opt, "-depth") == 0) zformat = parse_depth(arg);
+        else { usage(); return -1; }
+        i++;
+    }
+    if (width <= 0 || height <= 1 || frames <= 0 || cubes <= 0 || quads <= 0 || tiny <= 0 || field <= 0 || spheres <= 0 ||
+        threads < 0 || tex <= 0 || tex > (1 << (TEXTURE_LEVELS - 1)) || parse_scene(which) < 0 ||
+        raster < 0 || cull < 0 || bench_indexed < 0 || filter < 0 || address < 0 || shade < 0 ||
+        bench_bvh < 0 || bench_lod < 0 || bench_list < 0 || zformat < 0) {
+        usage();
+        return -1;
+    }
+    if (bench_lod) bench_bvh = 1;
+    if (bench_list) bench_bvh = bench_lod = 0, bench_indexed = 1;
+
+    aspect = (float)width / (float)height;
+    scene_init_cubes(&scenes[0], cubes);
+    scene_init_quads(&scenes[1], quads, aspect, 0);
+    scene_init_quads(&scenes[2], quads, aspect, 1);
+    scene_init_tiny(&scenes[3], width, height, tiny, aspect);
+    scene_init_field(&scenes[4], field);
+    scene_init_spheres(&scenes[5], spheres);
+    for (i = 0; i < 6; i++) scene_build_bvh(&scenes[i], bench_lod);
+
+    Offscreen screen;
+    if (screen.offscreen_init(width, height))
+        return -2;
+
+    Device device;
+    device.device_init(width, height, screen.getScreenFrameBuffer());
+    if (tex == 256) device.init_texture();
+    else bench_texture(&device, tex);
+    device.device_set_tiled(threads);
+    device.rasterizer = raster;
+    device.cull_mode = cull;
+    device.device_set_sampler(filter, address, address);
+    device.device_set_visibility(shade);
+    device.device_set_depth(zformat);
+    cmdlist_init(&bench_cmds);
+
+    printf("scene,state,raster,shade,draw,cull,bvh,lod,list,depth,tex,filter,address,threads,width,height,frames,submitted,triangles,pixels,fps,tris_per_sec,"
+        "pixels_per_sec,frame_ms,clear_ms,transform_ms,setup_ms,scanline_ms");
+#ifdef MINI3D_STATS
+    printf(",st_primitives,st_clipped,st_guarded,st_split,st_culled,st_trapezoids,st_scanlines,"
+        "st_pixels,st_zfail,st_written,st_hiztraps,st_hizpixels,st_shaded,st_objects,st_objculled");
+#endif
+    printf("\n");
+
+    for (i = 0; i < 6; i++) {
+        const Scene *scene = &scenes[i];
+        if (strcmp(which, "all") != 0 && strcmp(which, scene->name) != 0) continue;
+        for (k = 0; k < 3; k++) {
+            bench_result_t r;
+            double fps, scan_ms;
+            device.render_state = states[k];
+            bench_run(&device, scene, frames, &r);
+            fps = 1000.0 / r.frame_ms;
+            scan_ms = r.frame_ms - r.clear_ms - r.transform_ms - r.setup_ms;
+            if (scan_ms < 0) scan_ms = 0;
+            printf("%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%d,%s,%s,%d,%d,%d,%d,%ld,%ld,%ld,%.2f,%.0f,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f",
+                scene->name, state_name(states[k]),
+                (raster == RASTERIZER_HALFSPACE) ? "halfspace" : "scanline", shade ? "visibility" : "forward",
+                (bench_indexed || bench_bvh) ? "indexed" : "primitive", cull_name(cull),
+                bench_bvh ? "on" : "off", bench_lod ? "on" : "off", bench_list ? "on" : "off", depth_name(zformat), tex,
+                filter_name(filter), address_name(address), threads, width, height, frames,
+                r.submitted, r.triangles, r.pixels, fps, r.triangles * fps, r.pixels * fps,
+                r.frame_ms, r.clear_ms, r.transform_ms, r.setup_ms, scan_ms);
+#ifdef MINI3D_STATS
+            printf(",%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld", r.stats.primitives, r.stats.clipped,
+                r.stats.guarded, r.stats.split, r.stats.culled, r.stats.trapezoids, r.stats.scanlines, r.stats.pixels,
+                r.stats.zfail, r.stats.written, r.stats.hiztraps, r.stats.hizpixels, r.stats.shaded,
+                r.stats.objects, r.stats.objculled);
+#endif
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    for (i = 0; i < 6; i++) {
+        for (k = 0; k < (int)scenes[i].lods.size(); k++) mesh_lod_destroy(&scenes[i].lods[k]);
+        bvh_destroy(&scenes[i].bvh);
+    }
+    cmdlist_destroy(&bench_cmds);
+    device.device_destroy(&device);
+    return 0;
+}
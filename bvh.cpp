@@ -0,0 +1,202 @@
+#include "mini3d.h"
+
+#include <algorithm>
+
+//=====================================================================
+// 物体层次包围盒：每个物体的网格包围盒经世界矩阵变换后取世界空间的轴对齐包围盒，
+// 按包围盒中心沿最长轴从中间一分为二，递归建成二叉树。同一棵子树的物体在 order 里连续存放，
+// 子树整个在视锥内时不再往下测试，直接输出这一段；整个在某个平面外时一次跳过。
+// 视锥平面直接从 world * view * projection 的列组合出来，与 transform_check_cvv 的
+// 6 个条件一一对应：0 <= z <= w，-w <= x <= w，-w <= y <= w。
+//=====================================================================
+
+#define BVH_LEAF                    4       // 叶子最多放几个物体
+#define BVH_STACK                   64      // 遍历栈，中间切分的树深度不超过 log2(count) + 1
+
+// 包围盒在平面外返回 -1，整个在平面内返回 1，与平面相交返回 0
+static inline int bvh_plane_test(const float *plane, const point_t *lo, const point_t *hi) {
+    float a = plane[0], b = plane[1], c = plane[2], d = plane[3];
+    float far = d + a * ((a > 0) ? hi->x : lo->x) + b * ((b > 0) ? hi->y : lo->y) + c * ((c > 0) ? hi->z : lo->z);
+    float near = d + a * ((a > 0) ? lo->x : hi->x) + b * ((b > 0) ? lo->y : hi->y) + c * ((c > 0) ? lo->z : hi->z);
+    if (far < 0.0f) return -1;
+    return (near >= 0.0f) ? 1 : 0;
+}
+
+// 行向量 clip = p * m，clip 的第 j 个分量为 p 与 m 第 j 列的点积。
+// 平面 (a, b, c, d)：a * x + b * y + c * z + d >= 0 为视锥内
+static void bvh_planes(float planes[6][4], const matrix_t *m) {
+    int i;
+    for (i = 0; i < 4; i++) {
+        float x = m->m[i][0], y = m->m[i][1], z = m->m[i][2], w = m->m[i][3];
+        planes[0][i] = z;           // z >= 0
+        planes[1][i] = w - z;       // z <= w
+        planes[2][i] = w + x;       // x >= -w
+        planes[3][i] = w - x;       // x <= w
+        planes[4][i] = w + y;       // y >= -w
+        planes[5][i] = w - y;       // y <= w
+    }
+}
+
+static inline void bvh_merge(point_t *lo, point_t *hi, const point_t *a, const point_t *b) {
+    if (a->x < lo->x) lo->x = a->x;
+    if (a->y < lo->y) lo->y = a->y;
+    if (a->z < lo->z) lo->z = a->z;
+    if (b->x > hi->x) hi->x = b->x;
+    if (b->y > hi->y) hi->y = b->y;
+    if (b->z > hi->z) hi->z = b->z;
+}
+
+void bvh_init(bvh_t *bvh) {
+    memset(bvh, 0, sizeof(bvh_t));
+}
+
+void bvh_destroy(bvh_t *bvh) {
+    if (bvh->objects) free(bvh->objects);
+    if (bvh->nodes) free(bvh->nodes);
+    if (bvh->order) free(bvh->order);
+    if (bvh->visible) free(bvh->visible);
+    memset(bvh, 0, sizeof(bvh_t));
+}
+
+int bvh_add(bvh_t *bvh, const mesh_t *mesh, const matrix_t *world) {
+    bvh_object_t *obj;
+    int i;
+    if (bvh->count >= bvh->max) {
+        bvh->max = (bvh->max > 0) ? bvh->max * 2 : 64;
+        bvh->objects = (bvh_object_t*)realloc(bvh->objects, sizeof(bvh_object_t) * bvh->max);
+        assert(bvh->objects);
+    }
+    obj = &bvh->objects[bvh->count];
+    obj->mesh = mesh;
+    obj->lod = NULL;
+    obj->world = *world;
+    // 网格包围盒的 8 个角变换到世界空间，再取轴对齐包围盒
+    for (i = 0; i < 8; i++) {
+        vector_t p, q;
+        p.x = (i & 1) ? mesh->hi.x : mesh->lo.x;
+        p.y = (i & 2) ? mesh->hi.y : mesh->lo.y;
+        p.z = (i & 4) ? mesh->hi.z : mesh->lo.z;
+        p.w = 1.0f;
+        matrix_apply(&q, &p, world);
+        if (i == 0) obj->lo = obj->hi = q;
+        else bvh_merge(&obj->lo, &obj->hi, &q, &q);
+    }
+    bvh->built = 0;
+    return bvh->count++;
+}
+
+int bvh_add_lod(bvh_t *bvh, const mesh_lod_t *lod, const matrix_t *world) {
+    int id = bvh_add(bvh, &lod->level[0], world);
+    bvh->objects[id].lod = lod;
+    return id;
+}
+
+// 物体包围盒中心在 axis 上的坐标（放大两倍，省掉除法）
+static inline float bvh_center(const bvh_t *bvh, int id, int axis) {
+    const bvh_object_t *obj = &bvh->objects[id];
+    if (axis == 0) return obj->lo.x + obj->hi.x;
+    if (axis == 1) return obj->lo.y + obj->hi.y;
+    return obj->lo.z + obj->hi.z;
+}
+
+// 在 nodes[index] 建立 order[first, first + count) 的子树
+static void bvh_build_node(bvh_t *bvh, int index, int first, int count) {
+    bvh_node_t *node = &bvh->nodes[index];
+    int i, axis, half, left;
+    point_t clo, chi;
+    node->first = first;
+    node->count = count;
+    node->left = -1;
+    node->lo = bvh->objects[bvh->order[first]].lo;
+    node->hi = bvh->objects[bvh->order[first]].hi;
+    clo.x = chi.x = bvh_center(bvh, bvh->order[first], 0);
+    clo.y = chi.y = bvh_center(bvh, bvh->order[first], 1);
+    clo.z = chi.z = bvh_center(bvh, bvh->order[first], 2);
+    clo.w = chi.w = 1.0f;
+    for (i = first + 1; i < first + count; i++) {
+        const bvh_object_t *obj = &bvh->objects[bvh->order[i]];
+        point_t c;
+        c.x = bvh_center(bvh, bvh->order[i], 0);
+        c.y = bvh_center(bvh, bvh->order[i], 1);
+        c.z = bvh_center(bvh, bvh->order[i], 2);
+        bvh_merge(&node->lo, &node->hi, &obj->lo, &obj->hi);
+        bvh_merge(&clo, &chi, &c, &c);
+    }
+    if (count <= BVH_LEAF) return;
+
+    // 沿中心分布最长的轴，按中心的中位数分成数量相等的两半
+    chi.x -= clo.x, chi.y -= clo.y, chi.z -= clo.z;
+    axis = (chi.x >= chi.y && chi.x >= chi.z) ? 0 : ((chi.y >= chi.z) ? 1 : 2);
+    half = count / 2;
+    std::nth_element(bvh->order + first, bvh->order + first + half, bvh->order + first + count,
+        [bvh, axis](int a, int b) { return bvh_center(bvh, a, axis) < bvh_center(bvh, b, axis); });
+
+    // 两个子节点相邻存放，先占好位置再分别递归
+    left = bvh->node_count;
+    bvh->node_count += 2;
+    node->left = left;
+    bvh_build_node(bvh, left, first, half);
+    bvh_build_node(bvh, left + 1, first + half, count - half);
+}
+
+void bvh_build(bvh_t *bvh) {
+    int i;
+    if (bvh->nodes) free(bvh->nodes);
+    if (bvh->order) free(bvh->order);
+    if (bvh->visible) free(bvh->visible);
+    bvh->nodes = (bvh_node_t*)malloc(sizeof(bvh_node_t) * (bvh->count * 2 + 1));
+    bvh->order = (int*)malloc(sizeof(int) * (bvh->count + 1));
+    bvh->visible = (int*)malloc(sizeof(int) * (bvh->count + 1));
+    assert(bvh->nodes && bvh->order && bvh->visible);
+    for (i = 0; i < bvh->count; i++) bvh->order[i] = i;
+    bvh->node_count = 1;
+    if (bvh->count > 0) bvh_build_node(bvh, 0, 0, bvh->count);
+    bvh->built = 1;
+}
+
+int bvh_cull(const bvh_t *bvh, const matrix_t *transform, int *out) {
+    float planes[6][4];
+    int stack[BVH_STACK][2], top = 0, n = 0, i;
+    assert(bvh->built);
+    if (bvh->count == 0) return 0;
+    bvh_planes(planes, transform);
+    // 栈里存放节点和还需要测试的平面（位掩码），整个在某个平面内的子树不再测它
+    stack[top][0] = 0, stack[top][1] = 0x3f, top++;
+    while (top > 0) {
+        const bvh_node_t *node;
+        int mask, k;
+        top--;
+        node = &bvh->nodes[stack[top][0]];
+        mask = stack[top][1];
+        for (k = 0; k < 6; k++) {
+            int r;
+            if ((mask & (1 << k)) == 0) continue;
+            r = bvh_plane_test(planes[k], &node->lo, &node->hi);
+            if (r < 0) break;
+            if (r > 0) mask &= ~(1 << k);
+        }
+        if (k < 6) continue;
+        if (mask == 0) {
+            for (i = 0; i < node->count; i++) out[n++] = bvh->order[node->first + i];
+            continue;
+        }
+        if (node->left < 0) {
+            // 叶子：逐个测试物体自己的包围盒
+            for (i = 0; i < node->count; i++) {
+                int id = bvh->order[node->first + i];
+                const bvh_object_t *obj = &bvh->objects[id];
+                for (k = 0; k < 6; k++) {
+                    if ((mask & (1 << k)) && bvh_plane_test(planes[k], &obj->lo, &obj->hi) < 0) break;
+                }
+                if (k == 6) out[n++] = id;
+            }
+            continue;
+        }
+        assert(top + 2 <= BVH_STACK);
+        stack[top][0] = node->left + 1, stack[top][1] = mask, top++;
+        stack[top][0] = node->left, stack[top][1] = mask, top++;
+    }
+    // 按加入的顺序输出，绘制顺序与不剔除时一致
+    std::sort(out, out + n);
+    return n;
+}
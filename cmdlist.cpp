@@ -0,0 +1,69 @@
+#include "mini3d.h"
+
+#include <algorithm>
+#include <functional>
+
+//=====================================================================
+// 命令列表：draw 先记录下来，回放之前按渲染状态、纹理分组，组内按物体到摄像机的深度
+// 由近到远排序。分块模式下换纹理要先 device_flush，分组之后每种纹理只换一次；
+// 由近到远画时后面的物体大多被层次 z 整块跳过。
+// 物体中心在记录时就变换到世界空间，排序只需要每个命令一次点积，
+// 场景结构不变时列表跨帧保留，摄像机动了只重新 cmdlist_sort。
+//=====================================================================
+
+void cmdlist_init(cmdlist_t *list) {
+    memset(list, 0, sizeof(cmdlist_t));
+}
+
+void cmdlist_destroy(cmdlist_t *list) {
+    if (list->cmds) free(list->cmds);
+    if (list->order) free(list->order);
+    memset(list, 0, sizeof(cmdlist_t));
+}
+
+void cmdlist_reset(cmdlist_t *list) {
+    list->count = 0;
+}
+
+int cmdlist_draw(cmdlist_t *list, const mesh_t *mesh, const matrix_t *world, const texture_t *tex, int render_state) {
+    draw_cmd_t *cmd;
+    vector_t c;
+    if (list->count >= list->max) {
+        list->max = (list->max > 0) ? list->max * 2 : 64;
+        list->cmds = (draw_cmd_t*)realloc(list->cmds, sizeof(draw_cmd_t) * list->max);
+        list->order = (int*)realloc(list->order, sizeof(int) * list->max);
+        assert(list->cmds && list->order);
+    }
+    cmd = &list->cmds[list->count];
+    cmd->mesh = mesh;
+    cmd->tex = (render_state & RENDER_STATE_TEXTURE) ? tex : NULL;     // 不用纹理的命令不参与纹理分组
+    cmd->render_state = render_state;
+    cmd->world = *world;
+    c.x = (mesh->lo.x + mesh->hi.x) * 0.5f;
+    c.y = (mesh->lo.y + mesh->hi.y) * 0.5f;
+    c.z = (mesh->lo.z + mesh->hi.z) * 0.5f;
+    c.w = 1.0f;
+    matrix_apply(&cmd->center, &c, world);
+    cmd->depth = 0.0f;
+    // 排序之前按记录的顺序回放
+    list->order[list->count] = list->count;
+    return list->count++;
+}
+
+void cmdlist_sort(cmdlist_t *list, const matrix_t *view) {
+    draw_cmd_t *cmds = list->cmds;
+    int i;
+    // 行向量 p * view 的 z 分量：摄像机空间里沿视线方向的距离
+    for (i = 0; i < list->count; i++) {
+        const point_t *c = &cmds[i].center;
+        cmds[i].depth = c->x * view->m[0][2] + c->y * view->m[1][2] + c->z * view->m[2][2] + view->m[3][2];
+    }
+    // 深度相同时按记录顺序，回放顺序是确定的
+    std::sort(list->order, list->order + list->count, [cmds](int a, int b) {
+        const draw_cmd_t *x = &cmds[a], *y = &cmds[b];
+        if (x->render_state != y->render_state) return x->render_state < y->render_state;
+        if (x->tex != y->tex) return std::less<const texture_t*>()(x->tex, y->tex);
+        if (x->depth != y->depth) return x->depth < y->depth;
+        return a < b;
+    });
+}
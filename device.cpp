@@ -1,86 +1,245 @@
 #include "mini3d.h"
+#include "tiler.h"
 
-// 豸ʼfbΪⲿ֡棬 NULL ⲿ֡棨ÿ 4ֽڶ룩
+// 设备初始化，fb为外部帧缓存，非 NULL 将引用外部帧缓存（每行 width * 4 字节）。
+// framebuffer 和 zbuffer 为一块 64 字节对齐的内存，按基址加行距寻址，不再用行指针表；
+// 行距取到 16 个像素的倍数，每行都从缓存行开始
 void Device::device_init(int width, int height, void *fb) {
-    int need = sizeof(void*) * (height * 2 + 1024) + width * height * 8;
-    char *ptr = (char*)malloc(need + 64);
-    char *framebuf, *zbuf;
-    int j;
-    assert(ptr);
-    this->framebuffer = (UINT32**)ptr;
-    this->zbuffer = (float**)(ptr + sizeof(void*) * height);
-    ptr += sizeof(void*) * height * 2;
-    this->texture = (UINT32**)ptr;
-    ptr += sizeof(void*) * 1024;
-    framebuf = (char*)ptr;
-    zbuf = (char*)ptr + width * height * 4;
-    ptr += width * height * 8;
-    if (fb != NULL) framebuf = (char*)fb;
-    for (j = 0; j < height; j++) {
-        this->framebuffer[j] = (UINT32*)(framebuf + width * 4 * j);
-        this->zbuffer[j] = (float*)(zbuf + width * 4 * j);
-    }
-    this->texture[0] = (UINT32*)ptr;
-    this->texture[1] = (UINT32*)(ptr + 16);
-    memset(this->texture[0], 0, 64);
-    this->tex_width = 2;
-    this->tex_height = 2;
-    this->max_u = 1.0f;
-    this->max_v = 1.0f;
+    static const UINT32 blank[4] = { 0, 0, 0, 0 };
+    int stride = (width + 15) & ~15;
+    size_t plane = (size_t)stride * height * 4;
+    char *ptr;
+    this->surface = (char*)malloc(plane * ((fb != NULL) ? 1 : 2) + 64);
+    assert(this->surface);
+    ptr = (char*)(((size_t)this->surface + 63) & ~(size_t)63);
+    this->zbuffer = ptr;
+    this->zb_pitch = stride * 4;
+    this->depth_format = DEPTH_FLOAT;
+    this->depth_scale = 1.0f;
+    if (fb != NULL) {
+        this->framebuffer = (UINT32*)fb;
+        this->fb_stride = width;
+    }
+    else {
+        this->framebuffer = (UINT32*)(ptr + plane);
+        this->fb_stride = stride;
+    }
+    this->hiz_w = (width + HIZ_SIZE - 1) / HIZ_SIZE;
+    this->hiz_h = (height + HIZ_SIZE - 1) / HIZ_SIZE;
+    this->hiz = (float*)malloc(sizeof(float) * this->hiz_w * this->hiz_h);
+    this->hiz_count = (unsigned short*)malloc(sizeof(unsigned short) * this->hiz_w * this->hiz_h);
+    assert(this->hiz && this->hiz_count);
+    memset(this->hiz, 0, sizeof(float) * this->hiz_w * this->hiz_h);
+    memset(this->hiz_count, 0, sizeof(unsigned short) * this->hiz_w * this->hiz_h);
+    this->zclear = (unsigned char*)malloc(this->hiz_w * this->hiz_h);
+    this->clear_color = (UINT32*)malloc(sizeof(UINT32) * height);
+    assert(this->zclear && this->clear_color);
+    memset(this->zclear, 1, this->hiz_w * this->hiz_h);
+    this->clear_mode = -1;
+    texture_init(&this->tex_own, blank, 8, 2, 2);
+    this->tex = &this->tex_own;
+    this->tex_level = &this->tex->level[0];
+    this->tex_lerp = 0;
+    memset(&this->sampler, 0, sizeof(sampler_t));
     this->width = width;
     this->height = height;
     this->background = 0xc0c0c0;
     this->foreground = 0;
+    this->clip_x0 = 0;
+    this->clip_y0 = 0;
+    this->clip_x1 = width;
+    this->clip_y1 = height;
+    this->tiler = NULL;
+    memset(&this->post_pos, 0, sizeof(vector_soa_t));
+    memset(&this->post_clip, 0, sizeof(vector_soa_t));
+    memset(&this->post_screen, 0, sizeof(vector_soa_t));
+    this->post_cvv = NULL;
+    this->post_max = 0;
+    this->visibility = 0;
+    this->vbuffer = NULL;
+    this->visible = NULL;
+    this->visible_count = 0;
+    this->visible_max = 0;
+    this->visible_id = 0;
+    this->kernel = NULL;       // device_raster_triangle 每个三角形选择
     transform_init(&this->transform, width, height);
     this->render_state = RENDER_STATE_WIREFRAME;
+    this->cull_mode = CULL_NONE;
+    this->rasterizer = RASTERIZER_SCANLINE;
+#ifdef MINI3D_STATS
+    this->overdraw = (unsigned short*)malloc(sizeof(unsigned short) * width * height);
+    assert(this->overdraw);
+    device_stats_reset();
+#endif
 }
 
-// ɾ豸
+// 删除设备
 void Device::device_destroy(Device *device) {
-    if (this->framebuffer)
-        free(this->framebuffer);
+    if (this->tiler)
+        delete this->tiler;
+    this->tiler = NULL;
+    if (this->post_pos.x)
+        free(this->post_pos.x);
+    memset(&this->post_pos, 0, sizeof(vector_soa_t));
+    memset(&this->post_clip, 0, sizeof(vector_soa_t));
+    memset(&this->post_screen, 0, sizeof(vector_soa_t));
+    this->post_cvv = NULL;
+    this->post_max = 0;
+    if (this->vbuffer)
+        free(this->vbuffer);
+    if (this->visible)
+        free(this->visible);
+    this->vbuffer = NULL;
+    this->visible = NULL;
+    this->visible_count = 0;
+    this->visible_max = 0;
+    this->visibility = 0;
+    if (this->surface)
+        free(this->surface);
+    this->surface = NULL;
     this->framebuffer = NULL;
     this->zbuffer = NULL;
-    this->texture = NULL;
+    texture_destroy(&this->tex_own);
+    this->tex = NULL;
+    this->tex_level = NULL;
+    if (this->hiz)
+        free(this->hiz);
+    if (this->hiz_count)
+        free(this->hiz_count);
+    this->hiz = NULL;
+    this->hiz_count = NULL;
+    if (this->zclear)
+        free(this->zclear);
+    if (this->clear_color)
+        free(this->clear_color);
+    this->zclear = NULL;
+    this->clear_color = NULL;
+#ifdef MINI3D_STATS
+    if (this->overdraw)
+        free(this->overdraw);
+    this->overdraw = NULL;
+#endif
 }
 
-// õǰ
+// 设置当前纹理：复制到分块存放的第 0 层并生成 mip 链，之后 bits 可以释放
 void Device::device_set_texture(void *bits, long pitch, int w, int h) {
-    char *ptr = (char*)bits;
-    int j;
-    assert(w <= 1024 && h <= 1024);
-    for (j = 0; j < h; ptr += pitch, j++) 	// ¼ÿָ
-        this->texture[j] = (UINT32*)ptr;
-    this->tex_width = w;
-    this->tex_height = h;
-    this->max_u = (float)(w - 1);
-    this->max_v = (float)(h - 1);
-}
-
-//  framebuffer  zbuffer
+    device_flush();     // 分块模式下先画完引用旧纹理的三角形
+    texture_destroy(&this->tex_own);
+    texture_init(&this->tex_own, bits, pitch, w, h);
+    this->tex = &this->tex_own;
+    this->tex_level = &this->tex->level[0];
+}
+
+// 使用外部的纹理对象，NULL 恢复为 device_set_texture 设置的纹理
+void Device::device_bind_texture(const texture_t *tex) {
+    device_flush();
+    this->tex = (tex != NULL) ? tex : &this->tex_own;
+    this->tex_level = &this->tex->level[0];
+}
+
+// 设置纹理采样器，分块模式下先画完用旧采样器提交的三角形
+void Device::device_set_sampler(int filter, int address_u, int address_v) {
+    device_flush();
+    this->sampler.filter = filter;
+    this->sampler.address_u = address_u;
+    this->sampler.address_v = address_v;
+    this->tex_lerp = 0;
+}
+
+// 用颜色 cc 填满一行像素，对齐到 16 字节之后每次写 16 个像素。
+// 不用绕过缓存的流式写入：随后光栅化还要写同一块 framebuffer，留在缓存里更快
+static void device_fill_row(UINT32 *dst, int n, UINT32 cc) {
+    int x = 0;
+#ifdef MINI3D_SSE2
+    __m128i c = _mm_set1_epi32((int)cc);
+    for (; x < n && (((size_t)(dst + x)) & 15) != 0; x++) dst[x] = cc;
+    for (; x + 16 <= n; x += 16) {
+        _mm_store_si128((__m128i*)(dst + x), c);
+        _mm_store_si128((__m128i*)(dst + x + 4), c);
+        _mm_store_si128((__m128i*)(dst + x + 8), c);
+        _mm_store_si128((__m128i*)(dst + x + 12), c);
+    }
+    for (; x + 4 <= n; x += 4) _mm_store_si128((__m128i*)(dst + x), c);
+#endif
+    for (; x < n; x++) dst[x] = cc;
+}
+
+// 清空 framebuffer 和 zbuffer：每行的背景颜色只在模式或者 background 改变时重新计算；
+// zbuffer 不在这里清零，只把每个 8x8 分块标记为待清零，光栅化第一次画到分块时再清
 void Device::device_clear(int mode) {
-    int y, x, height = this->height;
-    for (y = 0; y < this->height; y++) {
-        UINT32 *dst = this->framebuffer[y];
-        UINT32 cc = (height - 1 - y) * 230 / (height - 1);
-        cc = (cc << 16) | (cc << 8) | cc;
-        if (mode == 0) cc = this->background;
-        for (x = this->width; x > 0; dst++, x--) dst[0] = cc;
+    int y, height = this->height;
+    device_flush();
+    if (mode != this->clear_mode || (mode == 0 && this->background != this->clear_background)) {
+        for (y = 0; y < height; y++) {
+            UINT32 cc = (height > 1) ? (height - 1 - y) * 230 / (height - 1) : 230;
+            cc = (cc << 16) | (cc << 8) | cc;
+            this->clear_color[y] = (mode == 0) ? this->background : cc;
+        }
+        this->clear_mode = mode;
+        this->clear_background = this->background;
     }
-    for (y = 0; y < this->height; y++) {
-        float *dst = this->zbuffer[y];
-        for (x = this->width; x > 0; dst++, x--) dst[0] = 0.0f;
+    for (y = 0; y < height; y++)
+        device_fill_row(this->framebuffer + y * this->fb_stride, this->width, this->clear_color[y]);
+    memset(this->zclear, 1, this->hiz_w * this->hiz_h);
+    memset(this->hiz, 0, sizeof(float) * this->hiz_w * this->hiz_h);
+    memset(this->hiz_count, 0, sizeof(unsigned short) * this->hiz_w * this->hiz_h);
+}
+
+// 切换深度格式：已经记录的绘制按原来的格式画完，之后 zbuffer 整个作废。
+// 16 位格式每行按 32 个像素对齐，行距不超过浮点格式的，原来的内存够用
+void Device::device_set_depth(int format) {
+    int stride = (this->width + 15) & ~15;
+    device_flush();
+    assert(format >= 0 && format < DEPTH_FORMATS);
+    this->depth_format = format;
+    if (format == DEPTH_16) {
+        this->zb_pitch = ((this->width + 31) & ~31) * 2;
+        this->depth_scale = (float)DEPTH_16_MAX / DEPTH_RHW_MAX;
     }
+    else {
+        this->zb_pitch = stride * 4;
+        this->depth_scale = (format == DEPTH_24) ? (float)DEPTH_24_MAX / DEPTH_RHW_MAX : 1.0f;
+    }
+    memset(this->zclear, 1, this->hiz_w * this->hiz_h);
+    memset(this->hiz, 0, sizeof(float) * this->hiz_w * this->hiz_h);
+    memset(this->hiz_count, 0, sizeof(unsigned short) * this->hiz_w * this->hiz_h);
 }
 
-// 
+// 像素矩形 [x0, x1) x [y0, y1) 覆盖到的分块里，device_clear 之后还没有清零的 zbuffer 现在清零，
+// 可见性缓存同时置为 -1。光栅化在读写 zbuffer 之前调用，矩形可以比实际画到的范围大
+void Device::device_zclear_resolve(int y0, int y1, int x0, int x1) {
+    int tx, ty, y, k;
+    int bytes = (this->depth_format == DEPTH_16) ? 2 : 4;
+    for (ty = y0 / HIZ_SIZE; ty * HIZ_SIZE < y1; ty++) {
+        unsigned char *flag = this->zclear + ty * this->hiz_w;
+        int ye = (ty + 1) * HIZ_SIZE;
+        if (ye > this->height) ye = this->height;
+        for (tx = x0 / HIZ_SIZE; tx * HIZ_SIZE < x1; tx++) {
+            int x = tx * HIZ_SIZE, xe = x + HIZ_SIZE;
+            if (flag[tx] == 0) continue;
+            flag[tx] = 0;
+            if (xe > this->width) xe = this->width;
+            // 三种格式的最远深度都是全 0（24 位格式的高 8 位一起清零）
+            for (y = ty * HIZ_SIZE; y < ye; y++)
+                memset((char*)this->zbuffer + y * this->zb_pitch + x * bytes, 0, (xe - x) * bytes);
+            if (this->vbuffer) {
+                for (y = ty * HIZ_SIZE; y < ye; y++) {
+                    int *vbuffer = this->vbuffer + y * this->width;
+                    for (k = x; k < xe; k++) vbuffer[k] = -1;
+                }
+            }
+        }
+    }
+}
+
+// 画点
 void Device::device_pixel(int x, int y, UINT32 color) {
-    if (((UINT32)x) < (UINT32)this->width && ((UINT32)y) < (UINT32)this->height) {
-        this->framebuffer[y][x] = color;
+    if (x >= this->clip_x0 && x < this->clip_x1 && y >= this->clip_y0 && y < this->clip_y1) {
+        this->framebuffer[y * this->fb_stride + x] = color;
     }
 }
 
-// ߶
+// 绘制线段
 void Device::device_draw_line(int x1, int y1, int x2, int y2, UINT32 c) {
     int x, y, rem = 0;
     if (x1 == x2 && y1 == y2) {
@@ -128,135 +287,910 @@ void Device::device_draw_line(int x1, int y1, int x2, int y2, UINT32 c) {
     }
 }
 
-// ȡ
+// 根据坐标读取纹理：默认的最近点、夹取直接在这里算，其余交给 sampler_fetch
 UINT32 Device::Device_texture_read(float u, float v) {
+    const texture_level_t *level = this->tex_level;
     int x, y;
-    u = u * this->max_u;
-    v = v * this->max_v;
+    if (this->sampler.filter | this->sampler.address_u | this->sampler.address_v)
+        return sampler_fetch(&this->sampler, level, this->tex_lerp, u, v);
+    u = u * level->max_u;
+    v = v * level->max_v;
     x = (int)(u + 0.5f);
     y = (int)(v + 0.5f);
-    x = clamp(x, 0, this->tex_width - 1);
-    y = clamp(y, 0, this->tex_height - 1);
-    return this->texture[y][x];
+    x = clamp(x, 0, level->width - 1);
+    y = clamp(y, 0, level->height - 1);
+    return level->bits[texture_offset(level, x, y)];
 }
 
+#ifdef MINI3D_STATS
+// 清零统计计数与 overdraw
+void Device::device_stats_reset() {
+    memset(&this->stats, 0, sizeof(this->stats));
+    memset(this->overdraw, 0, sizeof(unsigned short) * this->width * this->height);
+}
+
+// overdraw 热度图：0 次为黑，1 次蓝，随后依次青、绿、黄、橙，8 次及以上为红
+void Device::device_stats_heatmap(void *bits, long pitch) {
+    static const UINT32 ramp[9] = {
+        0x000000, 0x0000c0, 0x00c0c0, 0x00c000, 0x80c000,
+        0xc0c000, 0xe08000, 0xf04000, 0xff0000,
+    };
+    int x, y;
+    for (y = 0; y < this->height; y++) {
+        const unsigned short *src = this->overdraw + y * this->width;
+        UINT32 *dst = (UINT32*)((char*)bits + pitch * y);
+        for (x = 0; x < this->width; x++)
+            dst[x] = ramp[(src[x] < 8) ? src[x] : 8];
+    }
+}
+#endif
+
 
 //=====================================================================
-// Ⱦʵ
+// 渲染实现
 //=====================================================================
 
-// ɨ
-void Device::device_draw_scanline(scanline_t *scanline) {
+//---------------------------------------------------------------------
+// 扫描线内核：按渲染状态、采样器和可见性缓存分成几种，每种由模板生成一份。
+// device_raster_triangle 每个三角形查一次表，像素循环里不再判断渲染状态，
+// 扫描线起点也只计算输出用得到的属性。
+//---------------------------------------------------------------------
+#define SPAN_DEPTH                  0       // 只写 zbuffer
+#define SPAN_VISIBILITY             1       // zbuffer 加上可见性缓存里的三角形编号
+#define SPAN_COLOR                  2       // 颜色
+#define SPAN_TEXTURE                3       // 纹理，默认的最近点、夹取
+#define SPAN_SAMPLER                4       // 纹理，其余过滤和寻址方式交给采样器
+#define SPAN_KINDS                  5
 
-    UINT32 *framebuffer = this->framebuffer[scanline->y];
-    float *zbuffer = this->zbuffer[scanline->y];
-    int x = scanline->x;
-    int w = scanline->w;
-    int width = this->width;
-    int render_state = this->render_state;
-    for (; w > 0; x++, w--) {
-        if (x >= 0 && x < width) {
-            float rhw = scanline->v.rhw;
-            if (rhw >= zbuffer[x]) {
-                float w = 1.0f / rhw;
-                zbuffer[x] = rhw;
-                if (render_state & RENDER_STATE_COLOR) {
-                    float r = scanline->v.color.r * w;
-                    float g = scanline->v.color.g * w;
-                    float b = scanline->v.color.b * w;
-                    int R = (int)(r * 255.0f);
-                    int G = (int)(g * 255.0f);
-                    int B = (int)(b * 255.0f);
-                    R = clamp(R, 0, 255);
-                    G = clamp(G, 0, 255);
-                    B = clamp(B, 0, 255);
-                    framebuffer[x] = (R << 16) | (G << 8) | (B);
-                }
-                if (render_state & RENDER_STATE_TEXTURE) {
-                    float u = scanline->v.tc.u * w;
-                    float v = scanline->v.tc.v * w;
-                    UINT32 cc = Device_texture_read(u, v);
-                    framebuffer[x] = cc;
-                }
+//---------------------------------------------------------------------
+// 向量化内核：AVX2 每次 8 个像素，SSE2 每次 4 个像素。
+// 运算顺序与标量代码完全相同（v + step * i，再乘 w，除法而不是近似倒数），
+// 所以无论一条扫描线被哪个内核处理，结果都逐位一致。返回下一个待处理的 x。
+//---------------------------------------------------------------------
+#ifdef MINI3D_AVX2
+template <int KIND, int FMT>
+static int device_span_avx2(Device *device, const scanline_t *scanline, int x, int x1) {
+    UINT32 *framebuffer = device->framebuffer + scanline->y * device->fb_stride;
+    void *zbuffer = (char*)device->zbuffer + scanline->y * device->zb_pitch;
+    const float scale = device->depth_scale;
+    int *vbuffer = (KIND == SPAN_VISIBILITY) ? device->vbuffer + scanline->y * device->width : NULL;
+    const vertex_t *start = &scanline->v;
+    const vertex_t *step = &scanline->step;
+    const __m256 lane = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i zero = _mm256_setzero_si256();
+    for (; x + 8 <= x1; x += 8) {
+        __m256 i = _mm256_add_ps(_mm256_set1_ps((float)(x - scanline->x)), lane);
+        __m256 rhw = _mm256_add_ps(_mm256_set1_ps(start->rhw), _mm256_mul_ps(_mm256_set1_ps(step->rhw), i));
+        __m256i m = depth_test_avx2<FMT>(zbuffer, x, rhw, scale);
+        __m256 w;
+        __m256i cc;
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+        DEVICE_STAT(device->stats.pixels += 8);
+        DEVICE_STAT(for (int l = 0; l < 8; l++) {
+            if (mask & (1 << l)) {
+                device->stats.written++;
+                device->overdraw[scanline->y * device->width + x + l]++;
+            }
+            else {
+                device->stats.zfail++;
+            }
+        });
+        if (mask == 0) continue;
+        if (KIND == SPAN_DEPTH) continue;
+        if (KIND == SPAN_VISIBILITY) {
+            _mm256_maskstore_epi32(vbuffer + x, m, _mm256_set1_epi32(device->visible_id));
+            continue;
+        }
+        w = _mm256_div_ps(one, rhw);
+        if (KIND == SPAN_TEXTURE || KIND == SPAN_SAMPLER) {
+            __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(start->tc.u),
+                _mm256_mul_ps(_mm256_set1_ps(step->tc.u), i)), w);
+            __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(start->tc.v),
+                _mm256_mul_ps(_mm256_set1_ps(step->tc.v), i)), w);
+            const texture_level_t *level = device->tex_level;
+            if (KIND == SPAN_SAMPLER) {
+                // 过滤和其余寻址方式分成两半交给 SSE2 的采样器
+                __m128i lo = sampler_fetch_sse2(&device->sampler, level, device->tex_lerp,
+                    _mm256_castps256_ps128(u), _mm256_castps256_ps128(v));
+                __m128i hi = sampler_fetch_sse2(&device->sampler, level, device->tex_lerp,
+                    _mm256_extractf128_ps(u, 1), _mm256_extractf128_ps(v, 1));
+                cc = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            }
+            else {
+                const __m128i s = _mm_cvtsi32_si128(level->shift);
+                const __m256i k = _mm256_set1_epi32((1 << level->shift) - 1);
+                __m256i tx, ty, index;
+                u = _mm256_add_ps(_mm256_mul_ps(u, _mm256_set1_ps(level->max_u)), _mm256_set1_ps(0.5f));
+                v = _mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(level->max_v)), _mm256_set1_ps(0.5f));
+                tx = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(u), zero),
+                    _mm256_set1_epi32(level->width - 1));
+                ty = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(v), zero),
+                    _mm256_set1_epi32(level->height - 1));
+                // 与 texture_offset 相同的分块下标
+                index = _mm256_mullo_epi32(_mm256_srl_epi32(ty, s), _mm256_set1_epi32(level->stride));
+                index = _mm256_add_epi32(index, _mm256_sll_epi32(_mm256_srl_epi32(tx, s), _mm_add_epi64(s, s)));
+                index = _mm256_add_epi32(index, _mm256_sll_epi32(_mm256_and_si256(ty, k), s));
+                index = _mm256_add_epi32(index, _mm256_and_si256(tx, k));
+                cc = _mm256_mask_i32gather_epi32(zero, (const int*)level->bits, index, m, 4);
+            }
+        }
+        else {
+            const __m256 s = _mm256_set1_ps(255.0f);
+            const __m256i hi = _mm256_set1_epi32(255);
+            __m256 r = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(start->color.r),
+                _mm256_mul_ps(_mm256_set1_ps(step->color.r), i)), w);
+            __m256 g = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(start->color.g),
+                _mm256_mul_ps(_mm256_set1_ps(step->color.g), i)), w);
+            __m256 b = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(start->color.b),
+                _mm256_mul_ps(_mm256_set1_ps(step->color.b), i)), w);
+            __m256i R = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(r, s)), zero), hi);
+            __m256i G = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(g, s)), zero), hi);
+            __m256i B = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(b, s)), zero), hi);
+            cc = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(R, 16), _mm256_slli_epi32(G, 8)), B);
+        }
+        _mm256_maskstore_epi32((int*)(framebuffer + x), m, cc);
+    }
+    return x;
+}
+#endif
+
+#ifdef MINI3D_SSE2
+template <int KIND, int FMT>
+static int device_span_sse2(Device *device, const scanline_t *scanline, int x, int x1) {
+    UINT32 *framebuffer = device->framebuffer + scanline->y * device->fb_stride;
+    void *zbuffer = (char*)device->zbuffer + scanline->y * device->zb_pitch;
+    const float scale = device->depth_scale;
+    const __m128i all = _mm_set1_epi32(-1);
+    int *vbuffer = (KIND == SPAN_VISIBILITY) ? device->vbuffer + scanline->y * device->width : NULL;
+    const vertex_t *start = &scanline->v;
+    const vertex_t *step = &scanline->step;
+    const __m128 lane = _mm_set_ps(3, 2, 1, 0);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 4 <= x1; x += 4) {
+        __m128 i = _mm_add_ps(_mm_set1_ps((float)(x - scanline->x)), lane);
+        __m128 rhw = _mm_add_ps(_mm_set1_ps(start->rhw), _mm_mul_ps(_mm_set1_ps(step->rhw), i));
+        __m128i m = depth_test_sse2<FMT>(zbuffer, x, rhw, scale, all);
+        __m128 w;
+        __m128i cc, old;
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(m));
+        DEVICE_STAT(device->stats.pixels += 4);
+        DEVICE_STAT(for (int l = 0; l < 4; l++) {
+            if (mask & (1 << l)) {
+                device->stats.written++;
+                device->overdraw[scanline->y * device->width + x + l]++;
+            }
+            else {
+                device->stats.zfail++;
+            }
+        });
+        if (mask == 0) continue;
+        if (KIND == SPAN_DEPTH) continue;
+        if (KIND == SPAN_VISIBILITY) {
+            old = _mm_loadu_si128((const __m128i*)(vbuffer + x));
+            cc = _mm_set1_epi32(device->visible_id);
+            _mm_storeu_si128((__m128i*)(vbuffer + x), _mm_or_si128(_mm_and_si128(m, cc), _mm_andnot_si128(m, old)));
+            continue;
+        }
+        w = _mm_div_ps(one, rhw);
+        if (KIND == SPAN_TEXTURE || KIND == SPAN_SAMPLER) {
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(start->tc.u),
+                _mm_mul_ps(_mm_set1_ps(step->tc.u), i)), w);
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(start->tc.v),
+                _mm_mul_ps(_mm_set1_ps(step->tc.v), i)), w);
+            const texture_level_t *level = device->tex_level;
+            if (KIND == SPAN_SAMPLER) {
+                cc = sampler_fetch_sse2(&device->sampler, level, device->tex_lerp, u, v);
+            }
+            else {
+                __m128i tx, ty;
+                int index[4];
+                UINT32 texel[4];
+                u = _mm_add_ps(_mm_mul_ps(u, _mm_set1_ps(level->max_u)), _mm_set1_ps(0.5f));
+                v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(level->max_v)), _mm_set1_ps(0.5f));
+                tx = clamp_sse2(_mm_cvttps_epi32(u), zero, _mm_set1_epi32(level->width - 1));
+                ty = clamp_sse2(_mm_cvttps_epi32(v), zero, _mm_set1_epi32(level->height - 1));
+                _mm_storeu_si128((__m128i*)index, texture_offset_sse2(level, tx, ty));
+                texel[0] = level->bits[index[0]];
+                texel[1] = level->bits[index[1]];
+                texel[2] = level->bits[index[2]];
+                texel[3] = level->bits[index[3]];
+                cc = _mm_loadu_si128((const __m128i*)texel);
             }
         }
-        vertex_add(&scanline->v, &scanline->step);
-        if (x >= width) break;
+        else {
+            const __m128 s = _mm_set1_ps(255.0f);
+            const __m128i hi = _mm_set1_epi32(255);
+            __m128 r = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(start->color.r),
+                _mm_mul_ps(_mm_set1_ps(step->color.r), i)), w);
+            __m128 g = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(start->color.g),
+                _mm_mul_ps(_mm_set1_ps(step->color.g), i)), w);
+            __m128 b = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(start->color.b),
+                _mm_mul_ps(_mm_set1_ps(step->color.b), i)), w);
+            __m128i R = clamp_sse2(_mm_cvttps_epi32(_mm_mul_ps(r, s)), zero, hi);
+            __m128i G = clamp_sse2(_mm_cvttps_epi32(_mm_mul_ps(g, s)), zero, hi);
+            __m128i B = clamp_sse2(_mm_cvttps_epi32(_mm_mul_ps(b, s)), zero, hi);
+            cc = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(R, 16), _mm_slli_epi32(G, 8)), B);
+        }
+        old = _mm_loadu_si128((const __m128i*)(framebuffer + x));
+        cc = _mm_or_si128(_mm_and_si128(m, cc), _mm_andnot_si128(m, old));
+        _mm_storeu_si128((__m128i*)(framebuffer + x), cc);
+    }
+    return x;
+}
+#endif
+
+// 扫描线的一段：像素属性按 v + step * i 直接求值，这样同一条扫描线无论从哪里被裁开，
+// 每个像素的结果都完全一致。主体交给向量化内核，剩下不足一组的像素逐个处理
+template <int KIND, int FMT>
+static void device_span(Device *device, const scanline_t *scanline, int x0, int x1) {
+    UINT32 *framebuffer = device->framebuffer + scanline->y * device->fb_stride;
+    void *zbuffer = (char*)device->zbuffer + scanline->y * device->zb_pitch;
+    int *vbuffer = (KIND == SPAN_VISIBILITY) ? device->vbuffer + scanline->y * device->width : NULL;
+    const vertex_t *start = &scanline->v;
+    const vertex_t *step = &scanline->step;
+    int x = x0;
+#ifdef MINI3D_AVX2
+    if (x1 - x >= 8) x = device_span_avx2<KIND, FMT>(device, scanline, x, x1);
+#endif
+#ifdef MINI3D_SSE2
+    if (x1 - x >= 4) x = device_span_sse2<KIND, FMT>(device, scanline, x, x1);
+#endif
+    for (; x < x1; x++) {
+        float i = (float)(x - scanline->x);
+        float rhw = start->rhw + step->rhw * i;
+        float w;
+        DEVICE_STAT(device->stats.pixels++);
+        if (!depth_test<FMT>(zbuffer, x, rhw, device->depth_scale)) {
+            DEVICE_STAT(device->stats.zfail++);
+            continue;
+        }
+        DEVICE_STAT(device->stats.written++);
+        DEVICE_STAT(device->overdraw[scanline->y * device->width + x]++);
+        if (KIND == SPAN_DEPTH) continue;
+        if (KIND == SPAN_VISIBILITY) {
+            vbuffer[x] = device->visible_id;
+            continue;
+        }
+        w = 1.0f / rhw;
+        if (KIND == SPAN_TEXTURE || KIND == SPAN_SAMPLER) {
+            const texture_level_t *level = device->tex_level;
+            float u = (start->tc.u + step->tc.u * i) * w;
+            float v = (start->tc.v + step->tc.v * i) * w;
+            if (KIND == SPAN_SAMPLER) {
+                framebuffer[x] = sampler_fetch(&device->sampler, level, device->tex_lerp, u, v);
+            }
+            else {
+                // 与 Device_texture_read 的最近点、夹取相同
+                int tx = (int)(u * level->max_u + 0.5f);
+                int ty = (int)(v * level->max_v + 0.5f);
+                tx = clamp(tx, 0, level->width - 1);
+                ty = clamp(ty, 0, level->height - 1);
+                framebuffer[x] = level->bits[texture_offset(level, tx, ty)];
+            }
+        }
+        else {
+            float r = (start->color.r + step->color.r * i) * w;
+            float g = (start->color.g + step->color.g * i) * w;
+            float b = (start->color.b + step->color.b * i) * w;
+            int R = (int)(r * 255.0f);
+            int G = (int)(g * 255.0f);
+            int B = (int)(b * 255.0f);
+            R = clamp(R, 0, 255);
+            G = clamp(G, 0, 255);
+            B = clamp(B, 0, 255);
+            framebuffer[x] = (R << 16) | (G << 8) | (B);
+        }
+    }
+}
+
+// 每种内核的扫描线起点只计算它要用的属性，下标为深度格式和 SPAN_DEPTH 等
+#define DEVICE_SPAN_KERNELS(FMT) { \
+    { trapezoid_scan_line_attr<0>, device_span<SPAN_DEPTH, FMT> }, \
+    { trapezoid_scan_line_attr<0>, device_span<SPAN_VISIBILITY, FMT> }, \
+    { trapezoid_scan_line_attr<VERTEX_ATTR_COLOR>, device_span<SPAN_COLOR, FMT> }, \
+    { trapezoid_scan_line_attr<VERTEX_ATTR_TC>, device_span<SPAN_TEXTURE, FMT> }, \
+    { trapezoid_scan_line_attr<VERTEX_ATTR_TC>, device_span<SPAN_SAMPLER, FMT> }, \
+}
+
+static const span_kernel_t device_span_kernels[DEPTH_FORMATS][SPAN_KINDS] = {
+    DEVICE_SPAN_KERNELS(DEPTH_FLOAT),
+    DEVICE_SPAN_KERNELS(DEPTH_16),
+    DEVICE_SPAN_KERNELS(DEPTH_24),
+};
+
+// 按当前的渲染状态、采样器和可见性缓存选择扫描线内核
+static const span_kernel_t *device_span_select(const Device *device) {
+    const sampler_t *sampler = &device->sampler;
+    const span_kernel_t *kernels = device_span_kernels[device->depth_format];
+    if (device->visibility) return &kernels[SPAN_VISIBILITY];
+    if (device->render_state & RENDER_STATE_TEXTURE)
+        return &kernels[(sampler->filter | sampler->address_u | sampler->address_v) ?
+            SPAN_SAMPLER : SPAN_TEXTURE];
+    if (device->render_state & RENDER_STATE_COLOR) return &kernels[SPAN_COLOR];
+    return &kernels[SPAN_DEPTH];
+}
+//---------------------------------------------------------------------
+// 层次 z：每个 8x8 分块记录最小的 rhw，也就是分块里最远的深度。
+// zbuffer 的值只会在 device_clear 时变小，所以旧的最小值始终是一个保守的下界：
+// 画像素时不碰层次 z，一个梯形画完一行分块（或者半空间的一个像素块）之后，把画过的
+// 包围矩形面积累计到分块上，累计数达到分块面积的分块才重新计算。这样读 zbuffer 的开销
+// 摊下来每个像素不超过一次，小三角形很多的场景里 hiz 会旧一点，但不会出错。
+// 一段像素的最大 rhw 小于分块的最小 rhw，这段像素就一定全部通不过深度测试。
+// 定点格式的层次 z 同样记成 rhw，取分块最小的定点深度换回 rhw 的下界。
+//---------------------------------------------------------------------
+
+// 定点格式分块 [x, xe) x [y, y + rows) 里最小的深度
+static UINT32 device_hiz_min_fixed(const Device *device, int y, int rows, int x, int xe) {
+    const char *base = (const char*)device->zbuffer + y * device->zb_pitch;
+    UINT32 m = 0xffffffffu;
+    int k;
+#ifdef MINI3D_SSE2
+    if (device->depth_format == DEPTH_16 && xe - x == HIZ_SIZE) {
+        // 16 位无符号数没有 _mm_min_epu16，翻转符号位之后用有符号的比较
+        const __m128i flip = _mm_set1_epi16((short)0x8000);
+        __m128i a = _mm_set1_epi16(0x7fff);
+        for (k = 0; k < rows; k++) {
+            // 行距是 64 字节的倍数，分块的起点是 8 的倍数，可以用对齐读
+            __m128i z = _mm_load_si128((const __m128i*)(base + k * device->zb_pitch) + x / HIZ_SIZE);
+            a = _mm_min_epi16(a, _mm_xor_si128(z, flip));
+        }
+        a = _mm_min_epi16(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+        a = _mm_min_epi16(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+        a = _mm_min_epi16(a, _mm_shufflelo_epi16(a, _MM_SHUFFLE(2, 3, 0, 1)));
+        return (UINT32)(_mm_cvtsi128_si32(a) & 0xffff) ^ 0x8000;
+    }
+#endif
+    for (; rows > 0; rows--, base += device->zb_pitch) {
+        if (device->depth_format == DEPTH_16) {
+            const unsigned short *zbuffer = (const unsigned short*)base;
+            for (k = x; k < xe; k++)
+                if (zbuffer[k] < m) m = zbuffer[k];
+        }
+        else {
+            const UINT32 *zbuffer = (const UINT32*)base;
+            for (k = x; k < xe; k++)
+                if ((zbuffer[k] & DEPTH_24_MAX) < m) m = zbuffer[k] & DEPTH_24_MAX;
+        }
+    }
+    return m;
+}
+
+void Device::device_hiz_update(int y0, int y1, int x0, int x1) {
+    int ty = y0 / HIZ_SIZE, tx, y;
+    int rows = this->height - ty * HIZ_SIZE;
+    if (rows > HIZ_SIZE) rows = HIZ_SIZE;
+    for (tx = x0 / HIZ_SIZE; tx * HIZ_SIZE < x1; tx++) {
+        int t = ty * this->hiz_w + tx, x = tx * HIZ_SIZE, xe = x + HIZ_SIZE;
+        int cs = (x < x0) ? x0 : x, ce = (xe > x1) ? x1 : xe;
+        float m;
+        this->hiz_count[t] += (unsigned short)((y1 - y0) * (ce - cs));
+        if (this->hiz_count[t] < rows * ((xe < this->width) ? HIZ_SIZE : this->width - x)) continue;
+        this->hiz_count[t] = 0;
+        if (this->depth_format != DEPTH_FLOAT) {
+            if (xe > this->width) xe = this->width;
+            m = depth_rhw_bound(device_hiz_min_fixed(this, ty * HIZ_SIZE, rows, x, xe), this->depth_scale);
+            this->hiz[t] = m;
+            continue;
+        }
+#ifdef MINI3D_SSE2
+        if (xe <= this->width) {
+            __m128 a = _mm_set1_ps(3.402823466e+38f);
+            for (y = 0; y < rows; y++) {
+                // 行首 64 字节对齐，分块的起点是 8 的倍数，可以用对齐读
+                const float *zbuffer = (const float*)((const char*)this->zbuffer + (ty * HIZ_SIZE + y) * this->zb_pitch) + x;
+                a = _mm_min_ps(a, _mm_min_ps(_mm_load_ps(zbuffer), _mm_load_ps(zbuffer + 4)));
+            }
+            a = _mm_min_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 3, 2)));
+            a = _mm_min_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+            this->hiz[t] = _mm_cvtss_f32(a);
+            continue;
+        }
+#endif
+        if (xe > this->width) xe = this->width;
+        m = ((const float*)((const char*)this->zbuffer + ty * HIZ_SIZE * this->zb_pitch))[x];
+        for (y = 0; y < rows; y++) {
+            const float *zbuffer = (const float*)((const char*)this->zbuffer + (ty * HIZ_SIZE + y) * this->zb_pitch);
+            int k;
+            for (k = x; k < xe; k++)
+                if (zbuffer[k] < m) m = zbuffer[k];
+        }
+        this->hiz[t] = m;
+    }
+}
+
+// 绘制扫描线：先裁剪到 clip 区域，之后不再逐像素判断边界。
+// 再按层次 z 分块切成最多 8 个像素的小段，rhw 沿扫描线单调，每段最近的深度就在
+// step 指向的那一端，比分块最远的深度还远的小段直接跳过，其余的连起来一起画。
+// 一次测试 4 个分块，层次 z 的更新由 device_render_trap 负责
+void Device::device_draw_scanline(scanline_t *scanline, int hiz_test) {
+
+    const vertex_t *start = &scanline->v;
+    const vertex_t *step = &scanline->step;
+    const float *hiz = this->hiz + (scanline->y / HIZ_SIZE) * this->hiz_w;
+    int x0 = scanline->x;
+    int x1 = scanline->x + scanline->w;
+    int near = (step->rhw >= 0.0f) ? HIZ_SIZE - 1 : 0;
+    int tx, tx1, run;
+    if (x0 < this->clip_x0) x0 = this->clip_x0;
+    if (x1 > this->clip_x1) x1 = this->clip_x1;
+    DEVICE_STAT(this->stats.scanlines++);
+    if (x0 >= x1) return;
+    if (hiz_test == 0) {
+        device_draw_span(scanline, x0, x1);
+        return;
+    }
+    tx1 = (x1 - 1) / HIZ_SIZE;
+    run = x0;
+    for (tx = x0 / HIZ_SIZE; tx <= tx1; ) {
+        int n = (tx1 - tx + 1 < 4) ? tx1 - tx + 1 : 4;
+        int reject = 0, l;
+#ifdef MINI3D_SSE2
+        __m128i e = _mm_add_epi32(_mm_set1_epi32(tx * HIZ_SIZE + near),
+            _mm_set_epi32(3 * HIZ_SIZE, 2 * HIZ_SIZE, HIZ_SIZE, 0));
+        __m128 i, r, h;
+        e = clamp_sse2(e, _mm_set1_epi32(x0), _mm_set1_epi32(x1 - 1));
+        i = _mm_cvtepi32_ps(_mm_sub_epi32(e, _mm_set1_epi32(scanline->x)));
+        r = _mm_add_ps(_mm_set1_ps(start->rhw), _mm_mul_ps(_mm_set1_ps(step->rhw), i));
+        if (n == 4) {
+            h = _mm_loadu_ps(hiz + tx);
+        }
+        else {
+            // 不读范围外的分块：分块模式下它们属于别的线程
+            float t[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (l = 0; l < n; l++) t[l] = hiz[tx + l];
+            h = _mm_loadu_ps(t);
+        }
+        reject = _mm_movemask_ps(_mm_cmplt_ps(r, h)) & ((1 << n) - 1);
+#else
+        for (l = 0; l < n; l++) {
+            int e = clamp((tx + l) * HIZ_SIZE + near, x0, x1 - 1);
+            float r = start->rhw + step->rhw * (float)(e - scanline->x);
+            if (r < hiz[tx + l]) reject |= 1 << l;
+        }
+#endif
+        if (reject == 0) {
+            tx += n;
+            continue;
+        }
+        for (l = 0; l < n; l++, tx++) {
+            int cs = tx * HIZ_SIZE, ce = cs + HIZ_SIZE;
+            if ((reject & (1 << l)) == 0) continue;
+            if (cs < x0) cs = x0;
+            if (ce > x1) ce = x1;
+            DEVICE_STAT(this->stats.hizpixels += ce - cs);
+            if (run < cs) device_draw_span(scanline, run, cs);
+            run = ce;
+        }
+    }
+    if (run < x1) device_draw_span(scanline, run, x1);
+}
+
+// 扫描线的一段交给当前三角形的内核
+void Device::device_draw_span(const scanline_t *scanline, int x0, int x1) {
+    this->kernel->span(this, scanline, x0, x1);
+}
+
+// 梯形对层次 z 的测试：梯形内每个像素的 rhw 都是两条边四个端点 rhw 的凸组合，
+// 最大、最小值各向外放一点抵消舍入误差。返回 2 表示 [x0, x1) 覆盖到的每个分块的最小 rhw
+// 都比梯形最大的 rhw 大，整个梯形被挡住；返回 0 表示梯形最小的 rhw 不比任何分块的最小 rhw 小，
+// 扫描线上不会有小段被剔除，省掉逐段测试；其余情况返回 1
+static int device_trap_hiz_test(Device *device, const trapezoid_t *trap, int top, int bottom, int x0, int x1) {
+    const vertex_t *p[4] = { &trap->left.v1, &trap->left.v2, &trap->right.v1, &trap->right.v2 };
+    float rmax = p[0]->rhw, rmin = p[0]->rhw;
+    float hmax = 0.0f;
+    int tx, ty, k, occluded = 1;
+    for (k = 1; k < 4; k++) {
+        if (p[k]->rhw > rmax) rmax = p[k]->rhw;
+        if (p[k]->rhw < rmin) rmin = p[k]->rhw;
+    }
+    rmax *= 1.0f + 1e-5f;
+    rmin *= 1.0f - 1e-5f;
+    for (ty = top / HIZ_SIZE; ty * HIZ_SIZE < bottom; ty++) {
+        for (tx = x0 / HIZ_SIZE; tx * HIZ_SIZE < x1; tx++) {
+            float h = device->hiz[ty * device->hiz_w + tx];
+            if (rmax >= h) occluded = 0;
+            if (h > hmax) hmax = h;
+        }
     }
+    if (occluded) return 2;
+    return (rmin >= hmax) ? 0 : 1;
 }
 
-// Ⱦ
+// 按扫描线中点（裁剪之前）的导数选择 mip 层，结果与分块方式无关
+static void device_scanline_level(Device *device, const scanline_t *scanline) {
+    const vertex_t *start = &scanline->v;
+    const vertex_t *step = &scanline->step;
+    float i = (float)(scanline->w / 2);
+    float dx[3] = { step->tc.u, step->tc.v, step->rhw };
+    int lerp = 0;
+    int k = texture_select_level(device->tex, start->tc.u + step->tc.u * i,
+        start->tc.v + step->tc.v * i, start->rhw + step->rhw * i, dx, device->tex_dy,
+        (device->sampler.filter == SAMPLER_TRILINEAR) ? &lerp : NULL);
+    device->tex_level = &device->tex->level[k];
+    device->tex_lerp = lerp;
+}
+
+// 主渲染函数
 void Device::device_render_trap(trapezoid_t *trap) {
 
     scanline_t scanline;
-    int j, top, bottom;
-    top = (int)(trap->top + 0.5f);
-    bottom = (int)(trap->bottom + 0.5f);
-    for (j = top; j < bottom; j++) {
-        if (j >= 0 && j < this->height) {
-            trapezoid_edge_interp(trap, (float)j + 0.5f);
-            trapezoid_init_scan_line(trap, &scanline, j);
-            device_draw_scanline(&scanline);
+    float xl, xr;
+    const span_kernel_t *kernels = device_span_kernels[this->depth_format];
+    int texture = (this->kernel == &kernels[SPAN_TEXTURE] || this->kernel == &kernels[SPAN_SAMPLER]);
+    int j, top, bottom, x0, x1, hiz, test, by, bx0 = this->clip_x1, bx1 = this->clip_x0;
+    top = trap->top;
+    bottom = trap->bottom;
+    if (top < this->clip_y0) top = this->clip_y0;
+    if (bottom > this->clip_y1) bottom = this->clip_y1;
+    if (top >= bottom) return;
+    // 梯形内左边的 x 不小于左边两个端点中小的那个，右边同理，再外扩一个像素抵消取整
+    xl = (trap->left.v1.pos.x < trap->left.v2.pos.x) ? trap->left.v1.pos.x : trap->left.v2.pos.x;
+    xr = (trap->right.v1.pos.x > trap->right.v2.pos.x) ? trap->right.v1.pos.x : trap->right.v2.pos.x;
+    x0 = (int)floorf(xl) - 1;
+    x1 = (int)ceilf(xr) + 1;
+    if (x0 < this->clip_x0) x0 = this->clip_x0;
+    if (x1 > this->clip_x1) x1 = this->clip_x1;
+    if (x0 >= x1) return;
+    // 面积不到 4 个分块的小梯形，层次 z 的测试和更新都比直接画还贵，跳过（hiz 只会偏旧）
+    hiz = ((bottom - top) * (x1 - x0) >= 4 * HIZ_SIZE * HIZ_SIZE);
+    test = hiz ? device_trap_hiz_test(this, trap, top, bottom, x0, x1) : 0;
+    if (test == 2) {
+        DEVICE_STAT(this->stats.hiztraps++);
+        return;
+    }
+    device_zclear_resolve(top, bottom, x0, x1);
+    trapezoid_edge_start(trap, top);
+    // by 为当前这一行分块里的第一条扫描线，bx0, bx1 为扫描线覆盖的范围，
+    // 画完这一行分块后更新层次 z
+    for (j = top, by = top; j < bottom; j++, trapezoid_edge_step(trap)) {
+        this->kernel->scan_line(trap, &scanline, j);
+        // mip 层每行分块选择一次，用这一行分块里的第一条扫描线
+        if (texture && (j == top || j % HIZ_SIZE == 0)) device_scanline_level(this, &scanline);
+        device_draw_scanline(&scanline, test);
+        if (hiz && scanline.w > 0) {
+            if (scanline.x < bx0) bx0 = scanline.x;
+            if (scanline.x + scanline.w > bx1) bx1 = scanline.x + scanline.w;
+        }
+        if (hiz && ((j + 1) % HIZ_SIZE == 0 || j + 1 == bottom)) {
+            if (bx0 < this->clip_x0) bx0 = this->clip_x0;
+            if (bx1 > this->clip_x1) bx1 = this->clip_x1;
+            if (bx0 < bx1) device_hiz_update(by, j + 1, bx0, bx1);
+            bx0 = this->clip_x1, bx1 = this->clip_x0, by = j + 1;
         }
-        if (j >= this->height) break;
     }
 }
 
-//  render_state ԭʼ
+// 按 rasterizer 光栅化一个屏幕空间三角形
+void Device::device_raster_triangle(const vertex_t *t1, const vertex_t *t2, const vertex_t *t3) {
+    trapezoid_t traps[2];
+    int n;
+
+    if (this->rasterizer == RASTERIZER_HALFSPACE) {
+        device_render_halfspace(t1, t2, t3);
+        return;
+    }
+
+    // 每个三角形查一次表，选出扫描线内核
+    this->kernel = device_span_select(this);
+
+    // 拆分三角形为0-2个梯形，并且返回可用梯形数量
+    n = trapezoid_init_triangle(traps, t1, t2, t3);
+    DEVICE_STAT(this->stats.trapezoids += n);
+
+    // 纹理坐标在屏幕上是 (u * rhw, v * rhw, rhw) 的线性函数，沿 x 的梯度就是扫描线的步长，
+    // 沿 y 的梯度取梯形的平面方程，扫描线用它们选择 mip 层
+    if (n >= 1 && (this->render_state & RENDER_STATE_TEXTURE)) {
+        this->tex_dy[0] = traps[0].dy.tc.u;
+        this->tex_dy[1] = traps[0].dy.tc.v;
+        this->tex_dy[2] = traps[0].dy.rhw;
+    }
+
+    if (n >= 1) device_render_trap(&traps[0]);
+    if (n >= 2) device_render_trap(&traps[1]);
+}
+
+// 变换顶点，得到齐次坐标、cvv 检查结果，通过检查时再归一化
+void Device::device_transform_vertex(post_vertex_t *q, const vertex_t *v) {
+    transform_apply(&this->transform, &q->clip, &v->pos);
+    q->cvv = transform_check_cvv(&q->clip);
+    if (q->cvv == 0)
+        transform_homogenize(&this->transform, &q->screen, &q->clip);
+}
+
+// 根据 render_state 绘制原始三角形
 void Device::device_draw_primitive(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3) {
+    post_vertex_t q1, q2, q3;
 
-    point_t p1, p2, p3, c1, c2, c3;
-    int render_state = this->render_state;
+    // 按照 Transform 变化
+    device_transform_vertex(&q1, v1);
+    device_transform_vertex(&q2, v2);
+    device_transform_vertex(&q3, v3);
+
+    device_draw_post(v1, v2, v3, &q1, &q2, &q3);
+}
+
+// 从 draw_indexed 的 SoA 缓存取出第 i 个变换后的顶点
+void Device::device_post_fetch(post_vertex_t *q, int i) {
+    q->clip.x = this->post_clip.x[i];
+    q->clip.y = this->post_clip.y[i];
+    q->clip.z = this->post_clip.z[i];
+    q->clip.w = this->post_clip.w[i];
+    q->screen.x = this->post_screen.x[i];
+    q->screen.y = this->post_screen.y[i];
+    q->screen.z = this->post_screen.z[i];
+    q->screen.w = this->post_screen.w[i];
+    q->cvv = this->post_cvv[i];
+}
+
+// 把 count 个顶点的位置转成 SoA，用 transform_project_batch 一次变换完
+void Device::device_transform_batch(const vertex_t *vertices, int count) {
+    int i;
+
+    if (count > this->post_max) {
+        float *ptr;
+        if (this->post_pos.x)
+            free(this->post_pos.x);
+        ptr = (float*)malloc(sizeof(float) * count * 13);
+        assert(ptr);
+        this->post_pos.x = ptr, ptr += count;
+        this->post_pos.y = ptr, ptr += count;
+        this->post_pos.z = ptr, ptr += count;
+        this->post_pos.w = ptr, ptr += count;
+        this->post_clip.x = ptr, ptr += count;
+        this->post_clip.y = ptr, ptr += count;
+        this->post_clip.z = ptr, ptr += count;
+        this->post_clip.w = ptr, ptr += count;
+        this->post_screen.x = ptr, ptr += count;
+        this->post_screen.y = ptr, ptr += count;
+        this->post_screen.z = ptr, ptr += count;
+        this->post_screen.w = ptr, ptr += count;
+        this->post_cvv = (int*)ptr;
+        this->post_max = count;
+    }
+
+    for (i = 0; i < count; i++) {
+        this->post_pos.x[i] = vertices[i].pos.x;
+        this->post_pos.y[i] = vertices[i].pos.y;
+        this->post_pos.z[i] = vertices[i].pos.z;
+        this->post_pos.w[i] = vertices[i].pos.w;
+    }
+    transform_project_batch(&this->transform, &this->post_clip, this->post_cvv, &this->post_screen,
+        &this->post_pos, count);
+}
+
+// 索引绘制：所有顶点先批量变换，共享的顶点只算一次，再按索引组装三角形
+void Device::draw_indexed(const vertex_t *vertices, int count, const int *indices, int icount) {
+    int i;
+
+    device_transform_batch(vertices, count);
+
+    for (i = 0; i + 2 < icount; i += 3) {
+        int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        post_vertex_t q1, q2, q3;
+        assert(a >= 0 && a < count && b >= 0 && b < count && c >= 0 && c < count);
+        device_post_fetch(&q1, a);
+        device_post_fetch(&q2, b);
+        device_post_fetch(&q3, c);
+        device_draw_post(&vertices[a], &vertices[b], &vertices[c], &q1, &q2, &q3);
+    }
+}
+
+// 用已经变换好的顶点绘制三角形，v1-v3 提供纹理坐标和颜色，需要时做裁剪
+void Device::device_draw_post(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3,
+    const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3) {
+
+    DEVICE_STAT(this->stats.primitives++);
+
+    // 三个点都在 cvv 内，直接绘制
+    if ((q1->cvv | q2->cvv | q3->cvv) == 0) {
+        device_draw_triangle(v1, v2, v3, q1, q2, q3);
+        return;
+    }
+
+    // 三个点都在同一个平面外面，整个三角形不可见
+    if ((q1->cvv & q2->cvv & q3->cvv) != 0) {
+        DEVICE_STAT(this->stats.clipped++);
+        return;
+    }
+
+    device_clip_triangle(v1, v2, v3, q1, q2, q3);
+}
+
+// 裁剪用的顶点：齐次坐标加上顶点属性
+typedef struct ClipVertex { point_t clip; vertex_t v; } clip_vertex_t;
+
+// 齐次坐标到裁剪平面的有向距离，>= 0 为在内侧，plane 的取值同 transform_check_cvv
+static float device_clip_distance(const point_t *c, int plane) {
+    switch (plane) {
+    case 1: return c->z;                            // 近平面 z >= 0
+    case 2: return c->w - c->z;                     // 远平面 z <= w
+    case 4: return c->x + c->w * GUARD_BAND;        // 保护带左边
+    case 8: return c->w * GUARD_BAND - c->x;        // 保护带右边
+    case 16: return c->y + c->w * GUARD_BAND;       // 保护带下边
+    case 32: return c->w * GUARD_BAND - c->y;       // 保护带上边
+    }
+    return 0.0f;
+}
+
+// Sutherland-Hodgman：多边形 in 对一个平面裁剪，结果写入 out，返回顶点数
+static int device_clip_polygon(clip_vertex_t *out, const clip_vertex_t *in, int n, int plane) {
+    int i, count = 0;
+    for (i = 0; i < n; i++) {
+        const clip_vertex_t *a = &in[i], *b = &in[(i + 1) % n];
+        float da = device_clip_distance(&a->clip, plane);
+        float db = device_clip_distance(&b->clip, plane);
+        if (da >= 0.0f) out[count++] = *a;
+        if ((da >= 0.0f) != (db >= 0.0f)) {
+            float t = da / (da - db);
+            clip_vertex_t *c = &out[count++];
+            vector_interp(&c->clip, &a->clip, &b->clip, t);
+            vertex_interp(&c->v, &a->v, &b->v, t);
+        }
+    }
+    return count;
+}
+
+// 齐次空间裁剪：只是超出屏幕、仍在保护带内的三角形直接光栅化，由裁剪区域剪掉屏幕外的部分；
+// 穿过近/远平面或者超出保护带的才做多边形裁剪，再拆成扇形三角形
+void Device::device_clip_triangle(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3,
+    const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3) {
+
+    vertex_t v[CLIP_VERTICES];
+    post_vertex_t p[CLIP_VERTICES];
+    int n, i;
+
+    n = device_clip_fan(v, p, v1, v2, v3, q1, q2, q3);
+    for (i = 1; i + 1 < n; i++) {
+        device_draw_triangle(&v[0], &v[i], &v[i + 1], &p[0], &p[i], &p[i + 1]);
+    }
+}
+
+// 裁剪成凸多边形，顶点属性写入 v，屏幕坐标写入 p，返回顶点数。
+// 在保护带内的三角形原样返回 3 个顶点，只补上归一化
+int Device::device_clip_fan(vertex_t *v, post_vertex_t *p, const vertex_t *v1, const vertex_t *v2,
+    const vertex_t *v3, const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3) {
+
+    clip_vertex_t poly[2][CLIP_VERTICES];
+    int planes, plane, n = 3, k = 0, i;
+
+    planes = (q1->cvv | q2->cvv | q3->cvv) & 3;
+    planes |= transform_check_guard(&q1->clip);
+    planes |= transform_check_guard(&q2->clip);
+    planes |= transform_check_guard(&q3->clip);
+
+    if (planes == 0) {
+        DEVICE_STAT(this->stats.guarded++);
+        v[0] = *v1, v[1] = *v2, v[2] = *v3;
+        p[0] = *q1, p[1] = *q2, p[2] = *q3;
+        for (i = 0; i < 3; i++)
+            transform_homogenize(&this->transform, &p[i].screen, &p[i].clip);
+        return 3;
+    }
 
-    //  Transform 仯
-    transform_apply(&this->transform, &c1, &v1->pos);
-    transform_apply(&this->transform, &c2, &v2->pos);
-    transform_apply(&this->transform, &c3, &v3->pos);
+    DEVICE_STAT(this->stats.split++);
+    poly[0][0].clip = q1->clip, poly[0][0].v = *v1;
+    poly[0][1].clip = q2->clip, poly[0][1].v = *v2;
+    poly[0][2].clip = q3->clip, poly[0][2].v = *v3;
+
+    for (plane = 1; plane <= 32 && n >= 3; plane <<= 1) {
+        if (planes & plane) {
+            n = device_clip_polygon(poly[k ^ 1], poly[k], n, plane);
+            k ^= 1;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        v[i] = poly[k][i].v;
+        p[i].clip = poly[k][i].clip;
+        p[i].cvv = 0;
+        transform_homogenize(&this->transform, &p[i].screen, &p[i].clip);
+    }
+    return n;
+}
 
-    // üע˴Ϊжϼ cvvԼͬcvvཻƽ
-    // нһϸüһֽΪȫ cvvڵ
-    if (transform_check_cvv(&c1) != 0) return;
-    if (transform_check_cvv(&c2) != 0) return;
-    if (transform_check_cvv(&c3) != 0) return;
+// 屏幕空间剔除：屏幕 y 向下，area > 0 为顺时针。线框模式下不做像素中心的剔除
+int Device::device_check_cull(const point_t *p1, const point_t *p2, const point_t *p3) {
+    int x1 = subpixel_snap(p1->x), y1 = subpixel_snap(p1->y);
+    int x2 = subpixel_snap(p2->x), y2 = subpixel_snap(p2->y);
+    int x3 = subpixel_snap(p3->x), y3 = subpixel_snap(p3->y);
+    long long area = (long long)(x2 - x1) * (y3 - y1) - (long long)(x3 - x1) * (y2 - y1);
+    int xmin, xmax, ymin, ymax;
 
-    // һ
-    transform_homogenize(&this->transform, &p1, &c1);
-    transform_homogenize(&this->transform, &p2, &c2);
-    transform_homogenize(&this->transform, &p3, &c3);
+    // 面积和包围盒都按光栅化用的 28.4 定点坐标计算，剔除的三角形在两边都不会画出像素
+    if (area == 0) return 1;
+    if (this->cull_mode == CULL_CW && area > 0) return 1;
+    if (this->cull_mode == CULL_CCW && area < 0) return 1;
+    if (this->render_state & RENDER_STATE_WIREFRAME) return 0;
 
-    // ɫʻ
+    // 包围盒内没有任何像素中心 (x + 0.5, y + 0.5)：左边、上边上的算在内，右边、下边上的不算
+    xmin = xmax = x1;
+    ymin = ymax = y1;
+    if (x2 < xmin) xmin = x2;
+    if (x2 > xmax) xmax = x2;
+    if (x3 < xmin) xmin = x3;
+    if (x3 > xmax) xmax = x3;
+    if (y2 < ymin) ymin = y2;
+    if (y2 > ymax) ymax = y2;
+    if (y3 < ymin) ymin = y3;
+    if (y3 > ymax) ymax = y3;
+    if (subpixel_ceil(xmin) >= subpixel_ceil(xmax)) return 1;
+    if (subpixel_ceil(ymin) >= subpixel_ceil(ymax)) return 1;
+    return 0;
+}
+
+// 绘制屏幕坐标已经算好的三角形，先做剔除，通过后才复制顶点、初始化 rhw
+void Device::device_draw_triangle(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3,
+    const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3) {
+
+    int render_state = this->render_state;
+    const point_t *p1 = &q1->screen, *p2 = &q2->screen, *p3 = &q3->screen;
+
+    if (device_check_cull(p1, p2, p3)) {
+        DEVICE_STAT(this->stats.culled++);
+        return;
+    }
+
+    // 纹理或者色彩绘制
     if (render_state & (RENDER_STATE_TEXTURE | RENDER_STATE_COLOR)) {
         vertex_t t1 = *v1, t2 = *v2, t3 = *v3;
-        trapezoid_t traps[2];
-        int n;
 
-        t1.pos = p1;
-        t2.pos = p2;
-        t3.pos = p3;
-        t1.pos.w = c1.w;
-        t2.pos.w = c2.w;
-        t3.pos.w = c3.w;
+        t1.pos = *p1;
+        t2.pos = *p2;
+        t3.pos = *p3;
+        t1.pos.w = q1->clip.w;
+        t2.pos.w = q2->clip.w;
+        t3.pos.w = q3->clip.w;
 
-        vertex_rhw_init(&t1);	// ʼ w
-        vertex_rhw_init(&t2);	// ʼ w
-        vertex_rhw_init(&t3);	// ʼ w
+        vertex_rhw_init(&t1);	// 初始化 w
+        vertex_rhw_init(&t2);	// 初始化 w
+        vertex_rhw_init(&t3);	// 初始化 w
 
-        // Ϊ0-2Σҷؿ
-        n = trapezoid_init_triangle(traps, &t1, &t2, &t3);
+        // 可见性缓存模式下先记下三角形的平面方程，光栅化只写它的编号
+        if (this->visibility)
+            this->visible_id = device_visible_add(&t1, &t2, &t3);
 
-        if (n >= 1) device_render_trap(&traps[0]);
-        if (n >= 2) device_render_trap(&traps[1]);
+        // 分块模式下只把三角形放入分块，光栅化推迟到 device_flush
+        if (this->tiler)
+            this->tiler->tiler_add_triangle(this, &t1, &t2, &t3);
+        else
+            device_raster_triangle(&t1, &t2, &t3);
     }
 
-    if (render_state & RENDER_STATE_WIREFRAME) {		// ߿
-        device_draw_line((int)p1.x, (int)p1.y, (int)p2.x, (int)p2.y, this->foreground);
-        device_draw_line((int)p1.x, (int)p1.y, (int)p3.x, (int)p3.y, this->foreground);
-        device_draw_line((int)p3.x, (int)p3.y, (int)p2.x, (int)p2.y, this->foreground);
+    if (render_state & RENDER_STATE_WIREFRAME) {		// 线框绘制
+        if (this->tiler) {
+            this->tiler->tiler_add_lines(this, p1, p2, p3);
+            return;
+        }
+        device_draw_line((int)p1->x, (int)p1->y, (int)p2->x, (int)p2->y, this->foreground);
+        device_draw_line((int)p1->x, (int)p1->y, (int)p3->x, (int)p3->y, this->foreground);
+        device_draw_line((int)p3->x, (int)p3->y, (int)p2->x, (int)p2->y, this->foreground);
     }
 }
 
-void Device::draw_plane(int a, int b, int c, int d) {
-    vertex_t mesh[8] = {
+// 分块光栅化：threads 为工作线程数，0 关闭分块，回到逐三角形立即绘制
+void Device::device_set_tiled(int threads) {
+    device_flush();
+    if (this->tiler)
+        delete this->tiler;
+    this->tiler = NULL;
+    if (threads > 0)
+        this->tiler = new Tiler(this->width, this->height, threads);
+}
+
+// 画完所有已经分块的三角形，可见性缓存模式下再给还没有着色的像素着色，
+// 读取 framebuffer 之前必须调用。分块模式下每个分块光栅化之后由同一个线程接着着色
+void Device::device_flush() {
+    if (this->tiler)
+        this->tiler->tiler_flush(this);
+    else if (this->visibility && this->visible_count > 0)
+        device_visibility_resolve();
+    this->visible_count = 0;
+}
+
+// 立方体 8 个角点，draw_plane 用
+static const vertex_t box_corners[8] = {
     { { -1, -1,  1, 1 }, { 0, 0 }, { 1.0f, 0.2f, 0.2f }, 1 },
     { {  1, -1,  1, 1 }, { 0, 1 }, { 0.2f, 1.0f, 0.2f }, 1 },
     { {  1,  1,  1, 1 }, { 1, 1 }, { 0.2f, 0.2f, 1.0f }, 1 },
@@ -265,29 +1199,116 @@ void Device::draw_plane(int a, int b, int c, int d) {
     { {  1, -1, -1, 1 }, { 0, 1 }, { 0.2f, 1.0f, 1.0f }, 1 },
     { {  1,  1, -1, 1 }, { 1, 1 }, { 1.0f, 0.3f, 0.3f }, 1 },
     { { -1,  1, -1, 1 }, { 1, 0 }, { 0.2f, 1.0f, 0.3f }, 1 },
-    };
-    vertex_t p1 = mesh[a], p2 = mesh[b], p3 = mesh[c], p4 = mesh[d];
+};
+
+void Device::draw_plane(int a, int b, int c, int d) {
+    vertex_t p1 = box_corners[a], p2 = box_corners[b], p3 = box_corners[c], p4 = box_corners[d];
     p1.tc.u = 0, p1.tc.v = 0, p2.tc.u = 0, p2.tc.v = 1;
     p3.tc.u = 1, p3.tc.v = 1, p4.tc.u = 1, p4.tc.v = 0;
     device_draw_primitive(&p1, &p2, &p3);
     device_draw_primitive(&p3, &p4, &p1);
 }
 
+// draw_box 的立方体：每个面一种纹理坐标，角点拆成 24 个顶点，面内两个三角形共享 4 个顶点。
+// 编译期的常量表，多个设备在不同线程里同时画也不需要初始化
+const vertex_t box_vertices[BOX_VERTICES] = {
+    { { -1, -1,  1, 1 }, { 0, 0 }, { 1.0f, 0.2f, 0.2f }, 1 },
+    { {  1, -1,  1, 1 }, { 0, 1 }, { 0.2f, 1.0f, 0.2f }, 1 },
+    { {  1,  1,  1, 1 }, { 1, 1 }, { 0.2f, 0.2f, 1.0f }, 1 },
+    { { -1,  1,  1, 1 }, { 1, 0 }, { 1.0f, 0.2f, 1.0f }, 1 },
+    { { -1,  1, -1, 1 }, { 0, 0 }, { 0.2f, 1.0f, 0.3f }, 1 },
+    { {  1,  1, -1, 1 }, { 0, 1 }, { 1.0f, 0.3f, 0.3f }, 1 },
+    { {  1, -1, -1, 1 }, { 1, 1 }, { 0.2f, 1.0f, 1.0f }, 1 },
+    { { -1, -1, -1, 1 }, { 1, 0 }, { 1.0f, 1.0f, 0.2f }, 1 },
+    { { -1, -1,  1, 1 }, { 0, 0 }, { 1.0f, 0.2f, 0.2f }, 1 },
+    { { -1, -1, -1, 1 }, { 0, 1 }, { 1.0f, 1.0f, 0.2f }, 1 },
+    { {  1, -1, -1, 1 }, { 1, 1 }, { 0.2f, 1.0f, 1.0f }, 1 },
+    { {  1, -1,  1, 1 }, { 1, 0 }, { 0.2f, 1.0f, 0.2f }, 1 },
+    { {  1, -1,  1, 1 }, { 0, 0 }, { 0.2f, 1.0f, 0.2f }, 1 },
+    { {  1, -1, -1, 1 }, { 0, 1 }, { 0.2f, 1.0f, 1.0f }, 1 },
+    { {  1,  1, -1, 1 }, { 1, 1 }, { 1.0f, 0.3f, 0.3f }, 1 },
+    { {  1,  1,  1, 1 }, { 1, 0 }, { 0.2f, 0.2f, 1.0f }, 1 },
+    { {  1,  1,  1, 1 }, { 0, 0 }, { 0.2f, 0.2f, 1.0f }, 1 },
+    { {  1,  1, -1, 1 }, { 0, 1 }, { 1.0f, 0.3f, 0.3f }, 1 },
+    { { -1,  1, -1, 1 }, { 1, 1 }, { 0.2f, 1.0f, 0.3f }, 1 },
+    { { -1,  1,  1, 1 }, { 1, 0 }, { 1.0f, 0.2f, 1.0f }, 1 },
+    { { -1,  1,  1, 1 }, { 0, 0 }, { 1.0f, 0.2f, 1.0f }, 1 },
+    { { -1,  1, -1, 1 }, { 0, 1 }, { 0.2f, 1.0f, 0.3f }, 1 },
+    { { -1, -1, -1, 1 }, { 1, 1 }, { 1.0f, 1.0f, 0.2f }, 1 },
+    { { -1, -1,  1, 1 }, { 1, 0 }, { 1.0f, 0.2f, 0.2f }, 1 },
+};
+
+const int box_indices[BOX_INDICES] = {
+    0, 1, 2, 2, 3, 0,
+    4, 5, 6, 6, 7, 4,
+    8, 9, 10, 10, 11, 8,
+    12, 13, 14, 14, 15, 12,
+    16, 17, 18, 18, 19, 16,
+    20, 21, 22, 22, 23, 20,
+};
+
 void Device::draw_box(float theta) {
     matrix_t m;
     matrix_set_rotate(&m, -1, -0.5, 1, theta);
     this->transform.world = m;
     transform_update(&this->transform);
-    draw_plane(0, 1, 2, 3);
-    draw_plane(7, 6, 5, 4);
-    draw_plane(0, 4, 5, 1);
-    draw_plane(1, 5, 6, 2);
-    draw_plane(2, 6, 7, 3);
-    draw_plane(3, 7, 4, 0);
+    draw_indexed(box_vertices, BOX_VERTICES, box_indices, BOX_INDICES);
+}
+
+void Device::draw_mesh(const mesh_t *mesh, float theta) {
+    float sx = mesh->hi.x - mesh->lo.x, sy = mesh->hi.y - mesh->lo.y, sz = mesh->hi.z - mesh->lo.z;
+    float size = (sx > sy) ? ((sx > sz) ? sx : sz) : ((sy > sz) ? sy : sz);
+    matrix_t t, s, r, m;
+    matrix_set_translate(&t, -(mesh->lo.x + mesh->hi.x) * 0.5f, -(mesh->lo.y + mesh->hi.y) * 0.5f,
+        -(mesh->lo.z + mesh->hi.z) * 0.5f);
+    size = (size > 0) ? 2.0f / size : 1.0f;
+    matrix_set_scale(&s, size, size, size);
+    matrix_set_rotate(&r, -1, -0.5, 1, theta);
+    matrix_mul(&m, &t, &s);
+    matrix_mul(&this->transform.world, &m, &r);
+    transform_update(&this->transform);
+    draw_indexed(mesh->vertices, mesh->count, mesh->indices, mesh->icount);
+}
+
+void Device::draw_bvh(const bvh_t *bvh) {
+    int i, n;
+    matrix_set_identity(&this->transform.world);
+    transform_update(&this->transform);
+    n = bvh_cull(bvh, &this->transform.transform, bvh->visible);
+    DEVICE_STAT(this->stats.objects += bvh->count);
+    DEVICE_STAT(this->stats.objculled += bvh->count - n);
+    for (i = 0; i < n; i++) {
+        const bvh_object_t *obj = &bvh->objects[bvh->visible[i]];
+        const mesh_t *mesh = obj->mesh;
+        this->transform.world = obj->world;
+        transform_update(&this->transform);
+        if (obj->lod) mesh = &obj->lod->level[mesh_lod_select(obj->lod, &this->transform)];
+        draw_indexed(mesh->vertices, mesh->count, mesh->indices, mesh->icount);
+    }
+}
+
+void Device::draw_list(const cmdlist_t *list) {
+    const texture_t *tex = this->tex;
+    int state = this->render_state;
+    int i;
+    for (i = 0; i < list->count; i++) {
+        const draw_cmd_t *cmd = &list->cmds[list->order[i]];
+        const mesh_t *mesh = cmd->mesh;
+        // 换纹理要先画完已经分块的三角形，只在用纹理的命令上换；渲染状态记在每个三角形上，直接改
+        if (cmd->render_state & RENDER_STATE_TEXTURE) {
+            const texture_t *want = (cmd->tex != NULL) ? cmd->tex : tex;
+            if (want != this->tex) device_bind_texture(want);
+        }
+        this->render_state = cmd->render_state;
+        this->transform.world = cmd->world;
+        transform_update(&this->transform);
+        draw_indexed(mesh->vertices, mesh->count, mesh->indices, mesh->icount);
+    }
+    if (this->tex != tex) device_bind_texture(tex);
+    this->render_state = state;
 }
 
 void Device::camera_at_zero(float x, float y, float z) {
-    Device *device = this;
     point_t eye = { x, y, z, 1 }, at = { 0, 0, 0, 1 }, up = { 0, 0, 1, 1 };
     matrix_set_lookat(&this->transform.view, &eye, &at, &up);
     transform_update(&this->transform);
@@ -0,0 +1,321 @@
+#include "mini3d.h"
+
+//=====================================================================
+// 边函数光栅化：三条边的 E(x, y) = a * x + b * y + c 在三角形内部为正，
+// 以 8x8 像素块为单位求块角上的边函数，整块在某条边外面直接跳过，
+// 整块在三条边里面就不再逐像素测试。顶点与扫描线一样对齐到 28.4 定点，
+// 边函数用整数求值，覆盖测试没有舍入误差。rhw / 纹理坐标 / 颜色都按平面方程
+// f(x, y) = dx * x + dy * y + c 在像素中心直接求值，不需要逐行插值。
+// 可见性缓存模式下通过深度测试的像素只写三角形编号，不求纹理坐标和颜色。
+//=====================================================================
+
+#define HALFSPACE_BLOCK             8
+
+// 边函数，a、b 为 28.4 定点的坐标差，E 以 1/256 像素为单位。不是上边、左边的 c 再减 1，
+// 压在边上的像素只算给上边、左边（top-left 规则），内部测试统一为 E >= 0
+typedef struct HalfEdge { int a, b; long long c; } half_edge_t;
+// 属性平面方程
+typedef struct HalfPlane { float dx, dy, c; } half_plane_t;
+
+static void halfspace_edge(half_edge_t *e, int xa, int ya, int xb, int yb) {
+    e->a = ya - yb;
+    e->b = xb - xa;
+    e->c = (long long)xa * yb - (long long)xb * ya;
+    if (!(e->a > 0 || (e->a == 0 && e->b > 0))) e->c--;
+}
+
+// 像素 (x, y) 中心上的边函数
+static inline long long halfspace_edge_eval(const half_edge_t *e, int x, int y) {
+    return (long long)e->a * (x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2) +
+        (long long)e->b * (y * SUBPIXEL_ONE + SUBPIXEL_ONE / 2) + e->c;
+}
+
+// 由三个顶点上的属性值求平面方程，再加上常数项，inv 为三角形两倍面积的倒数
+static void halfspace_plane(half_plane_t *p, const float *x, const float *y,
+    float a1, float a2, float a3, float inv) {
+    triangle_plane(&p->dx, &p->dy, x, y, a1, a2, a3, inv);
+    p->c = a1 - p->dx * x[0] - p->dy * y[0];
+}
+
+#ifdef MINI3D_SSE2
+static inline __m128 halfspace_eval(const half_plane_t *p, __m128 px, __m128 py) {
+    __m128 fx = _mm_mul_ps(_mm_set1_ps(p->dx), px);
+    __m128 fy = _mm_mul_ps(_mm_set1_ps(p->dy), py);
+    return _mm_add_ps(_mm_add_ps(fx, fy), _mm_set1_ps(p->c));
+}
+#else
+static inline float halfspace_eval1(const half_plane_t *p, float px, float py) {
+    return p->dx * px + p->dy * py + p->c;
+}
+#endif
+
+void Device::device_render_halfspace(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3) {
+    const vertex_t *p;
+    half_edge_t e[3];
+    half_plane_t plane[6];      // rhw, u, v, r, g, b
+    float xs[3], ys[3], inv;
+    int X[3], Y[3], xmin, xmax, ymin, ymax;
+    int minx, maxx, miny, maxy, bx, by, k;
+    int render_state = this->visibility ? 0 : this->render_state;     // 可见性缓存不需要其余属性
+    long long area;
+
+    X[0] = subpixel_snap(v1->pos.x), Y[0] = subpixel_snap(v1->pos.y);
+    X[1] = subpixel_snap(v2->pos.x), Y[1] = subpixel_snap(v2->pos.y);
+    X[2] = subpixel_snap(v3->pos.x), Y[2] = subpixel_snap(v3->pos.y);
+    area = (long long)(X[1] - X[0]) * (Y[2] - Y[0]) - (long long)(X[2] - X[0]) * (Y[1] - Y[0]);
+    if (area == 0) return;
+    if (area < 0) {
+        p = v2, v2 = v3, v3 = p, area = -area;
+        k = X[1], X[1] = X[2], X[2] = k;
+        k = Y[1], Y[1] = Y[2], Y[2] = k;
+    }
+
+    for (k = 0; k < 3; k++) {
+        xs[k] = (float)X[k] * (1.0f / SUBPIXEL_ONE);
+        ys[k] = (float)Y[k] * (1.0f / SUBPIXEL_ONE);
+    }
+    halfspace_edge(&e[0], X[0], Y[0], X[1], Y[1]);
+    halfspace_edge(&e[1], X[1], Y[1], X[2], Y[2]);
+    halfspace_edge(&e[2], X[2], Y[2], X[0], Y[0]);
+
+    // 只建立渲染状态用得到的平面，其余清零：编译器看不出建立和着色的条件相同
+    memset(plane, 0, sizeof(plane));
+    inv = (float)(SUBPIXEL_ONE * SUBPIXEL_ONE) / (float)area;
+    halfspace_plane(&plane[0], xs, ys, v1->rhw, v2->rhw, v3->rhw, inv);
+    if (render_state & RENDER_STATE_TEXTURE) {
+        halfspace_plane(&plane[1], xs, ys, v1->tc.u, v2->tc.u, v3->tc.u, inv);
+        halfspace_plane(&plane[2], xs, ys, v1->tc.v, v2->tc.v, v3->tc.v, inv);
+    }
+    else if (render_state & RENDER_STATE_COLOR) {
+        halfspace_plane(&plane[3], xs, ys, v1->color.r, v2->color.r, v3->color.r, inv);
+        halfspace_plane(&plane[4], xs, ys, v1->color.g, v2->color.g, v3->color.g, inv);
+        halfspace_plane(&plane[5], xs, ys, v1->color.b, v2->color.b, v3->color.b, inv);
+    }
+
+    // 包围盒：像素中心 (x + 0.5, y + 0.5) 可能落在三角形里的范围，再裁剪到 clip
+    xmin = xmax = X[0];
+    ymin = ymax = Y[0];
+    for (k = 1; k < 3; k++) {
+        if (X[k] < xmin) xmin = X[k];
+        if (X[k] > xmax) xmax = X[k];
+        if (Y[k] < ymin) ymin = Y[k];
+        if (Y[k] > ymax) ymax = Y[k];
+    }
+    minx = subpixel_ceil(xmin);
+    maxx = subpixel_ceil(xmax) - 1;
+    miny = subpixel_ceil(ymin);
+    maxy = subpixel_ceil(ymax) - 1;
+    if (minx < this->clip_x0) minx = this->clip_x0;
+    if (miny < this->clip_y0) miny = this->clip_y0;
+    if (maxx > this->clip_x1 - 1) maxx = this->clip_x1 - 1;
+    if (maxy > this->clip_y1 - 1) maxy = this->clip_y1 - 1;
+    if (minx > maxx || miny > maxy) return;
+
+    for (by = miny & ~(HALFSPACE_BLOCK - 1); by <= maxy; by += HALFSPACE_BLOCK) {
+        int y0 = (by < miny) ? miny : by;
+        int y1 = (by + HALFSPACE_BLOCK - 1 > maxy) ? maxy : by + HALFSPACE_BLOCK - 1;
+        for (bx = minx & ~(HALFSPACE_BLOCK - 1); bx <= maxx; bx += HALFSPACE_BLOCK) {
+            float cx = (float)bx + 0.5f, cy = (float)by + 0.5f;
+            float span = (float)(HALFSPACE_BLOCK - 1);
+            int skip = 0, x, y;
+            // 需要逐像素测试的边：块左上角像素中心的边函数，以及沿 x、y 走一个像素的增量。
+            // 这样的边从块内穿过，块内的边函数不超过 8 个像素的增量，32 位整数放得下
+            int edge0[3], edge_a[3], edge_b[3], test = 0;
+
+            // 块角上的边函数：线性函数在矩形上的最大/最小值都在角上
+            for (k = 0; k < 3; k++) {
+                long long e0 = halfspace_edge_eval(&e[k], bx, by);
+                long long ea = (long long)e[k].a * SUBPIXEL_ONE * (HALFSPACE_BLOCK - 1);
+                long long eb = (long long)e[k].b * SUBPIXEL_ONE * (HALFSPACE_BLOCK - 1);
+                long long emax = e0 + ((ea > 0) ? ea : 0) + ((eb > 0) ? eb : 0);
+                long long emin = e0 + ((ea < 0) ? ea : 0) + ((eb < 0) ? eb : 0);
+                if (emax < 0) { skip = 1; break; }
+                if (emin < 0) {
+                    edge0[test] = (int)e0;
+                    edge_a[test] = e[k].a * SUBPIXEL_ONE;
+                    edge_b[test] = e[k].b * SUBPIXEL_ONE;
+                    test++;
+                }
+            }
+            if (skip) continue;
+
+            // 层次 z：块内最大的 rhw 也在角上，加上求值的舍入误差仍然比分块最小的 rhw 小，
+            // 整块都通不过深度测试。8x8 像素块与层次 z 的分块正好对齐
+            {
+                const half_plane_t *r = &plane[0];
+                float ra = r->dx * span, rb = r->dy * span;
+                float rmax = r->dx * cx + r->dy * cy + r->c + ((ra > 0) ? ra : 0) + ((rb > 0) ? rb : 0);
+                float err = (fabsf(r->dx) * (cx + span) + fabsf(r->dy) * (cy + span) + fabsf(r->c)) * 1e-6f;
+                if (rmax + err < this->hiz[(by / HIZ_SIZE) * this->hiz_w + bx / HIZ_SIZE]) {
+                    DEVICE_STAT(this->stats.hizpixels += (y1 - y0 + 1) * HIZ_SIZE);
+                    continue;
+                }
+            }
+
+            device_zclear_resolve(y0, y1 + 1, bx, bx + 1);
+            // 每个像素块用同一个 mip 层，按块中心的导数选择
+            if (render_state & RENDER_STATE_TEXTURE) {
+                float mx = cx + span * 0.5f, my = cy + span * 0.5f;
+                float dx[3] = { plane[1].dx, plane[2].dx, plane[0].dx };
+                float dy[3] = { plane[1].dy, plane[2].dy, plane[0].dy };
+                int lerp = 0;
+                int level = texture_select_level(this->tex,
+                    plane[1].dx * mx + plane[1].dy * my + plane[1].c,
+                    plane[2].dx * mx + plane[2].dy * my + plane[2].c,
+                    plane[0].dx * mx + plane[0].dy * my + plane[0].c, dx, dy,
+                    (this->sampler.filter == SAMPLER_TRILINEAR) ? &lerp : NULL);
+                this->tex_level = &this->tex->level[level];
+                this->tex_lerp = lerp;
+            }
+            for (y = y0; y <= y1; y++) {
+                void *zbuffer = (char*)this->zbuffer + y * this->zb_pitch;
+                // 可见性缓存模式下写进 vbuffer 的是三角形编号
+                UINT32 *framebuffer = this->visibility ? (UINT32*)(this->vbuffer + y * this->width) :
+                    this->framebuffer + y * this->fb_stride;
+#ifdef MINI3D_SSE2
+                __m128 py = _mm_set1_ps((float)y + 0.5f);
+                for (x = bx; x < bx + HALFSPACE_BLOCK; x += 4) {
+                    __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+                    __m128 fx = _mm_add_ps(_mm_set1_ps((float)x), lane);
+                    __m128 px = _mm_add_ps(fx, _mm_set1_ps(0.5f));
+                    __m128 cover, rhw;
+                    int inside, mask, whole, l;
+                    cover = _mm_and_ps(_mm_cmpge_ps(fx, _mm_set1_ps((float)minx)),
+                        _mm_cmple_ps(fx, _mm_set1_ps((float)maxx)));
+                    for (k = 0; k < test; k++) {
+                        int a = edge_a[k];
+                        __m128i ev = _mm_add_epi32(_mm_set1_epi32(edge0[k] + a * (x - bx) + edge_b[k] * (y - by)),
+                            _mm_set_epi32(3 * a, 2 * a, a, 0));
+                        cover = _mm_and_ps(cover, _mm_castsi128_ps(_mm_cmpgt_epi32(ev, _mm_set1_epi32(-1))));
+                    }
+                    inside = _mm_movemask_ps(cover);
+                    if (inside == 0) continue;
+
+                    // 四个像素都在裁剪区域内才整体读写，否则逐像素处理。通过的像素在测试时写入深度
+                    whole = (x >= minx && x + 3 <= maxx);
+                    rhw = halfspace_eval(&plane[0], px, py);
+                    if (whole) {
+                        __m128i pass = depth_test_format_sse2(this->depth_format, zbuffer, x, rhw,
+                            this->depth_scale, _mm_castps_si128(cover));
+                        mask = _mm_movemask_ps(_mm_castsi128_ps(pass));
+                    }
+                    else {
+                        float z[4];
+                        _mm_storeu_ps(z, rhw);
+                        mask = 0;
+                        for (l = 0; l < 4; l++) {
+                            if ((inside & (1 << l)) &&
+                                depth_test_format(this->depth_format, zbuffer, x + l, z[l], this->depth_scale))
+                                mask |= 1 << l;
+                        }
+                    }
+                    DEVICE_STAT(for (l = 0; l < 4; l++) {
+                        if (inside & (1 << l)) this->stats.pixels++;
+                        if ((inside & ~mask) & (1 << l)) this->stats.zfail++;
+                        if (mask & (1 << l)) {
+                            this->stats.written++;
+                            this->overdraw[y * this->width + x + l]++;
+                        }
+                    });
+                    if (mask == 0) continue;
+
+                    __m128 w;
+                    __m128i cc;
+                    // 与平面方程的建立用同样的条件：可见性缓存模式下 render_state 为 0
+                    if (render_state & RENDER_STATE_TEXTURE) {
+                        __m128 u, v;
+                        w = _mm_div_ps(_mm_set1_ps(1.0f), rhw);
+                        u = _mm_mul_ps(halfspace_eval(&plane[1], px, py), w);
+                        v = _mm_mul_ps(halfspace_eval(&plane[2], px, py), w);
+                        const texture_level_t *level = this->tex_level;
+                        if (this->sampler.filter | this->sampler.address_u | this->sampler.address_v) {
+                            cc = sampler_fetch_sse2(&this->sampler, level, this->tex_lerp, u, v);
+                        }
+                        else {
+                            __m128i tx, ty;
+                            int index[4];
+                            UINT32 texel[4];
+                            u = _mm_add_ps(_mm_mul_ps(u, _mm_set1_ps(level->max_u)), _mm_set1_ps(0.5f));
+                            v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(level->max_v)), _mm_set1_ps(0.5f));
+                            tx = clamp_sse2(_mm_cvttps_epi32(u), _mm_setzero_si128(),
+                                _mm_set1_epi32(level->width - 1));
+                            ty = clamp_sse2(_mm_cvttps_epi32(v), _mm_setzero_si128(),
+                                _mm_set1_epi32(level->height - 1));
+                            _mm_storeu_si128((__m128i*)index, texture_offset_sse2(level, tx, ty));
+                            for (l = 0; l < 4; l++)
+                                texel[l] = (mask & (1 << l)) ? level->bits[index[l]] : 0;
+                            cc = _mm_loadu_si128((const __m128i*)texel);
+                        }
+                    }
+                    else if (render_state & RENDER_STATE_COLOR) {
+                        __m128 s = _mm_set1_ps(255.0f);
+                        __m128i lo = _mm_setzero_si128(), hi = _mm_set1_epi32(255);
+                        w = _mm_div_ps(_mm_set1_ps(1.0f), rhw);
+                        __m128 r = _mm_mul_ps(_mm_mul_ps(halfspace_eval(&plane[3], px, py), w), s);
+                        __m128 g = _mm_mul_ps(_mm_mul_ps(halfspace_eval(&plane[4], px, py), w), s);
+                        __m128 b = _mm_mul_ps(_mm_mul_ps(halfspace_eval(&plane[5], px, py), w), s);
+                        __m128i R = clamp_sse2(_mm_cvttps_epi32(r), lo, hi);
+                        __m128i G = clamp_sse2(_mm_cvttps_epi32(g), lo, hi);
+                        __m128i B = clamp_sse2(_mm_cvttps_epi32(b), lo, hi);
+                        cc = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(R, 16),
+                            _mm_slli_epi32(G, 8)), B);
+                    }
+                    else {
+                        cc = _mm_set1_epi32(this->visible_id);
+                    }
+
+                    if (whole && mask == 15) {
+                        _mm_storeu_si128((__m128i*)(framebuffer + x), cc);
+                    }
+                    else {
+                        UINT32 c[4];
+                        _mm_storeu_si128((__m128i*)c, cc);
+                        for (l = 0; l < 4; l++) {
+                            if (mask & (1 << l)) framebuffer[x + l] = c[l];
+                        }
+                    }
+                }
+#else
+                float py = (float)y + 0.5f;
+                for (x = bx; x < bx + HALFSPACE_BLOCK; x++) {
+                    float px = (float)x + 0.5f;
+                    float rhw, w;
+                    int in = (x >= minx && x <= maxx);
+                    for (k = 0; k < test && in; k++)
+                        in = (edge0[k] + edge_a[k] * (x - bx) + edge_b[k] * (y - by) >= 0);
+                    if (!in) continue;
+                    DEVICE_STAT(this->stats.pixels++);
+                    rhw = halfspace_eval1(&plane[0], px, py);
+                    if (!depth_test_format(this->depth_format, zbuffer, x, rhw, this->depth_scale)) {
+                        DEVICE_STAT(this->stats.zfail++);
+                        continue;
+                    }
+                    DEVICE_STAT(this->stats.written++);
+                    DEVICE_STAT(this->overdraw[y * this->width + x]++);
+                    w = 1.0f / rhw;
+                    if (render_state & RENDER_STATE_TEXTURE) {
+                        float u = halfspace_eval1(&plane[1], px, py) * w;
+                        float v = halfspace_eval1(&plane[2], px, py) * w;
+                        framebuffer[x] = Device_texture_read(u, v);
+                    }
+                    else if (render_state & RENDER_STATE_COLOR) {
+                        int R = (int)(halfspace_eval1(&plane[3], px, py) * w * 255.0f);
+                        int G = (int)(halfspace_eval1(&plane[4], px, py) * w * 255.0f);
+                        int B = (int)(halfspace_eval1(&plane[5], px, py) * w * 255.0f);
+                        R = clamp(R, 0, 255);
+                        G = clamp(G, 0, 255);
+                        B = clamp(B, 0, 255);
+                        framebuffer[x] = (R << 16) | (G << 8) | (B);
+                    }
+                    else {
+                        framebuffer[x] = (UINT32)this->visible_id;
+                    }
+                }
+#endif
+            }
+
+            device_hiz_update(y0, y1 + 1, (bx < minx) ? minx : bx,
+                (bx + HALFSPACE_BLOCK - 1 > maxx) ? maxx + 1 : bx + HALFSPACE_BLOCK);
+        }
+    }
+}
@@ -0,0 +1,269 @@
+#include "mini3d.h"
+#include "offscreen.h"
+#include "pipeline.h"
+
+// 无窗口渲染：在没有显示设备的机器上批量渲染并输出图片
+// 用法：Mini3DHeadless [-w 宽] [-h 高] [-n 帧数] [-s texture|color|wireframe]
+//                      [-threads 分块光栅化线程数，0 为单线程]
+//                      [-raster scanline|halfspace] [-d 摄像机距离]
+//                      [-cull none|cw|ccw] [-filter nearest|bilinear|trilinear]
+//                      [-address clamp|wrap|mirror] [-tex 纹理文件.bmp|.tga]
+//                      [-shade forward|visibility] [-obj 网格.obj]
+//                      [-pipeline 同时在流水线里的帧数，0 为关闭] [-depth float|16|24]
+//                      [-o out.ppm] [-raw out.rgba] [-heat overdraw.ppm]
+// -shade visibility 使用可见性缓存：光栅化只写深度和三角形编号，每个像素只着色一次
+// -obj 绘制 OBJ 网格代替立方体，网格缩放到立方体的大小
+// -pipeline 几何、光栅化、输出分在三个线程里，不同的帧同时进行，输出与逐帧绘制相同
+// -depth 深度缓存格式：float 为 32 位浮点，16 为 16 位定点（预览用），24 为 24 位定点
+// 文件名中含有 %d 时每帧输出一张，否则只输出最后一帧
+// 以 MINI3D_STATS 编译时，打印最后一帧的管线统计，-heat 输出 overdraw 热度图
+
+static void usage(void) {
+    printf("usage: Mini3DHeadless [-w width] [-h height] [-n frames]\n");
+    printf("                      [-s texture|color|wireframe] [-threads n]\n");
+    printf("                      [-raster scanline|halfspace] [-d distance]\n");
+    printf("                      [-cull none|cw|ccw] [-filter nearest|bilinear|trilinear]\n");
+    printf("                      [-address clamp|wrap|mirror] [-tex file.bmp|file.tga]\n");
+    printf("                      [-shade forward|visibility] [-obj mesh.obj]\n");
+    printf("                      [-pipeline depth] [-depth float|16|24]\n");
+    printf("                      [-o out.ppm] [-raw out.rgba] [-heat overdraw.ppm]\n");
+}
+
+static int parse_state(const char *name) {
+    if (strcmp(name, "texture") == 0) return RENDER_STATE_TEXTURE;
+    if (strcmp(name, "color") == 0) return RENDER_STATE_COLOR;
+    if (strcmp(name, "wireframe") == 0) return RENDER_STATE_WIREFRAME;
+    return -1;
+}
+
+static int parse_raster(const char *name) {
+    if (strcmp(name, "scanline") == 0) return RASTERIZER_SCANLINE;
+    if (strcmp(name, "halfspace") == 0) return RASTERIZER_HALFSPACE;
+    return -1;
+}
+
+static int parse_cull(const char *name) {
+    if (strcmp(name, "none") == 0) return CULL_NONE;
+    if (strcmp(name, "cw") == 0) return CULL_CW;
+    if (strcmp(name, "ccw") == 0) return CULL_CCW;
+    return -1;
+}
+
+static int parse_filter(const char *name) {
+    if (strcmp(name, "nearest") == 0) return SAMPLER_NEAREST;
+    if (strcmp(name, "bilinear") == 0) return SAMPLER_BILINEAR;
+    if (strcmp(name, "trilinear") == 0) return SAMPLER_TRILINEAR;
+    return -1;
+}
+
+static int parse_address(const char *name) {
+    if (strcmp(name, "clamp") == 0) return SAMPLER_CLAMP;
+    if (strcmp(name, "wrap") == 0) return SAMPLER_WRAP;
+    if (strcmp(name, "mirror") == 0) return SAMPLER_MIRROR;
+    return -1;
+}
+
+static int parse_shade(const char *name) {
+    if (strcmp(name, "forward") == 0) return 0;
+    if (strcmp(name, "visibility") == 0) return 1;
+    return -1;
+}
+
+static int parse_depth(const char *name) {
+    if (strcmp(name, "float") == 0) return DEPTH_FLOAT;
+    if (strcmp(name, "16") == 0) return DEPTH_16;
+    if (strcmp(name, "24") == 0) return DEPTH_24;
+    return -1;
+}
+
+static int save_frame(const Offscreen &screen, const char *ppm, const char *raw, int frame) {
+    char name[1024];
+    if (ppm) {
+        snprintf(name, sizeof(name), ppm, frame);
+        if (screen.offscreen_save_ppm(name) != 0) return -1;
+    }
+    if (raw) {
+        snprintf(name, sizeof(name), raw, frame);
+        if (screen.offscreen_save_raw(name) != 0) return -1;
+    }
+    return 0;
+}
+
+#ifdef MINI3D_STATS
+static int save_stats(Device *device, const char *heat) {
+    const device_stats_t *st = &device->stats;
+    printf("primitives=%ld clipped=%ld guarded=%ld split=%ld culled=%ld trapezoids=%ld "
+        "scanlines=%ld pixels=%ld zfail=%ld written=%ld hiztraps=%ld hizpixels=%ld shaded=%ld objects=%ld "
+        "objculled=%ld\n", st->primitives,
+        st->clipped, st->guarded, st->split, st->culled, st->trapezoids, st->scanlines, st->pixels,
+        st->zfail, st->written, st->hiztraps, st->hizpixels, st->shaded, st->objects, st->objculled);
+    if (heat) {
+        Offscreen map;
+        if (map.offscreen_init(device->width, device->height)) return -1;
+        device->device_stats_heatmap(map.getScreenFrameBuffer(), map.getPitch());
+        if (map.offscreen_save_ppm(heat) != 0) return -1;
+    }
+    return 0;
+}
+#endif
+
+// 流水线的输出线程：帧复制到 screen 再保存，最后一帧同时输出统计
+typedef struct {
+    Offscreen *screen;
+    const char *ppm, *raw, *heat;
+    int every, frames;
+    int error;                  // 写失败的帧号，-1 为没有
+} present_t;
+
+static void present_frame(void *user, Device *frame, int index) {
+    present_t *ctx = (present_t*)user;
+    unsigned char *fb = ctx->screen->getScreenFrameBuffer();
+    int y;
+    if (ctx->error >= 0 || (!ctx->every && index != ctx->frames - 1)) return;
+    for (y = 0; y < frame->height; y++)
+        memcpy(fb + ctx->screen->getPitch() * y, frame->framebuffer + y * frame->fb_stride, frame->width * 4);
+    if (save_frame(*ctx->screen, ctx->ppm, ctx->raw, index) != 0) {
+        ctx->error = index;
+        return;
+    }
+#ifdef MINI3D_STATS
+    if (index == ctx->frames - 1 && save_stats(frame, ctx->heat) != 0)
+        fprintf(stderr, "error: can not write heat map\n");
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    int width = 800, height = 600, frames = 1;
+    int state = RENDER_STATE_TEXTURE;
+    const char *ppm = "mini3d.ppm", *raw = NULL, *heat = NULL, *tex = NULL, *obj = NULL;
+    const texture_t *file = NULL;
+    mesh_t mesh;
+    float theta = 1, pos = 3.5;
+    int threads = 0, raster = RASTERIZER_SCANLINE, cull = CULL_NONE;
+    int filter = SAMPLER_NEAREST, address = SAMPLER_CLAMP, shade = 0;
+    int depth = 0, zformat = DEPTH_FLOAT;
+    int i, every;
+
+    for (i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (arg == NULL) { usage(); return -1; }
+        if (strcmp(opt, "-w") == 0) width = atoi(arg);
+        else if (strcmp(opt, "-h") == 0) height = atoi(arg);
+        else if (strcmp(opt, "-n") == 0) frames = atoi(arg);
+        else if (strcmp(opt, "-s") == 0) state = parse_state(arg);
+        else if (strcmp(opt, "-threads") == 0) threads = atoi(arg);
+        else if (strcmp(opt, "-raster") == 0) raster = parse_raster(arg);
+        else if (strcmp(opt, "-d") == 0) pos = (float)atof(arg);
+        else if (strcmp(opt, "-cull") == 0) cull = parse_cull(arg);
+        else if (strcmp(opt, "-filter") == 0) filter = parse_filter(arg);
+        else if (strcmp(opt, "-address") == 0) address = parse_address(arg);
+        else if (strcmp(opt, "-tex") == 0) tex = arg;
+        else if (strcmp(opt, "-shade") == 0) shade = parse_shade(arg);
+        else if (strcmp(opt, "-obj") == 0) obj = arg;
+        else if (strcmp(opt, "-pipeline") == 0) depth = atoi(arg);
+        else if (strcmp(opt, "-depth") == 0) zformat = parse_depth(arg);
+        else if (strcmp(opt, "-o") == 0) ppm = arg;
+        else if (strcmp(opt, "-raw") == 0) raw = arg;
+        else if (strcmp(opt, "-heat") == 0) heat = arg;
+        else { usage(); return -1; }
+        i++;
+    }
+    if (width <= 0 || height <= 1 || frames <= 0 || state < 0 || threads < 0 ||
+        raster < 0 || cull < 0 || filter < 0 || address < 0 || shade < 0 ||
+        depth < 0 || depth > PIPELINE_MAX_DEPTH || zformat < 0) {
+        usage();
+        return -1;
+    }
+
+    Offscreen screen;
+    if (screen.offscreen_init(width, height))
+        return -2;
+    if (tex && (file = texture_acquire(tex)) == NULL) {
+        fprintf(stderr, "error: can not load texture %s\n", tex);
+        return -2;
+    }
+    memset(&mesh, 0, sizeof(mesh));
+    if (obj && mesh_load(&mesh, obj, 0) != 0) {
+        fprintf(stderr, "error: can not load mesh %s\n", obj);
+        if (file) texture_release(file);
+        return -2;
+    }
+
+    Device device;
+    device.device_init(width, height, screen.getScreenFrameBuffer());
+    device.init_texture();
+    if (file) device.device_bind_texture(file);
+    device.render_state = state;
+    device.rasterizer = raster;
+    device.cull_mode = cull;
+    device.device_set_sampler(filter, address, address);
+    device.device_set_tiled(threads);
+    device.device_set_visibility(shade);
+    device.device_set_depth(zformat);
+
+    every = (ppm && strstr(ppm, "%d")) || (raw && strstr(raw, "%d"));
+
+    if (depth > 0) {
+        present_t ctx = { &screen, ppm, raw, heat, every, frames, -1 };
+        Pipeline *pipeline = new Pipeline(&device, depth, threads, present_frame, &ctx);
+        for (i = 0; i < frames; i++) {
+            pipeline->pipeline_begin();
+#ifdef MINI3D_STATS
+            device.device_stats_reset();
+#endif
+            device.device_clear(1);
+            device.camera_at_zero(pos, 0, 0);
+            if (obj) device.draw_mesh(&mesh, theta);
+            else device.draw_box(theta);
+            pipeline->pipeline_end();
+            theta += 0.01f;
+        }
+        delete pipeline;
+#ifndef MINI3D_STATS
+        if (heat) fprintf(stderr, "warning: -heat needs a MINI3D_STATS build\n");
+#endif
+        device.device_destroy(&device);
+        if (file) texture_release(file);
+        mesh_destroy(&mesh);
+        if (ctx.error >= 0) {
+            fprintf(stderr, "error: can not write frame %d\n", ctx.error);
+            return -3;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < frames; i++) {
+#ifdef MINI3D_STATS
+        device.device_stats_reset();
+#endif
+        device.device_clear(1);
+        device.camera_at_zero(pos, 0, 0);
+        if (obj) device.draw_mesh(&mesh, theta);
+        else device.draw_box(theta);
+        device.device_flush();
+        if (every || i == frames - 1) {
+            if (save_frame(screen, ppm, raw, i) != 0) {
+                fprintf(stderr, "error: can not write frame %d\n", i);
+                device.device_destroy(&device);
+                if (file) texture_release(file);
+                mesh_destroy(&mesh);
+                return -3;
+            }
+        }
+        theta += 0.01f;
+    }
+
+#ifdef MINI3D_STATS
+    if (save_stats(&device, heat) != 0)
+        fprintf(stderr, "error: can not write heat map\n");
+#else
+    if (heat) fprintf(stderr, "warning: -heat needs a MINI3D_STATS build\n");
+#endif
+
+    device.device_destroy(&device);
+    if (file) texture_release(file);
+    mesh_destroy(&mesh);
+    return 0;
+}
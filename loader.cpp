@@ -0,0 +1,292 @@
+#include "mini3d.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <mutex>
+
+//=====================================================================
+// 纹理文件：整个文件只读映射到内存，不经过 fread 的缓冲。
+// 32 位 BGRA 像素在内存里的排列与 UINT32 的 0xAARRGGBB 相同，第 0 层直接指向
+// 映射里的像素，只为 mip 链分配内存；其余格式逐个 texel 转换，直接写进分块存放的
+// 第 0 层，然后解除映射。每个 texel 最多复制一次。
+// BMP / TGA 的像素通常从 2 字节对齐的位置开始，不对齐的 UINT32 读写在任何平台上都是
+// 未定义行为（编译器自动向量化时会假定 4 字节对齐），只有 4 字节对齐时才直接使用。
+//=====================================================================
+
+#define LOADER_MAX_SIZE             (1 << (TEXTURE_LEVELS - 1))
+
+const void *file_map(const char *filename, long *size) {
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER length;
+    void *ptr = NULL;
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+    if (GetFileSizeEx(file, &length) && length.QuadPart > 0 && length.QuadPart < 0x7fffffff) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) {
+            ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    if (ptr) *size = (long)length.QuadPart;
+    return ptr;
+#else
+    struct stat st;
+    void *ptr = NULL;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size < 0x7fffffff) {
+        ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) ptr = NULL;
+    }
+    close(fd);
+    if (ptr) *size = (long)st.st_size;
+    return ptr;
+#endif
+}
+
+void file_unmap(const void *ptr, long size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(ptr);
+#else
+    munmap((void*)ptr, (size_t)size);
+#endif
+}
+
+
+//---------------------------------------------------------------------
+// 文件格式解析：得到像素在文件里的位置和排列方式
+//---------------------------------------------------------------------
+typedef struct Image {
+    const unsigned char *pixels;    // 文件里第一行的第一个像素
+    long pitch;                     // 文件里相邻两行的距离（字节）
+    int width, height;
+    int bpp;                        // 每像素位数：8 / 24 / 32
+    int bottom_up;                  // 文件里第一行是图像最下面的一行
+    int right_left;                 // 每行从右往左存放
+    UINT32 palette[256];            // 8 位像素的颜色表（调色板或者灰度）
+} image_t;
+
+static inline int loader_u16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+static inline UINT32 loader_u32(const unsigned char *p) {
+    return (UINT32)p[0] | ((UINT32)p[1] << 8) | ((UINT32)p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+// 像素区 [pixels, pixels + pitch * height) 必须在文件里，两端都要检查
+static int loader_check(const image_t *img, const unsigned char *data, long size) {
+    long long need = (long long)(img->pixels - data) + (long long)img->pitch * img->height;
+    return (img->pixels >= data && img->width > 0 && img->height > 0 && img->width <= LOADER_MAX_SIZE &&
+        img->height <= LOADER_MAX_SIZE && need <= size) ? 0 : -2;
+}
+
+// BMP：BI_RGB 的 8 / 24 / 32 位，以及掩码为 BGRX 的 BI_BITFIELDS 32 位
+static int loader_bmp(image_t *img, const unsigned char *data, long size) {
+    UINT32 header, offset, compression, height, count;
+    int i;
+    if (size < 54 || data[0] != 'B' || data[1] != 'M') return -2;
+    // 偏移和头的长度按无符号数比较：long 只有 32 位时（Win32）转成 long 可能变成负数。
+    // 像素区在文件头和信息头之后
+    offset = loader_u32(data + 10);
+    header = loader_u32(data + 14);
+    if (header < 40 || 14 + (long long)header > size) return -2;
+    if (offset < 14 + header || (long long)offset >= size) return -2;
+    img->width = (int)loader_u32(data + 18);
+    height = loader_u32(data + 22);
+    img->bpp = loader_u16(data + 28);
+    compression = loader_u32(data + 30);
+    // 高度为负表示从上往下存放。取绝对值在无符号数上做，0x80000000 取反不会溢出
+    img->bottom_up = (height < 0x80000000u);
+    if (!img->bottom_up) height = 0u - height;
+    if (height == 0 || height > LOADER_MAX_SIZE) return -2;
+    img->height = (int)height;
+    img->right_left = 0;
+    if (compression == 3) {
+        // 40 字节的头后面跟着三个掩码，更长的头把掩码放在头里
+        const unsigned char *mask = data + 14 + 40;
+        if (img->bpp != 32 || 14 + 40 + 12 > size) return -2;
+        if (loader_u32(mask) != 0xff0000 || loader_u32(mask + 4) != 0xff00 || loader_u32(mask + 8) != 0xff)
+            return -2;
+    }
+    else if (compression != 0) {
+        return -2;
+    }
+    if (img->bpp == 8) {
+        count = loader_u32(data + 46);
+        if (count == 0) count = 256;
+        if (count > 256 || 14 + (long long)header + count * 4 > size) return -2;
+        memset(img->palette, 0, sizeof(img->palette));
+        for (i = 0; i < (int)count; i++) {
+            const unsigned char *p = data + 14 + header + i * 4;
+            img->palette[i] = p[0] | (p[1] << 8) | (p[2] << 16);
+        }
+    }
+    else if (img->bpp != 24 && img->bpp != 32) {
+        return -2;
+    }
+    if (img->width <= 0 || img->width > LOADER_MAX_SIZE) return -2;
+    img->pitch = (((long)img->width * img->bpp + 31) / 32) * 4;
+    img->pixels = data + offset;
+    return loader_check(img, data, size);
+}
+
+// TGA：未压缩的类型 1（8 位索引）、2（24 / 32 位）、3（8 位灰度）
+static int loader_tga(image_t *img, const unsigned char *data, long size) {
+    int type, map_first, map_count, map_bits, i;
+    long pos;
+    if (size < 18) return -2;
+    type = data[2];
+    map_first = loader_u16(data + 3);
+    map_count = loader_u16(data + 5);
+    map_bits = data[7];
+    img->width = loader_u16(data + 12);
+    img->height = loader_u16(data + 14);
+    img->bpp = data[16];
+    img->bottom_up = (data[17] & 0x20) == 0;
+    img->right_left = (data[17] & 0x10) != 0;
+    pos = 18 + data[0];
+    if (data[1] == 1) {
+        if (map_bits != 24 && map_bits != 32) return -2;
+        if (pos + (long)map_count * (map_bits / 8) > size) return -2;
+        memset(img->palette, 0, sizeof(img->palette));
+        for (i = 0; i < map_count; i++) {
+            const unsigned char *p = data + pos + i * (map_bits / 8);
+            int index = map_first + i;
+            if (type != 1 || index > 255) continue;
+            img->palette[index] = p[0] | (p[1] << 8) | (p[2] << 16) | ((map_bits == 32) ? (UINT32)p[3] << 24 : 0);
+        }
+        pos += (long)map_count * (map_bits / 8);
+    }
+    else if (data[1] != 0) {
+        return -2;
+    }
+    if (type == 1) {
+        if (data[1] != 1 || img->bpp != 8) return -2;
+    }
+    else if (type == 2) {
+        if (img->bpp != 24 && img->bpp != 32) return -2;
+    }
+    else if (type == 3) {
+        if (img->bpp != 8) return -2;
+        for (i = 0; i < 256; i++) img->palette[i] = (UINT32)i * 0x010101;
+    }
+    else {
+        return -2;
+    }
+    img->pitch = (long)img->width * (img->bpp / 8);
+    img->pixels = data + pos;
+    return loader_check(img, data, size);
+}
+
+// 图像第 y 行（从上往下数）在文件里的位置
+static inline const unsigned char *loader_row(const image_t *img, int y) {
+    return img->pixels + img->pitch * (img->bottom_up ? img->height - 1 - y : y);
+}
+
+// 转换到分块存放的第 0 层
+static void loader_convert(texture_t *tex, const image_t *img) {
+    texture_level_t *level = &tex->level[0];
+    int x, y;
+    for (y = 0; y < img->height; y++) {
+        const unsigned char *row = loader_row(img, y);
+        for (x = 0; x < img->width; x++) {
+            const unsigned char *p = row + (long)(img->right_left ? img->width - 1 - x : x) * (img->bpp / 8);
+            UINT32 c;
+            if (img->bpp == 32) c = p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+            else if (img->bpp == 24) c = p[0] | (p[1] << 8) | (p[2] << 16);
+            else c = img->palette[p[0]];
+            level->bits[texture_offset(level, x, y)] = c;
+        }
+    }
+}
+
+int texture_load(texture_t *tex, const char *filename) {
+    const unsigned char *data;
+    image_t img;
+    long size;
+    data = (const unsigned char*)file_map(filename, &size);
+    if (data == NULL) return -1;
+    if (loader_bmp(&img, data, size) != 0 && loader_tga(&img, data, size) != 0) {
+        file_unmap(data, size);
+        return -2;
+    }
+    if (img.bpp == 32 && !img.right_left && ((size_t)img.pixels & 3) == 0) {
+        texture_init_shared(tex, loader_row(&img, 0), img.bottom_up ? -img.pitch : img.pitch,
+            img.width, img.height);
+        tex->mapped = data;
+        tex->mapped_size = size;
+        return 0;
+    }
+    texture_create(tex, img.width, img.height);
+    loader_convert(tex, &img);
+    texture_build_mips(tex);
+    file_unmap(data, size);
+    return 0;
+}
+
+
+//---------------------------------------------------------------------
+// 纹理注册表：按文件名散列，同一个文件只映射、转换一次。
+// 加载在锁里进行，多个线程同时请求同一个文件时只有一个真正加载
+//---------------------------------------------------------------------
+#define REGISTRY_SIZE               256
+
+typedef struct TextureEntry {
+    texture_t tex;                  // 必须是第一个成员，texture_release 由纹理指针找回表项
+    char *name;
+    int refs;
+    struct TextureEntry *next;
+} texture_entry_t;
+
+static texture_entry_t *registry[REGISTRY_SIZE];
+static std::mutex registry_lock;
+
+// FNV-1a
+static unsigned int registry_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name; name++) h = (h ^ (unsigned char)*name) * 16777619u;
+    return h % REGISTRY_SIZE;
+}
+
+const texture_t *texture_acquire(const char *filename) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    unsigned int h = registry_hash(filename);
+    texture_entry_t *entry;
+    for (entry = registry[h]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, filename) == 0) {
+            entry->refs++;
+            return &entry->tex;
+        }
+    }
+    entry = (texture_entry_t*)malloc(sizeof(texture_entry_t) + strlen(filename) + 1);
+    assert(entry);
+    if (texture_load(&entry->tex, filename) != 0) {
+        free(entry);
+        return NULL;
+    }
+    entry->name = (char*)(entry + 1);
+    strcpy(entry->name, filename);
+    entry->refs = 1;
+    entry->next = registry[h];
+    registry[h] = entry;
+    return &entry->tex;
+}
+
+void texture_release(const texture_t *tex) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    texture_entry_t *entry = (texture_entry_t*)tex, **p;
+    if (--entry->refs > 0) return;
+    for (p = &registry[registry_hash(entry->name)]; *p != entry; p = &(*p)->next);
+    *p = entry->next;
+    texture_destroy(&entry->tex);
+    free(entry);
+}
@@ -0,0 +1,362 @@
+#include "mini3d.h"
+
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+//=====================================================================
+// 网格简化：二次误差度量（quadric error metric）的半边折叠。
+// 每个顶点累加相邻三角形所在平面的二次型（按面积加权），把顶点 a 折叠到相邻的顶点 b 的代价为
+// b 的位置代入 Q(a) + Q(b)，再除以二次型的总面积，即 b 到这些平面按面积平均的距离平方。
+// 所有候选边放进按代价排序的堆，每次取出代价最小的一条，代价超过上限时停止；
+// 顶点改动后版本号加一，堆里引用旧版本的候选边取出时直接丢弃，不用从堆里删除。
+// 半边折叠不产生新顶点，顶点的纹理坐标、颜色原样保留。
+// 只属于一个三角形的边是网格的边界，UV 接缝处的顶点按 (位置, 纹理坐标) 拆开，接缝也是边界：
+// 边界上的顶点不移动，简化之后接缝两侧仍然严丝合缝。
+//=====================================================================
+
+#define LOD_PIXELS                  8.0f    // 选层时每个三角形大约覆盖的像素
+#define LOD_FLIP                    0.2f    // 折叠后法线与原来夹角的余弦至少为多少，防止三角形翻面
+#define LOD_ERROR                   0.02f   // 折叠使表面移动的距离不超过包围球半径的多少，选层距离上不到一个像素
+#define LOD_SHRINK                  0.05f   // 每层的包围盒各个面向内收缩不超过包围球半径的多少
+#define LOD_COVERAGE                0.1f    // 每层在各个方向上的投影面积与第 0 层相差不超过多少
+#define LOD_VIEWS                   7       // 比较投影面积的方向：三个轴和四条体对角线
+
+typedef struct LodQuadric { double a[10]; } lod_quadric_t;   // 对称 4x4：00 01 02 03 11 12 13 22 23 33
+
+typedef struct LodEdge {
+    double error;
+    int a, b;                       // 把 a 折叠到 b
+    unsigned int va, vb;            // 放进堆时 a、b 的版本号
+    bool operator<(const LodEdge &e) const { return error > e.error; }
+} lod_edge_t;
+
+typedef struct LodState {
+    const mesh_t *mesh;
+    std::vector<lod_quadric_t> quadric;
+    std::vector<std::vector<int> > adjacent;    // 每个顶点相邻的三角形，可能含已经删除的
+    std::vector<int> tris;                      // 3 个下标一个三角形，删除的第一个下标为 -1
+    std::vector<unsigned int> version;
+    std::vector<unsigned char> locked;          // 边界上的顶点
+    std::vector<unsigned char> removed;         // 已经折叠掉的顶点
+    std::vector<unsigned int> mark;             // 求公共邻点用的标记
+    unsigned int stamp;
+    std::priority_queue<lod_edge_t> heap;
+} lod_state_t;
+
+static inline const point_t *lod_pos(const lod_state_t *s, int v) {
+    return &s->mesh->vertices[v].pos;
+}
+
+static void lod_quadric_add_plane(lod_quadric_t *q, double a, double b, double c, double d, double w) {
+    q->a[0] += w * a * a, q->a[1] += w * a * b, q->a[2] += w * a * c, q->a[3] += w * a * d;
+    q->a[4] += w * b * b, q->a[5] += w * b * c, q->a[6] += w * b * d;
+    q->a[7] += w * c * c, q->a[8] += w * c * d;
+    q->a[9] += w * d * d;
+}
+
+// v^T (q1 + q2) v，v = (x, y, z, 1)，除以总面积：平面的法线是单位向量，
+// 二次型左上 3x3 的迹就是累加进来的面积
+static double lod_quadric_error(const lod_quadric_t *q1, const lod_quadric_t *q2, const point_t *p) {
+    double a[10], x = p->x, y = p->y, z = p->z, e, w;
+    int i;
+    for (i = 0; i < 10; i++) a[i] = q1->a[i] + q2->a[i];
+    e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x +
+        a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y +
+        a[7] * z * z + 2 * a[8] * z + a[9];
+    w = a[0] + a[4] + a[7];
+    return (w > 0) ? e / w : e;
+}
+
+// 三角形法线（未归一化，长度为面积的两倍），p 不为 NULL 时用 p 代替顶点 replace 的位置
+static void lod_normal(const lod_state_t *s, const int *t, int replace, const point_t *p, double *n) {
+    const point_t *v[3];
+    double e1[3], e2[3];
+    int i;
+    for (i = 0; i < 3; i++) v[i] = (p != NULL && t[i] == replace) ? p : lod_pos(s, t[i]);
+    e1[0] = v[1]->x - v[0]->x, e1[1] = v[1]->y - v[0]->y, e1[2] = v[1]->z - v[0]->z;
+    e2[0] = v[2]->x - v[0]->x, e2[1] = v[2]->y - v[0]->y, e2[2] = v[2]->z - v[0]->z;
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static inline int lod_has(const int *t, int v) {
+    return t[0] == v || t[1] == v || t[2] == v;
+}
+
+// 把 a 折叠到 b 是否保持网格的拓扑和朝向
+static int lod_check(lod_state_t *s, int a, int b) {
+    const std::vector<int> &ta = s->adjacent[a], &tb = s->adjacent[b];
+    int shared = 0, common = 0;
+    size_t i;
+    int k;
+    // 连接条件：a、b 的公共邻点恰好是共享 ab 边的三角形的第三个顶点，否则折叠后出现非流形的边
+    s->stamp += 2;
+    for (i = 0; i < ta.size(); i++) {
+        const int *t = &s->tris[ta[i] * 3];
+        if (t[0] < 0) continue;
+        if (lod_has(t, b)) shared++;
+        for (k = 0; k < 3; k++) if (t[k] != a) s->mark[t[k]] = s->stamp;
+    }
+    for (i = 0; i < tb.size(); i++) {
+        const int *t = &s->tris[tb[i] * 3];
+        if (t[0] < 0) continue;
+        for (k = 0; k < 3; k++) {
+            if (t[k] != b && s->mark[t[k]] == s->stamp) {
+                s->mark[t[k]] = s->stamp + 1;
+                common++;
+            }
+        }
+    }
+    if (shared == 0 || common != shared) return 0;
+    // a 的其余三角形换成 b 的位置之后不能翻面，也不能退化
+    for (i = 0; i < ta.size(); i++) {
+        const int *t = &s->tris[ta[i] * 3];
+        double n0[3], n1[3], d, l0, l1;
+        if (t[0] < 0 || lod_has(t, b)) continue;
+        lod_normal(s, t, a, NULL, n0);
+        lod_normal(s, t, a, lod_pos(s, b), n1);
+        d = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+        l0 = n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2];
+        l1 = n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2];
+        if (l1 <= 0 || d <= 0 || d * d < (double)LOD_FLIP * LOD_FLIP * l0 * l1) return 0;
+    }
+    return 1;
+}
+
+// 边 (a, b) 的两个方向中代价小的一个放进堆，两端都在边界上时不放
+static void lod_push(lod_state_t *s, int a, int b) {
+    lod_edge_t e;
+    double ea, eb;
+    if (s->locked[a] && s->locked[b]) return;
+    ea = s->locked[a] ? 1e300 : lod_quadric_error(&s->quadric[a], &s->quadric[b], lod_pos(s, b));
+    eb = s->locked[b] ? 1e300 : lod_quadric_error(&s->quadric[a], &s->quadric[b], lod_pos(s, a));
+    if (ea <= eb) e.a = a, e.b = b, e.error = ea;
+    else e.a = b, e.b = a, e.error = eb;
+    e.va = s->version[e.a];
+    e.vb = s->version[e.b];
+    s->heap.push(e);
+}
+
+// 把 a 折叠到 b，返回删除的三角形数
+static int lod_collapse(lod_state_t *s, int a, int b) {
+    std::vector<int> &ta = s->adjacent[a], &tb = s->adjacent[b];
+    int deleted = 0, k;
+    size_t i, n;
+    for (i = 0; i < ta.size(); i++) {
+        int *t = &s->tris[ta[i] * 3];
+        if (t[0] < 0) continue;
+        if (lod_has(t, b)) {
+            t[0] = -1;
+            deleted++;
+            continue;
+        }
+        for (k = 0; k < 3; k++) if (t[k] == a) t[k] = b;
+        tb.push_back(ta[i]);
+    }
+    std::vector<int>().swap(ta);
+    for (k = 0; k < 10; k++) s->quadric[b].a[k] += s->quadric[a].a[k];
+    s->removed[a] = 1;
+    s->version[a]++;
+    s->version[b]++;
+    // 去掉 b 相邻的已删除三角形，b 的每条边重新估价
+    for (i = 0, n = 0; i < tb.size(); i++) {
+        const int *t = &s->tris[tb[i] * 3];
+        if (t[0] < 0) continue;
+        tb[n++] = tb[i];
+        for (k = 0; k < 3; k++) if (t[k] != b) lod_push(s, b, t[k]);
+    }
+    tb.resize(n);
+    return deleted;
+}
+
+int mesh_simplify(mesh_t *out, const mesh_t *mesh, int target, float max_error) {
+    lod_state_t s;
+    std::vector<long long> edges;
+    std::vector<int> remap;
+    int count = mesh->count, alive = mesh->icount / 3, i, k, n;
+
+    memset(out, 0, sizeof(mesh_t));
+    s.mesh = mesh;
+    s.tris.assign(mesh->indices, mesh->indices + alive * 3);
+    s.quadric.assign(count, lod_quadric_t());
+    s.adjacent.resize(count);
+    s.version.assign(count, 0);
+    s.locked.assign(count, 0);
+    s.removed.assign(count, 0);
+    s.mark.assign(count, 0);
+    s.stamp = 0;
+    for (i = 0; i < count; i++) memset(&s.quadric[i], 0, sizeof(lod_quadric_t));
+
+    // 每个三角形所在平面按面积加权累加到三个顶点
+    for (i = 0; i < alive; i++) {
+        const int *t = &s.tris[i * 3];
+        const point_t *p = lod_pos(&s, t[0]);
+        double nn[3], len;
+        lod_normal(&s, t, -1, NULL, nn);
+        len = sqrt(nn[0] * nn[0] + nn[1] * nn[1] + nn[2] * nn[2]);
+        for (k = 0; k < 3; k++) s.adjacent[t[k]].push_back(i);
+        if (len <= 0) continue;
+        nn[0] /= len, nn[1] /= len, nn[2] /= len;
+        for (k = 0; k < 3; k++)
+            lod_quadric_add_plane(&s.quadric[t[k]], nn[0], nn[1], nn[2],
+                -(nn[0] * p->x + nn[1] * p->y + nn[2] * p->z), len * 0.5);
+    }
+
+    // 只出现一次（边界、接缝）或者超过两次（非流形）的边，两端的顶点锁定
+    edges.reserve(alive * 3);
+    for (i = 0; i < alive; i++) {
+        const int *t = &s.tris[i * 3];
+        for (k = 0; k < 3; k++) {
+            long long a = t[k], b = t[(k + 1) % 3];
+            edges.push_back((a < b) ? (a << 32) | b : (b << 32) | a);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (i = 0; i < (int)edges.size(); i = n) {
+        for (n = i + 1; n < (int)edges.size() && edges[n] == edges[i]; n++);
+        if (n - i != 2) {
+            s.locked[(int)(edges[i] >> 32)] = 1;
+            s.locked[(int)(edges[i] & 0xffffffff)] = 1;
+        }
+    }
+    for (i = 0; i < (int)edges.size(); i++) {
+        if (i > 0 && edges[i] == edges[i - 1]) continue;
+        lod_push(&s, (int)(edges[i] >> 32), (int)(edges[i] & 0xffffffff));
+    }
+    std::vector<long long>().swap(edges);
+
+    while (alive > target && !s.heap.empty()) {
+        lod_edge_t e = s.heap.top();
+        // 堆顶是代价最小的候选边，它超过上限就没有可以折叠的边了
+        if (max_error > 0 && e.error > (double)max_error * max_error) break;
+        s.heap.pop();
+        if (s.removed[e.a] || s.removed[e.b]) continue;
+        if (s.version[e.a] != e.va || s.version[e.b] != e.vb) continue;
+        if (!lod_check(&s, e.a, e.b)) continue;
+        alive -= lod_collapse(&s, e.a, e.b);
+    }
+
+    // 按第一次使用的顺序收集剩下的顶点
+    remap.assign(count, -1);
+    out->vertices = (vertex_t*)malloc(sizeof(vertex_t) * (count + 1));
+    out->indices = (int*)malloc(sizeof(int) * (alive * 3 + 1));
+    assert(out->vertices && out->indices);
+    for (i = 0, n = 0; i < mesh->icount / 3; i++) {
+        const int *t = &s.tris[i * 3];
+        if (t[0] < 0) continue;
+        for (k = 0; k < 3; k++) {
+            if (remap[t[k]] < 0) {
+                remap[t[k]] = out->count;
+                out->vertices[out->count++] = mesh->vertices[t[k]];
+            }
+            out->indices[n++] = remap[t[k]];
+        }
+    }
+    out->icount = n;
+    out->vertices = (vertex_t*)realloc(out->vertices, sizeof(vertex_t) * (out->count + 1));
+    mesh_update_bounds(out);
+    return n / 3;
+}
+
+
+//---------------------------------------------------------------------
+// 细节层次
+//---------------------------------------------------------------------
+
+// 网格在 LOD_VIEWS 个方向上的投影面积：每个三角形的面积乘法线与方向夹角余弦的绝对值，求和再减半。
+// 封闭的凸网格上正好是轮廓的面积，同一个距离上覆盖的像素数与它成正比
+static void lod_coverage(const mesh_t *mesh, double *area) {
+    static const double views[LOD_VIEWS][3] = {
+        { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 },
+        { 0.57735, 0.57735, 0.57735 }, { -0.57735, 0.57735, 0.57735 },
+        { 0.57735, -0.57735, 0.57735 }, { 0.57735, 0.57735, -0.57735 },
+    };
+    int i, k;
+    for (k = 0; k < LOD_VIEWS; k++) area[k] = 0;
+    for (i = 0; i < mesh->icount; i += 3) {
+        const point_t *a = &mesh->vertices[mesh->indices[i]].pos;
+        const point_t *b = &mesh->vertices[mesh->indices[i + 1]].pos;
+        const point_t *c = &mesh->vertices[mesh->indices[i + 2]].pos;
+        double e1[3] = { b->x - a->x, b->y - a->y, b->z - a->z };
+        double e2[3] = { c->x - a->x, c->y - a->y, c->z - a->z };
+        double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        for (k = 0; k < LOD_VIEWS; k++)
+            area[k] += 0.25 * fabs(n[0] * views[k][0] + n[1] * views[k][1] + n[2] * views[k][2]);
+    }
+}
+
+// 简化后的一层是否还保持原来的形状：包围盒没有明显收缩，各个方向的投影面积（也就是在
+// 选层距离上覆盖的像素）与第 0 层相近。半边折叠只删除顶点，包围盒只会变小
+static int lod_accept(const mesh_lod_t *lod, const mesh_t *level, const double *coverage) {
+    const mesh_t *base = &lod->level[0];
+    float d = LOD_SHRINK * lod->radius;
+    double area[LOD_VIEWS];
+    int k;
+    if (level->lo.x > base->lo.x + d || level->lo.y > base->lo.y + d || level->lo.z > base->lo.z + d) return 0;
+    if (level->hi.x < base->hi.x - d || level->hi.y < base->hi.y - d || level->hi.z < base->hi.z - d) return 0;
+    lod_coverage(level, area);
+    for (k = 0; k < LOD_VIEWS; k++)
+        if (fabs(area[k] - coverage[k]) > LOD_COVERAGE * coverage[k]) return 0;
+    return 1;
+}
+
+int mesh_lod_build(mesh_lod_t *lod, const mesh_t *mesh, int levels) {
+    float dx = mesh->hi.x - mesh->lo.x, dy = mesh->hi.y - mesh->lo.y, dz = mesh->hi.z - mesh->lo.z;
+    double coverage[LOD_VIEWS];
+    int i;
+    memset(lod, 0, sizeof(mesh_lod_t));
+    lod->level[0] = *mesh;
+    lod->levels = 1;
+    lod->center.x = (mesh->lo.x + mesh->hi.x) * 0.5f;
+    lod->center.y = (mesh->lo.y + mesh->hi.y) * 0.5f;
+    lod->center.z = (mesh->lo.z + mesh->hi.z) * 0.5f;
+    lod->center.w = 1.0f;
+    lod->radius = (float)sqrt(dx * dx + dy * dy + dz * dz) * 0.5f;
+    if (levels > MESH_LODS) levels = MESH_LODS;
+    lod_coverage(mesh, coverage);
+    // 每层从上一层简化到四分之一，折叠的误差不超过包围球半径的 LOD_ERROR。
+    // 减不到四分之三以下说明已经简化不下去了；形状走样的一层也不要，更粗的层只会更差
+    for (i = 1; i < levels; i++) {
+        const mesh_t *prev = &lod->level[i - 1];
+        int tris = prev->icount / 3, n;
+        if (tris / 4 < 2) break;
+        n = mesh_simplify(&lod->level[i], prev, tris / 4, LOD_ERROR * lod->radius);
+        if (n > tris * 3 / 4 || !lod_accept(lod, &lod->level[i], coverage)) {
+            mesh_destroy(&lod->level[i]);
+            break;
+        }
+        lod->levels++;
+    }
+    return lod->levels;
+}
+
+void mesh_lod_destroy(mesh_lod_t *lod) {
+    int i;
+    for (i = 1; i < lod->levels; i++)
+        mesh_destroy(&lod->level[i]);
+    memset(lod, 0, sizeof(mesh_lod_t));
+}
+
+int mesh_lod_select(const mesh_lod_t *lod, const transform_t *ts) {
+    const matrix_t *w = &ts->world;
+    float scale = 0, r, px, budget;
+    vector_t clip;
+    int i;
+    // 世界矩阵三个轴中最大的缩放，包围球半径按它放大
+    for (i = 0; i < 3; i++) {
+        float s = w->m[i][0] * w->m[i][0] + w->m[i][1] * w->m[i][1] + w->m[i][2] * w->m[i][2];
+        if (s > scale) scale = s;
+    }
+    r = lod->radius * (float)sqrt(scale);
+    matrix_apply(&clip, &lod->center, &ts->transform);
+    if (clip.w <= r) return 0;
+    // 屏幕上的半径（像素）：透视投影的 m[1][1] 为 cot(fovy / 2)，w 为到摄像机的距离
+    px = r * ts->projection.m[1][1] * ts->h * 0.5f / clip.w;
+    budget = 3.1415926f * px * px / LOD_PIXELS;
+    // 三角形数不少于 budget 的最粗一层
+    for (i = lod->levels - 1; i > 0; i--)
+        if (lod->level[i].icount / 3 >= budget) return i;
+    return 0;
+}
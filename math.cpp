@@ -22,12 +22,12 @@ void vector_sub(vector_t *z, const vector_t *x, const vector_t *y) {
     z->w = 1.0;
 }
 
-// ʸ
+// 矢量点乘
 float vector_dotproduct(const vector_t *x, const vector_t *y) {
     return x->x * y->x + x->y * y->y + x->z * y->z;
 }
 
-// ʸ
+// 矢量叉乘
 void vector_crossproduct(vector_t *z, const vector_t *x, const vector_t *y) {
     float m1, m2, m3;
     m1 = x->y * y->z - x->z * y->y;
@@ -39,7 +39,7 @@ void vector_crossproduct(vector_t *z, const vector_t *x, const vector_t *y) {
     z->w = 1.0f;
 }
 
-// ʸֵtȡֵ [0, 1]
+// 矢量插值，t取值 [0, 1]
 void vector_interp(vector_t *z, const vector_t *x1, const vector_t *x2, float t) {
     z->x = interp(x1->x, x2->x, t);
     z->y = interp(x1->y, x2->y, t);
@@ -47,7 +47,7 @@ void vector_interp(vector_t *z, const vector_t *x1, const vector_t *x2, float t)
     z->w = 1.0f;
 }
 
-// ʸһ
+// 矢量归一化
 void vector_normalize(vector_t *v) {
     float length = vector_length(v);
     if (length != 0.0f) {
@@ -110,6 +110,56 @@ void matrix_apply(vector_t *y, const vector_t *x, const matrix_t *m) {
     y->w = X * m->m[0][3] + Y * m->m[1][3] + Z * m->m[2][3] + W * m->m[3][3];
 }
 
+// 批量 y = x * m：四个分量的乘加顺序与 matrix_apply 相同，保证结果一致
+void matrix_apply_batch(vector_soa_t *y, const vector_soa_t *x, const matrix_t *m, int n) {
+    int i = 0;
+#ifdef MINI3D_AVX2
+    {
+        __m256 c[4][4];
+        int k;
+        for (k = 0; k < 16; k++) c[k >> 2][k & 3] = _mm256_set1_ps(m->m[k >> 2][k & 3]);
+        for (; i + 8 <= n; i += 8) {
+            __m256 X = _mm256_loadu_ps(x->x + i), Y = _mm256_loadu_ps(x->y + i);
+            __m256 Z = _mm256_loadu_ps(x->z + i), W = _mm256_loadu_ps(x->w + i);
+            float *out[4] = { y->x + i, y->y + i, y->z + i, y->w + i };
+            for (k = 0; k < 4; k++) {
+                __m256 r = _mm256_mul_ps(X, c[0][k]);
+                r = _mm256_add_ps(r, _mm256_mul_ps(Y, c[1][k]));
+                r = _mm256_add_ps(r, _mm256_mul_ps(Z, c[2][k]));
+                r = _mm256_add_ps(r, _mm256_mul_ps(W, c[3][k]));
+                _mm256_storeu_ps(out[k], r);
+            }
+        }
+    }
+#endif
+#ifdef MINI3D_SSE2
+    {
+        __m128 c[4][4];
+        int k;
+        for (k = 0; k < 16; k++) c[k >> 2][k & 3] = _mm_set1_ps(m->m[k >> 2][k & 3]);
+        for (; i + 4 <= n; i += 4) {
+            __m128 X = _mm_loadu_ps(x->x + i), Y = _mm_loadu_ps(x->y + i);
+            __m128 Z = _mm_loadu_ps(x->z + i), W = _mm_loadu_ps(x->w + i);
+            float *out[4] = { y->x + i, y->y + i, y->z + i, y->w + i };
+            for (k = 0; k < 4; k++) {
+                __m128 r = _mm_mul_ps(X, c[0][k]);
+                r = _mm_add_ps(r, _mm_mul_ps(Y, c[1][k]));
+                r = _mm_add_ps(r, _mm_mul_ps(Z, c[2][k]));
+                r = _mm_add_ps(r, _mm_mul_ps(W, c[3][k]));
+                _mm_storeu_ps(out[k], r);
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        float X = x->x[i], Y = x->y[i], Z = x->z[i], W = x->w[i];
+        y->x[i] = X * m->m[0][0] + Y * m->m[1][0] + Z * m->m[2][0] + W * m->m[3][0];
+        y->y[i] = X * m->m[0][1] + Y * m->m[1][1] + Z * m->m[2][1] + W * m->m[3][1];
+        y->z[i] = X * m->m[0][2] + Y * m->m[1][2] + Z * m->m[2][2] + W * m->m[3][2];
+        y->w[i] = X * m->m[0][3] + Y * m->m[1][3] + Z * m->m[2][3] + W * m->m[3][3];
+    }
+}
+
 void matrix_set_identity(matrix_t *m) {
     m->m[0][0] = m->m[1][1] = m->m[2][2] = m->m[3][3] = 1.0f;
     m->m[0][1] = m->m[0][2] = m->m[0][3] = 0.0f;
@@ -125,7 +175,7 @@ void matrix_set_zero(matrix_t *m) {
     m->m[3][0] = m->m[3][1] = m->m[3][2] = m->m[3][3] = 0.0f;
 }
 
-// ƽƱ任
+// 平移变换
 void matrix_set_translate(matrix_t *m, float x, float y, float z) {
     matrix_set_identity(m);
     m->m[3][0] = x;
@@ -133,7 +183,7 @@ void matrix_set_translate(matrix_t *m, float x, float y, float z) {
     m->m[3][2] = z;
 }
 
-// ű任
+// 缩放变换
 void matrix_set_scale(matrix_t *m, float x, float y, float z) {
     matrix_set_identity(m);
     m->m[0][0] = x;
@@ -141,7 +191,7 @@ void matrix_set_scale(matrix_t *m, float x, float y, float z) {
     m->m[2][2] = z;
 }
 
-// ת
+// 旋转矩阵
 void matrix_set_rotate(matrix_t *m, float x, float y, float z, float theta) {
     float qsin = (float)sin(theta * 0.5f);
     float qcos = (float)cos(theta * 0.5f);
@@ -165,7 +215,7 @@ void matrix_set_rotate(matrix_t *m, float x, float y, float z, float theta) {
     m->m[3][3] = 1.0f;
 }
 
-// 
+// 设置摄像机
 void matrix_set_lookat(matrix_t *m, const vector_t *eye, const vector_t *at, const vector_t *up) {
     vector_t xaxis, yaxis, zaxis;
 
@@ -1,18 +1,32 @@
+#ifndef _MINI3D_MATH_H_
+#define _MINI3D_MATH_H_
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
 
-#include <windows.h>
-#include <tchar.h>
+// SSE2：x64 上总是可用，x86 需要编译器打开
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MINI3D_SSE2                 1
+#include <emmintrin.h>
+#endif
+
+// AVX2：需要以 -mavx2 或 /arch:AVX2 编译（cmake -DMINI3D_AVX2=ON）
+#if defined(__AVX2__)
+#define MINI3D_AVX2                 1
+#include <immintrin.h>
+#endif
 
 typedef struct Matrix { float m[4][4]; } matrix_t;
 typedef struct Vector { float x, y, z, w; } vector_t;
 typedef vector_t point_t;
+// 结构体数组（SoA）形式的一批矢量：第 i 个为 (x[i], y[i], z[i], w[i])
+typedef struct VectorSoA { float *x, *y, *z, *w; } vector_soa_t;
 
 inline int clamp(int x, int min, int max) { return (x < min) ? min : ((x > max) ? max : x); }
 
-// ֵt Ϊ [0, 1] ֵ֮
+// 计算插值：t 为 [0, 1] 之间的数值
 inline float interp(float x1, float x2, float t) { return x1 + (x2 - x1) * t; }
 
 // | v |
@@ -21,13 +35,13 @@ float vector_length(const vector_t *v);
 void vector_add(vector_t *z, const vector_t *x, const vector_t *y);
 // z = x - y
 void vector_sub(vector_t *z, const vector_t *x, const vector_t *y);
-// ʸ
+// 矢量点乘
 float vector_dotproduct(const vector_t *x, const vector_t *y);
-// ʸ
+// 矢量叉乘
 void vector_crossproduct(vector_t *z, const vector_t *x, const vector_t *y);
-// ʸֵtȡֵ [0, 1]
+// 矢量插值，t取值 [0, 1]
 void vector_interp(vector_t *z, const vector_t *x1, const vector_t *x2, float t);
-// ʸһ
+// 矢量归一化
 void vector_normalize(vector_t *v);
 
 
@@ -42,18 +56,21 @@ void matrix_mul(matrix_t *c, const matrix_t *a, const matrix_t *b);
 void matrix_scale(matrix_t *c, const matrix_t *a, float f);
 // y = x * m
 void matrix_apply(vector_t *y, const vector_t *x, const matrix_t *m);
-// λ
+// y[i] = x[i] * m，共 n 个，AVX 一次 8 个、SSE 一次 4 个，结果与 matrix_apply 逐位一致
+void matrix_apply_batch(vector_soa_t *y, const vector_soa_t *x, const matrix_t *m, int n);
+// 单位矩阵
 void matrix_set_identity(matrix_t *m);
-// 0 
+// 0 矩阵
 void matrix_set_zero(matrix_t *m);
-// ƽƱ任
+// 平移变换
 void matrix_set_translate(matrix_t *m, float x, float y, float z);
-// ű任
+// 缩放变换
 void matrix_set_scale(matrix_t *m, float x, float y, float z);
-// ת
+// 旋转矩阵
 void matrix_set_rotate(matrix_t *m, float x, float y, float z, float theta);
-// 
+// 设置摄像机
 void matrix_set_lookat(matrix_t *m, const vector_t *eye, const vector_t *at, const vector_t *up);
 // D3DXMatrixPerspectiveFovLH
 void matrix_set_perspective(matrix_t *m, float fovy, float aspect, float zn, float zf);
 
+#endif
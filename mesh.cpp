@@ -0,0 +1,315 @@
+#include "mini3d.h"
+
+#include <thread>
+#include <vector>
+
+//=====================================================================
+// OBJ 网格：整个文件只读映射，按行边界切成若干段，每段由一个线程从头到尾扫描一次，
+// 位置、纹理坐标和三角形的角点存进段内的数组。之后按段的顺序拼接位置和纹理坐标，
+// 再把位置、纹理坐标都相同的角点合并成一个顶点，得到 draw_indexed 用的顶点和索引，
+// 每拼接完一段就释放这一段的数组，临时内存不会比最终的缓冲大很多。
+// 多边形面按扇形拆成三角形；v 后面跟 r g b 的扩展写法读入顶点颜色，没有时为白色。
+// vertex_t 没有法线，vn 直接跳过，只有法线不同的角点合并成同一个顶点。
+// OBJ 的纹理坐标 v 向上，纹理的第 0 行在最上面，所以 tc.v 取 1 - v。
+//=====================================================================
+
+#define MESH_CHUNK_MIN              (4 << 20)   // 每段至少 4MB，小文件只用一个线程
+#define MESH_RELATIVE               (1 << 30)   // 段内的相对下标减去它存放，与绝对下标区分
+#define MESH_NONE                   (-0x7fffffff - 1)   // 角点没有纹理坐标
+
+// 一段文件的解析结果。角点的下标 >= 0 为绝对下标（从 0 开始），负数为段内相对下标 r 减去
+// MESH_RELATIVE，r 加上这一段之前的数量才是绝对下标
+typedef struct MeshChunk {
+    const char *begin, *end;
+    std::vector<float> pos;         // 每个位置 6 个 float：x y z r g b
+    std::vector<float> uv;          // 每个纹理坐标 2 个 float
+    std::vector<int> corners;       // 每个三角形 3 个角点，每个角点两个下标：位置、纹理坐标
+    int error;
+} mesh_chunk_t;
+
+static inline int mesh_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// 读一个浮点数：整数部分和小数部分先累加成 64 位整数，再乘 10 的幂，比 strtof 快，也不受 locale 影响
+static const char *mesh_float(const char *p, const char *end, float *out) {
+    static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    unsigned long long mant = 0;
+    int neg = 0, exp = 0, digits = 0;
+    double value;
+    while (p < end && mesh_space(*p)) p++;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (mant < 100000000000000000ull) mant = mant * 10 + (*p - '0');
+        else exp++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (mant < 100000000000000000ull) mant = mant * 10 + (*p - '0'), exp--;
+        }
+    }
+    if (digits == 0) return NULL;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int eneg = 0, e = 0;
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) eneg = (*p++ == '-');
+        if (p >= end || *p < '0' || *p > '9') return NULL;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+            if (e < 10000) e = e * 10 + (*p - '0');
+        exp += eneg ? -e : e;
+    }
+    value = (double)mant;
+    if (exp < 0) value = (exp >= -22) ? value / pow10[-exp] : value * pow(10.0, exp);
+    else if (exp > 0) value = (exp <= 22) ? value * pow10[exp] : value * pow(10.0, exp);
+    *out = (float)(neg ? -value : value);
+    return p;
+}
+
+// 读一个有符号整数下标，0 不是合法的 OBJ 下标
+static const char *mesh_int(const char *p, const char *end, int *out) {
+    int neg = 0, digits = 0;
+    long long v = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+        if (v < 0x7fffffff) v = v * 10 + (*p - '0');
+    if (digits == 0 || v == 0 || v >= 0x7fffffff) return NULL;
+    *out = (int)(neg ? -v : v);
+    return p;
+}
+
+// OBJ 下标转换成角点里存放的下标，count 为段内已经读到的数量。
+// 相对下标 i 必须大于 -MESH_RELATIVE，mesh_face 先检查，这里不会溢出
+static inline int mesh_index(int i, int count) {
+    return (i > 0) ? i - 1 : count + i - MESH_RELATIVE;
+}
+
+// 读一个面：每个角点为 v、v/vt、v//vn 或者 v/vt/vn，按扇形拆成三角形
+static const char *mesh_face(mesh_chunk_t *chunk, const char *p, const char *end) {
+    int pc = (int)(chunk->pos.size() / 6), tc = (int)(chunk->uv.size() / 2);
+    int first[2], prev[2], n = 0;
+    while (1) {
+        int v, t = MESH_NONE, k;
+        while (p < end && mesh_space(*p)) p++;
+        if (p >= end || *p == '\n' || *p == '#') break;
+        // 前面各段的数量这里还不知道，相对下标只能按 MESH_RELATIVE 限制
+        if ((p = mesh_int(p, end, &v)) == NULL || v <= -MESH_RELATIVE) return NULL;
+        v = mesh_index(v, pc);
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p != '/') {
+                if ((p = mesh_int(p, end, &t)) == NULL || t <= -MESH_RELATIVE) return NULL;
+                t = mesh_index(t, tc);
+            }
+            if (p < end && *p == '/') {
+                p++;
+                if ((p = mesh_int(p, end, &k)) == NULL) return NULL;
+            }
+        }
+        if (p < end && !mesh_space(*p) && *p != '\n') return NULL;
+        if (n >= 2) {
+            chunk->corners.push_back(first[0]);
+            chunk->corners.push_back(first[1]);
+            chunk->corners.push_back(prev[0]);
+            chunk->corners.push_back(prev[1]);
+            chunk->corners.push_back(v);
+            chunk->corners.push_back(t);
+        }
+        if (n == 0) first[0] = v, first[1] = t;
+        prev[0] = v, prev[1] = t;
+        n++;
+    }
+    return (n >= 3) ? p : NULL;
+}
+
+// 扫描一段：只认 v、vt、f，其余的行（vn、o、g、s、usemtl、注释等）跳过
+static void mesh_parse(mesh_chunk_t *chunk) {
+    const char *p = chunk->begin, *end = chunk->end;
+    chunk->error = 0;
+    while (p < end) {
+        const char *next;
+        while (p < end && mesh_space(*p)) p++;
+        if (p + 1 < end && p[0] == 'v' && mesh_space(p[1])) {
+            float a[6] = { 0, 0, 0, 1, 1, 1 };
+            int k;
+            for (k = 0, p++; k < 6; k++) {
+                const char *q = mesh_float(p, end, &a[k]);
+                if (q == NULL) break;
+                p = q;
+            }
+            if (k < 3) { chunk->error = 1; return; }
+            if (k < 6) a[3] = a[4] = a[5] = 1.0f;
+            chunk->pos.insert(chunk->pos.end(), a, a + 6);
+        }
+        else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && mesh_space(p[2])) {
+            float a[2] = { 0, 0 };
+            const char *q = mesh_float(p + 2, end, &a[0]);
+            if (q == NULL) { chunk->error = 1; return; }
+            p = q;
+            if ((q = mesh_float(p, end, &a[1])) != NULL) p = q;
+            chunk->uv.push_back(a[0]);
+            chunk->uv.push_back(1.0f - a[1]);
+        }
+        else if (p + 1 < end && p[0] == 'f' && mesh_space(p[1])) {
+            if ((p = mesh_face(chunk, p + 1, end)) == NULL) { chunk->error = 1; return; }
+        }
+        next = (const char*)memchr(p, '\n', end - p);
+        p = (next != NULL) ? next + 1 : end;
+    }
+}
+
+// 第 i 段的结尾：大致等分文件，再移到下一行的开头
+static const char *mesh_split(const char *data, long size, int i, int n) {
+    const char *p;
+    if (i >= n) return data + size;
+    p = data + (long)((long long)size * i / n);
+    p = (const char*)memchr(p, '\n', data + size - p);
+    return (p != NULL) ? p + 1 : data + size;
+}
+
+int mesh_load(mesh_t *mesh, const char *filename, int threads) {
+    const char *data;
+    long size;
+    int n, i, k, npos = 0, nuv = 0, ncorner = 0, nvert = 0, cap, error = 0;
+    int *head, *link, *key, *index;
+    float *pos, *uv;
+    vertex_t *vertices;
+
+    memset(mesh, 0, sizeof(mesh_t));
+    data = (const char*)file_map(filename, &size);
+    if (data == NULL) return -1;
+
+    // 切段并行扫描
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+    n = (int)(size / MESH_CHUNK_MIN);
+    if (n > threads) n = threads;
+    if (n < 1) n = 1;
+    std::vector<mesh_chunk_t> chunks(n);
+    std::vector<std::thread> workers;
+    for (i = 0; i < n; i++) {
+        chunks[i].begin = (i == 0) ? data : chunks[i - 1].end;
+        chunks[i].end = mesh_split(data, size, i + 1, n);
+    }
+    for (i = 1; i < n; i++)
+        workers.push_back(std::thread(mesh_parse, &chunks[i]));
+    mesh_parse(&chunks[0]);
+    for (i = 0; i < (int)workers.size(); i++)
+        workers[i].join();
+    file_unmap(data, size);
+
+    for (i = 0; i < n; i++) {
+        if (chunks[i].error) return -2;
+        npos += (int)(chunks[i].pos.size() / 6);
+        nuv += (int)(chunks[i].uv.size() / 2);
+        ncorner += (int)(chunks[i].corners.size() / 2);
+    }
+    if (ncorner == 0) return -2;
+
+    // 拼接位置和纹理坐标，每段拼完就释放
+    pos = (float*)malloc(sizeof(float) * 6 * (npos + 1));
+    uv = (float*)malloc(sizeof(float) * 2 * (nuv + 1));
+    index = (int*)malloc(sizeof(int) * ncorner);
+    head = (int*)malloc(sizeof(int) * (npos + 1));
+    assert(pos && uv && index && head);
+    for (i = 0, npos = 0, nuv = 0; i < n; i++) {
+        mesh_chunk_t *chunk = &chunks[i];
+        int pc = (int)(chunk->pos.size() / 6), tc = (int)(chunk->uv.size() / 2);
+        if (pc > 0) memcpy(pos + npos * 6, &chunk->pos[0], sizeof(float) * 6 * pc);
+        if (tc > 0) memcpy(uv + nuv * 2, &chunk->uv[0], sizeof(float) * 2 * tc);
+        // 相对下标换成绝对下标，角点留在段里，合并顶点时再读
+        for (k = 0; k < (int)chunk->corners.size(); k += 2) {
+            int *c = &chunk->corners[k];
+            if (c[0] < 0) c[0] += MESH_RELATIVE + npos;
+            if (c[1] < 0 && c[1] != MESH_NONE) c[1] += MESH_RELATIVE + nuv;
+        }
+        npos += pc, nuv += tc;
+        std::vector<float>().swap(chunk->pos);
+        std::vector<float>().swap(chunk->uv);
+    }
+
+    // 合并相同的 (位置, 纹理坐标)：同一个位置的顶点串成链表，head 为链表头，
+    // 绝大多数位置只有一两个不同的纹理坐标，不需要散列表
+    for (i = 0; i < npos; i++) head[i] = -1;
+    cap = npos + 16;
+    vertices = (vertex_t*)malloc(sizeof(vertex_t) * cap);
+    link = (int*)malloc(sizeof(int) * cap);
+    key = (int*)malloc(sizeof(int) * cap);
+    assert(vertices && link && key);
+    for (i = 0, ncorner = 0; i < n && !error; i++) {
+        mesh_chunk_t *chunk = &chunks[i];
+        for (k = 0; k < (int)chunk->corners.size(); k += 2) {
+            int v = chunk->corners[k], t = chunk->corners[k + 1], j;
+            if (v < 0 || v >= npos || (t != MESH_NONE && (t < 0 || t >= nuv))) {
+                error = 1;
+                break;
+            }
+            for (j = head[v]; j >= 0 && key[j] != t; j = link[j]);
+            if (j < 0) {
+                vertex_t *out;
+                const float *p = pos + v * 6;
+                if (nvert >= cap) {
+                    cap *= 2;
+                    vertices = (vertex_t*)realloc(vertices, sizeof(vertex_t) * cap);
+                    link = (int*)realloc(link, sizeof(int) * cap);
+                    key = (int*)realloc(key, sizeof(int) * cap);
+                    assert(vertices && link && key);
+                }
+                j = nvert++;
+                key[j] = t;
+                link[j] = head[v];
+                head[v] = j;
+                out = &vertices[j];
+                out->pos.x = p[0], out->pos.y = p[1], out->pos.z = p[2], out->pos.w = 1.0f;
+                out->color.r = p[3], out->color.g = p[4], out->color.b = p[5];
+                out->tc.u = (t != MESH_NONE) ? uv[t * 2] : 0.0f;
+                out->tc.v = (t != MESH_NONE) ? uv[t * 2 + 1] : 0.0f;
+                out->rhw = 1.0f;
+            }
+            index[ncorner++] = j;
+        }
+        std::vector<int>().swap(chunk->corners);
+    }
+    free(pos);
+    free(uv);
+    free(head);
+    free(link);
+    free(key);
+    if (error) {
+        free(vertices);
+        free(index);
+        memset(mesh, 0, sizeof(mesh_t));
+        return -2;
+    }
+
+    mesh->vertices = (vertex_t*)realloc(vertices, sizeof(vertex_t) * nvert);
+    mesh->count = nvert;
+    mesh->indices = index;
+    mesh->icount = ncorner;
+    mesh_update_bounds(mesh);
+    return 0;
+}
+
+void mesh_update_bounds(mesh_t *mesh) {
+    int i;
+    if (mesh->count <= 0) {
+        memset(&mesh->lo, 0, sizeof(point_t));
+        memset(&mesh->hi, 0, sizeof(point_t));
+        return;
+    }
+    mesh->lo = mesh->hi = mesh->vertices[0].pos;
+    for (i = 1; i < mesh->count; i++) {
+        const point_t *p = &mesh->vertices[i].pos;
+        if (p->x < mesh->lo.x) mesh->lo.x = p->x;
+        if (p->y < mesh->lo.y) mesh->lo.y = p->y;
+        if (p->z < mesh->lo.z) mesh->lo.z = p->z;
+        if (p->x > mesh->hi.x) mesh->hi.x = p->x;
+        if (p->y > mesh->hi.y) mesh->hi.y = p->y;
+        if (p->z > mesh->hi.z) mesh->hi.z = p->z;
+    }
+}
+
+void mesh_destroy(mesh_t *mesh) {
+    if (mesh->vertices)
+        free(mesh->vertices);
+    if (mesh->indices)
+        free(mesh->indices);
+    memset(mesh, 0, sizeof(mesh_t));
+}
@@ -1,8 +1,20 @@
 #include "mini3d.h"
 #include "window.h"
+#include "pipeline.h"
 
 #define DEVICE_WIDTH    800
 #define DEVICE_HEIGHT   600
+#define PIPELINE_DEPTH  3       // 几何、光栅化、显示各一帧
+
+// 流水线的输出线程：光栅化完成的帧复制到窗口的 DIB 再显示
+static void present_frame(void *user, Device *frame, int index) {
+    Window *window = (Window*)user;
+    unsigned char *fb = window->getScreenFrameBuffer();
+    int y;
+    for (y = 0; y < frame->height; y++)
+        memcpy(fb + frame->width * 4 * y, frame->framebuffer + y * frame->fb_stride, frame->width * 4);
+    window->screen_update();
+}
 
 int main(void)
 {
@@ -25,10 +37,12 @@ int main(void)
     float pos = 3.5;
     int states[] = { RENDER_STATE_TEXTURE, RENDER_STATE_COLOR, RENDER_STATE_WIREFRAME };
     int indicator = 0;
+    Pipeline *pipeline = new Pipeline(&device, PIPELINE_DEPTH, 2, present_frame, &window);
 
 	while (window.device_exit == 0 && window.device_keys[VK_ESCAPE] == 0) {
         window.win_dispatch(); // 事件分发
 
+        pipeline->pipeline_begin();
         device.device_clear(1);
         device.camera_at_zero(pos, 0, 0);
 		
@@ -48,8 +62,9 @@ int main(void)
 		}
 
         device.draw_box(theta);
-        window.screen_update();
+        pipeline->pipeline_end();
 		Sleep(1);
 	}
+    delete pipeline;
 	return 0;
 }
@@ -1,106 +1,698 @@
+#ifndef _MINI3D_H_
+#define _MINI3D_H_
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <assert.h>
 
-#include <windows.h>
-#include <tchar.h>
-
 #include "math.h"
 
-// 任
+// 核心渲染部分不依赖 windows.h，像素格式与 Win32 的 UINT32 保持一致
+typedef unsigned int UINT32;
+
+// 坐标变换
 typedef struct Transform {
-    matrix_t world;         // 任
-    matrix_t view;          // Ӱ任
-    matrix_t projection;    // ͶӰ任
+    matrix_t world;         // 世界坐标变换
+    matrix_t view;          // 摄影机坐标变换
+    matrix_t projection;    // 投影变换
     matrix_t transform;     // transform = world * view * projection
-    float w, h;             // ĻС
+    float w, h;             // 屏幕大小
 } transform_t;
 
-// £ transform = world * view * projection
+// 矩阵更新，计算 transform = world * view * projection
 void transform_update(transform_t *ts);
-// ʼĻ
+// 初始化，设置屏幕长宽
 void transform_init(transform_t *ts, int width, int height);
-// ʸ x  project 
+// 将矢量 x 进行 project 
 void transform_apply(const transform_t *ts, vector_t *y, const vector_t *x);
-// ͬ cvv ı߽׶ü
+// 检查齐次坐标同 cvv 的边界用于视锥裁剪
 int transform_check_cvv(const vector_t *v);
-// һõĻ
+// 检查齐次坐标同保护带的 x / y 边界，返回值各位与 transform_check_cvv 相同（不含 z）
+int transform_check_guard(const vector_t *v);
+// 归一化，得到屏幕坐标
 void transform_homogenize(const transform_t *ts, vector_t *y, const vector_t *x);
+// 批量变换 n 个顶点：clip 为齐次坐标，cvv[i] 同 transform_check_cvv，screen 同 transform_homogenize
+// （cvv 不为 0 的顶点 screen 没有意义）。结果与逐个调用单顶点函数逐位一致
+void transform_project_batch(const transform_t *ts, vector_soa_t *clip, int *cvv, vector_soa_t *screen,
+    const vector_soa_t *x, int n);
+
+
+// 纹理：mip 链的每一层按 TEXTURE_TILE x TEXTURE_TILE 个 texel 分块存放
+#define TEXTURE_LEVELS              16      // 最多的 mip 层数，第 0 层最大 32768x32768
+#define TEXTURE_TILE_SHIFT          2
+#define TEXTURE_TILE                (1 << TEXTURE_TILE_SHIFT)
+
+// 一个 mip 层。(x, y) 处的 texel 为 bits[texture_offset(level, x, y)]
+typedef struct TextureLevel {
+    UINT32 *bits;           // 本层第一个 texel
+    int width, height;      // 本层大小
+    int shift;              // 分块边长的对数，0 表示逐行存放
+    int stride;             // 一行分块占多少个 texel（shift 为 0 时就是一行的 texel 数）
+    float max_u, max_v;     // width - 1, height - 1
+} texture_level_t;
+
+typedef struct Texture {
+    texture_level_t level[TEXTURE_LEVELS];
+    int levels;             // mip 层数，最后一层为 1x1
+    void *memory;           // 各层所在的内存，texture_destroy 释放
+    const void *mapped;     // 第 0 层直接引用的文件映射，texture_destroy 解除映射
+    long mapped_size;
+} texture_t;
+
+// 分块存放时 texel 的下标：先找到分块，再找块内的行和列
+inline int texture_offset(const texture_level_t *level, int x, int y) {
+    int s = level->shift, m = (1 << s) - 1;
+    return (y >> s) * level->stride + ((x >> s) << (s * 2)) + ((y & m) << s) + (x & m);
+}
+
+#ifdef MINI3D_SSE2
+// texture_offset 按行、列拆开的两部分，一次算 4 个 texel，下标为两者之和。
+// SSE2 没有 _mm_mullo_epi32，奇偶两组各用一次 _mm_mul_epu32
+inline __m128i texture_row_sse2(const texture_level_t *level, __m128i y) {
+    __m128i s = _mm_cvtsi32_si128(level->shift);
+    __m128i m = _mm_set1_epi32((1 << level->shift) - 1);
+    __m128i k = _mm_set1_epi32(level->stride);
+    __m128i r = _mm_srl_epi32(y, s);
+    __m128i even = _mm_shuffle_epi32(_mm_mul_epu32(r, k), _MM_SHUFFLE(0, 0, 2, 0));
+    __m128i odd = _mm_shuffle_epi32(_mm_mul_epu32(_mm_srli_epi64(r, 32), k), _MM_SHUFFLE(0, 0, 2, 0));
+    return _mm_add_epi32(_mm_unpacklo_epi32(even, odd), _mm_sll_epi32(_mm_and_si128(y, m), s));
+}
+
+inline __m128i texture_column_sse2(const texture_level_t *level, __m128i x) {
+    __m128i s = _mm_cvtsi32_si128(level->shift);
+    __m128i m = _mm_set1_epi32((1 << level->shift) - 1);
+    return _mm_add_epi32(_mm_sll_epi32(_mm_srl_epi32(x, s), _mm_add_epi64(s, s)), _mm_and_si128(x, m));
+}
+
+inline __m128i texture_offset_sse2(const texture_level_t *level, __m128i x, __m128i y) {
+    return _mm_add_epi32(texture_row_sse2(level, y), texture_column_sse2(level, x));
+}
+
+// 有符号 32 位整数限制到 [lo, hi]：SSE2 没有 _mm_min_epi32 / _mm_max_epi32，用比较加选择代替
+inline __m128i clamp_sse2(__m128i x, __m128i lo, __m128i hi) {
+    __m128i m = _mm_cmpgt_epi32(lo, x);
+    x = _mm_or_si128(_mm_and_si128(m, lo), _mm_andnot_si128(m, x));
+    m = _mm_cmpgt_epi32(x, hi);
+    return _mm_or_si128(_mm_and_si128(m, hi), _mm_andnot_si128(m, x));
+}
+#endif
+
+// 属性的平面方程：三个顶点 (x[k], y[k]) 上的值为 a1, a2, a3，inv 为两倍面积的倒数，
+// 求出沿屏幕 x、y 的梯度。梯形、半空间光栅化和可见性缓存共用，同一个三角形的梯度逐位一致
+inline void triangle_plane(float *dx, float *dy, const float *x, const float *y,
+    float a1, float a2, float a3, float inv) {
+    *dx = ((a2 - a1) * (y[2] - y[0]) - (a3 - a1) * (y[1] - y[0])) * inv;
+    *dy = ((a3 - a1) * (x[1] - x[0]) - (a2 - a1) * (x[2] - x[0])) * inv;
+}
 
+// 分配 w x h 的纹理，内容为 0：填好第 0 层之后调用 texture_build_mips
+int texture_create(texture_t *tex, int w, int h);
+// 初始化纹理：复制 bits（h 行，每行 pitch 字节）到第 0 层，再生成整条 mip 链
+int texture_init(texture_t *tex, const void *bits, long pitch, int w, int h);
+// 第 0 层不复制，直接引用 bits（逐行存放，pitch 为 4 的倍数，可以为负），只生成其余各层
+int texture_init_shared(texture_t *tex, const void *bits, long pitch, int w, int h);
+// 由第 0 层生成其余各层
+void texture_build_mips(texture_t *tex);
+// 释放纹理内存
+void texture_destroy(texture_t *tex);
 
-// μ㣺㡢ɨߡԵΡ
+// 只读映射整个文件，失败返回 NULL，size 为文件长度
+const void *file_map(const char *filename, long *size);
+// 解除 file_map 的映射
+void file_unmap(const void *ptr, long size);
+// 从未压缩的 BMP（8 / 24 / 32 位）或 TGA（类型 1 / 2 / 3）文件加载纹理。32 位、从左到右存放的
+// 像素直接在文件映射里使用（从下往上的行用负的 stride），其余格式转换到分块存放的第 0 层。
+// 返回 0 成功，-1 打不开文件，-2 格式不支持
+int texture_load(texture_t *tex, const char *filename);
+// 纹理注册表：同一个文件名只加载一次，之后增加引用计数，失败返回 NULL
+const texture_t *texture_acquire(const char *filename);
+// 减少引用计数，减到 0 时释放
+void texture_release(const texture_t *tex);
+// 由某个像素上的 (u * rhw, v * rhw, rhw) 及其沿屏幕 x、y 的梯度 dx[3]、dy[3] 选择 mip 层
+// lerp 为 NULL 时层号四舍五入；否则向下取整，*lerp 为与下一层混合的权重（0-255）
+int texture_select_level(const texture_t *tex, float U, float V, float R, const float *dx, const float *dy,
+    int *lerp);
+
+
+// 采样器：过滤方式和 u / v 两个方向的寻址方式。全 0 为默认：最近点、夹取，与以前的读法逐位一致
+#define SAMPLER_NEAREST             0       // 取最近的 texel
+#define SAMPLER_BILINEAR            1       // 2x2 个 texel 按 8.8 定点权重混合
+#define SAMPLER_TRILINEAR           2       // 相邻两个 mip 层各做一次双线性，再按 lod 的小数部分混合
+
+#define SAMPLER_CLAMP               0       // 夹取：u = 0 / 1 对应第一个 / 最后一个 texel 的中心
+#define SAMPLER_WRAP                1       // 重复：周期为 1，u = 0 / 1 对应纹理的左右边缘
+#define SAMPLER_MIRROR              2       // 镜像重复：周期为 2，奇数段左右翻转
+
+typedef struct Sampler { int filter, address_u, address_v; } sampler_t;
+
+// 按 sampler 在 level 上读取 (u, v) 处的颜色；lerp 不为 0 时再读 level + 1，按 lerp / 256 混合
+UINT32 sampler_fetch(const sampler_t *sampler, const texture_level_t *level, int lerp, float u, float v);
+#ifdef MINI3D_SSE2
+// sampler_fetch 一次读 4 个像素，结果与逐个调用逐位一致
+__m128i sampler_fetch_sse2(const sampler_t *sampler, const texture_level_t *level, int lerp, __m128 u, __m128 v);
+#endif
+
+
+// 几何计算：顶点、扫描线、边缘、矩形、步长计算
 typedef struct Color { float r, g, b; } color_t;
 typedef struct TexCoord { float u, v; } texcoord_t;
 typedef struct Vertex { point_t pos; texcoord_t tc; color_t color; float rhw; } vertex_t;
 
-typedef struct Edge { vertex_t v, v1, v2; } edge_t;
-typedef struct Trapezoid { float top, bottom; edge_t left, right; } trapezoid_t;
+// 边：v1 在上、v2 在下，(x1, y1)、(x2, y2) 为端点的 28.4 定点坐标。
+// x 为当前扫描线上像素中心不在边左侧的第一个像素，按整数步进：
+// 每行 x += dx，余数 r -= dr，r 小于 0 时再进一位，den 为余数的分母
+typedef struct Edge { vertex_t v1, v2; int x1, y1, x2, y2; int x, r, dx, dr, den; } edge_t;
+// 梯形：覆盖扫描线 [top, bottom)。屏幕 (x, y) 处的属性为 v + dx * (x - v.pos.x) + dy * (y - v.pos.y)，
+// 同一个三角形拆出的梯形共用一组平面方程（pos 不插值）
+typedef struct Trapezoid { int top, bottom; edge_t left, right; vertex_t v, dx, dy; } trapezoid_t;
 typedef struct Scanline { vertex_t v, step; int x, y, w; } scanline_t;
+// 变换后的顶点：齐次坐标 clip、归一化后的屏幕坐标 screen、transform_check_cvv 的结果
+typedef struct PostVertex { point_t clip; point_t screen; int cvv; } post_vertex_t;
+// 可见性缓存里的三角形：像素 (x, y) 中心的属性为 v + dx * (x - v.pos.x) + dy * (y - v.pos.y)，
+// v.pos 已经减去 0.5，直接代入像素的整数坐标。render_state 为提交时的渲染状态
+typedef struct VisiblePrim { vertex_t v, dx, dy; int render_state; } visible_prim_t;
+// 网格：draw_indexed 用的顶点和三角形索引（icount 为索引个数，3 的倍数），lo / hi 为包围盒
+typedef struct Mesh { vertex_t *vertices; int count; int *indices; int icount; point_t lo, hi; } mesh_t;
+
+// 加载 OBJ 网格：文件只读映射，大文件按行切段，最多 threads 个线程并行解析（<= 0 为 CPU 个数）。
+// 位置和纹理坐标都相同的角点合并成一个顶点，法线忽略，多边形按扇形拆成三角形，
+// 支持负数下标和 "v x y z r g b" 顶点颜色。返回 0 成功，-1 打不开文件，-2 格式错误
+int mesh_load(mesh_t *mesh, const char *filename, int threads);
+void mesh_destroy(mesh_t *mesh);
+// 由 vertices 重新计算包围盒 lo / hi，自己填写顶点的网格在加入 BVH 之前调用
+void mesh_update_bounds(mesh_t *mesh);
+// 用二次误差度量的半边折叠把 mesh 简化到大约 target 个三角形，结果写进 out（新分配，mesh_destroy 释放）。
+// max_error > 0 时，折叠使表面移动的距离（按面积平均）超过 max_error 就提前停止。
+// 不产生新顶点；边界和 UV 接缝上的顶点不动。返回简化后的三角形数
+int mesh_simplify(mesh_t *out, const mesh_t *mesh, int target, float max_error);
+
+// Device::draw_box 的立方体：边长 2、中心在原点，每个面 4 个顶点（各自的纹理坐标）、两个三角形
+#define BOX_VERTICES                24
+#define BOX_INDICES                 36
+extern const vertex_t box_vertices[BOX_VERTICES];
+extern const int box_indices[BOX_INDICES];
+
+// 网格的细节层次：level[0] 与原网格共用顶点和索引，之后每层由上一层简化到大约四分之一。
+// 误差超过包围球半径的一定比例就不再折叠；包围盒明显收缩、或者投影面积（覆盖的像素）
+// 与 level[0] 相差较多的一层不要，levels 可能比要求的少。center / radius 为 level[0] 包围盒的外接球
+#define MESH_LODS                   5
+typedef struct MeshLod { mesh_t level[MESH_LODS]; int levels; point_t center; float radius; } mesh_lod_t;
+
+// 生成最多 levels 层（包括 level[0]），简化不下去时提前结束，返回实际的层数
+int mesh_lod_build(mesh_lod_t *lod, const mesh_t *mesh, int levels);
+// 释放 level[1] 以后的各层，level[0] 不属于 lod
+void mesh_lod_destroy(mesh_lod_t *lod);
+// 按包围球在屏幕上的大小选层：ts->world 为物体的世界矩阵，选三角形数不少于覆盖面积所需的最粗一层
+int mesh_lod_select(const mesh_lod_t *lod, const transform_t *ts);
+
+// 物体层次包围盒（BVH）：物体为网格加世界矩阵，lo / hi 为世界空间的轴对齐包围盒。
+// 节点覆盖 order[first, first + count) 的物体，left 为 -1 时是叶子，否则两个子节点为 left、left + 1。
+// lod 不为 NULL 时 mesh 为 lod->level[0]，绘制时按屏幕大小选层
+typedef struct BvhObject { const mesh_t *mesh; const mesh_lod_t *lod; matrix_t world; point_t lo, hi; } bvh_object_t;
+typedef struct BvhNode { point_t lo, hi; int left, first, count; } bvh_node_t;
+typedef struct Bvh {
+    bvh_object_t *objects;      // 按加入顺序存放的物体
+    int count, max;
+    bvh_node_t *nodes;          // nodes[0] 为根
+    int node_count;
+    int *order;                 // 物体编号按树的叶子顺序排列
+    int *visible;               // draw_bvh 存放剔除结果，count 个
+    int built;                  // 加入物体之后要重新 bvh_build
+} bvh_t;
+
+void bvh_init(bvh_t *bvh);
+void bvh_destroy(bvh_t *bvh);
+// 加入一个物体，返回编号（从 0 开始）。mesh 只引用不复制，要在 BVH 之前一直有效
+int bvh_add(bvh_t *bvh, const mesh_t *mesh, const matrix_t *world);
+// 加入一个带细节层次的物体，包围盒取 level[0] 的
+int bvh_add_lod(bvh_t *bvh, const mesh_lod_t *lod, const matrix_t *world);
+// 按包围盒中心沿最长轴中间切分，建成二叉树
+void bvh_build(bvh_t *bvh);
+// 由 transform（world * view * projection）取出视锥的 6 个平面，与视锥相交的物体编号按从小到大
+// 写进 out，返回个数。物体的包围盒在世界空间，world 应为单位矩阵
+int bvh_cull(const bvh_t *bvh, const matrix_t *transform, int *out);
+
+// 命令列表：记录 draw（网格、世界矩阵、纹理、渲染状态）而不执行，由 Device::draw_list 回放。
+// tex 为 NULL 时用开始回放时 device 的纹理，渲染状态不含 RENDER_STATE_TEXTURE 时记为 NULL；
+// center 为网格包围盒中心的世界坐标，depth 为它在摄像机空间的 z
+typedef struct DrawCmd {
+    const mesh_t *mesh;
+    const texture_t *tex;
+    int render_state;
+    matrix_t world;
+    point_t center;
+    float depth;
+} draw_cmd_t;
+typedef struct CmdList {
+    draw_cmd_t *cmds;           // 按记录顺序存放的命令
+    int count, max;
+    int *order;                 // 回放顺序，cmdlist_sort 之前为记录顺序
+} cmdlist_t;
+
+void cmdlist_init(cmdlist_t *list);
+void cmdlist_destroy(cmdlist_t *list);
+// 清空命令，保留内存，每帧重新记录时用
+void cmdlist_reset(cmdlist_t *list);
+// 记录一个 draw，返回编号（从 0 开始）。mesh 和 tex 只引用不复制，回放时要仍然有效
+int cmdlist_draw(cmdlist_t *list, const mesh_t *mesh, const matrix_t *world, const texture_t *tex, int render_state);
+// 按 view 重新计算深度，回放顺序排成：渲染状态、纹理、由近到远。列表跨帧保留时摄像机变了再调用
+void cmdlist_sort(cmdlist_t *list, const matrix_t *view);
+
+// 帧内存池：每帧的临时数据按顺序从一块连续内存里切出来，arena_reset 一次全部收回。
+// 放不下时分配溢出块，reset 时把主块扩大到这一帧的用量，之后的帧只是把 used 置 0
+#define ARENA_ALIGN                 16      // 每次分配的对齐
+typedef struct ArenaBlock { struct ArenaBlock *next; char *ptr; size_t size, used; } arena_block_t;
+typedef struct Arena {
+    char *mem;                  // 主块，malloc 得到的原始指针
+    char *base;                 // 主块 64 字节对齐后的起点
+    size_t size, used;
+    size_t total;               // 上次 reset 之后分配的字节数，包括溢出块
+    arena_block_t *extra;       // 溢出块，最新的在前
+} arena_t;
+
+void arena_init(arena_t *arena, size_t size);
+void arena_destroy(arena_t *arena);
+// 分配 size 字节，不清零，到下次 arena_reset 之前有效
+void *arena_alloc(arena_t *arena, size_t size);
+// 收回所有分配，没有溢出时为 O(1)
+void arena_reset(arena_t *arena);
 
 
 void vertex_rhw_init(vertex_t *v);
 void vertex_interp(vertex_t *y, const vertex_t *x1, const vertex_t *x2, float t);
 void vertex_division(vertex_t *y, const vertex_t *x1, const vertex_t *x2, float w);
 void vertex_add(vertex_t *y, const vertex_t *x);
+// y = x + step * t
+void vertex_advance(vertex_t *y, const vertex_t *x, const vertex_t *step, float t);
+
+// 顶点属性的子集：rhw 总是要算的，其余按渲染状态选择，只计算输出用得到的属性
+#define VERTEX_ATTR_TC              1       // 纹理坐标
+#define VERTEX_ATTR_COLOR           2       // 颜色
+#define VERTEX_ATTR_POS             4       // 位置
+#define VERTEX_ATTR_ALL             7
+
+// vertex_advance 只计算 rhw 和 ATTR 里的属性，其余属性不写
+template <int ATTR>
+inline void vertex_advance_attr(vertex_t *y, const vertex_t *x, const vertex_t *step, float t) {
+    if (ATTR & VERTEX_ATTR_POS) {
+        y->pos.x = x->pos.x + step->pos.x * t;
+        y->pos.y = x->pos.y + step->pos.y * t;
+        y->pos.z = x->pos.z + step->pos.z * t;
+        y->pos.w = x->pos.w + step->pos.w * t;
+    }
+    y->rhw = x->rhw + step->rhw * t;
+    if (ATTR & VERTEX_ATTR_TC) {
+        y->tc.u = x->tc.u + step->tc.u * t;
+        y->tc.v = x->tc.v + step->tc.v * t;
+    }
+    if (ATTR & VERTEX_ATTR_COLOR) {
+        y->color.r = x->color.r + step->color.r * t;
+        y->color.g = x->color.g + step->color.g * t;
+        y->color.b = x->color.b + step->color.b * t;
+    }
+}
+
+// 亚像素精度：屏幕坐标取 28.4 定点，乘 16 四舍五入
+#define SUBPIXEL_BITS               4
+#define SUBPIXEL_ONE                (1 << SUBPIXEL_BITS)
 
-//  0-2 ΣҷغϷε
+inline int subpixel_snap(float x) {
+    float f = x * (float)SUBPIXEL_ONE + 0.5f;
+    int i = (int)f;
+    return i - (f < (float)i);      // 向下取整，比 floorf 少一次范围检查
+}
+// 像素中心 (i + 0.5) 不小于定点坐标 x 的第一个 i：像素中心压在上边、左边上的算在内
+inline int subpixel_ceil(int x) { return (x + SUBPIXEL_ONE / 2 - 1) >> SUBPIXEL_BITS; }
+
+// 根据三角形生成 0-2 个梯形，并且返回非空梯形的数量。顶点坐标先对齐到 28.4 定点，
+// 像素中心落在左边、上边上的算在三角形内，落在右边、下边上的不算（top-left 规则）
 int trapezoid_init_triangle(trapezoid_t *trap, const vertex_t *p1, const vertex_t *p2, const vertex_t *p3);
-//  Y  Y Ķ
-void trapezoid_edge_interp(trapezoid_t *trap, float y);
-// ߵĶ˵㣬ʼɨߵͲ
+// 左右两条边的整数步进从第 y 条扫描线开始
+void trapezoid_edge_start(trapezoid_t *trap, int y);
+// 左右两条边走到下一条扫描线。进位不用分支，m 为 -1 表示余数变成了负数
+inline void trapezoid_edge_step(trapezoid_t *trap) {
+    edge_t *e = &trap->left;
+    int m;
+    e->r -= e->dr, m = e->r >> 31;
+    e->x += e->dx - m, e->r += e->den & m;
+    e = &trap->right;
+    e->r -= e->dr, m = e->r >> 31;
+    e->x += e->dx - m, e->r += e->den & m;
+}
+// 由左右两边的整数位置和平面方程，初始化计算出扫描线的起点（第一个像素的中心）和步长
 void trapezoid_init_scan_line(const trapezoid_t *trap, scanline_t *scanline, int y);
+// trapezoid_init_scan_line 只计算 rhw 和 ATTR 里的属性，起点的其余属性没有定义
+template <int ATTR>
+inline void trapezoid_scan_line_attr(const trapezoid_t *trap, scanline_t *scanline, int y) {
+    scanline->x = trap->left.x;
+    scanline->w = trap->right.x - trap->left.x;
+    scanline->y = y;
+    if (scanline->w < 0) scanline->w = 0;
+    scanline->step = trap->dx;
+    vertex_advance_attr<ATTR>(&scanline->v, &trap->v, &trap->dx, (float)scanline->x + 0.5f - trap->v.pos.x);
+    vertex_advance_attr<ATTR>(&scanline->v, &scanline->v, &trap->dy, (float)y + 0.5f - trap->v.pos.y);
+}
+
+
+#define RENDER_STATE_WIREFRAME      1		// 渲染线框
+#define RENDER_STATE_TEXTURE        2		// 渲染纹理
+#define RENDER_STATE_COLOR          4		// 渲染颜色
+
+#define RASTERIZER_SCANLINE         0       // 梯形拆分 + 扫描线
+#define RASTERIZER_HALFSPACE        1       // 边函数 + 8x8 像素块
+
+#define HIZ_SIZE                    8       // 层次 z 缓存的分块大小（像素）
+
+// 深度格式：zbuffer 存的都是 rhw（越大越近，0 为最远），新值不小于旧值通过测试。
+// 定点格式存 rhw * depth_scale 截断取整，rhw 为 DEPTH_RHW_MAX 时取到最大值
+#define DEPTH_FLOAT                 0       // 32 位浮点
+#define DEPTH_16                    1       // 16 位定点，填充为主的预览，深度带宽减半
+#define DEPTH_24                    2       // 低 24 位定点，高 8 位留给模板或覆盖掩码，深度写入时不动
+#define DEPTH_FORMATS               3
+#define DEPTH_16_MAX                0xffffu
+#define DEPTH_24_MAX                0xffffffu
+#define DEPTH_RHW_MAX               1.0f    // transform_init 的近平面为 1，可见的 rhw 不超过 1
 
+// 定点深度：rhw * scale 截断取整，限制到 [0, max]
+inline UINT32 depth_quantize(float rhw, float scale, UINT32 max) {
+    float q = rhw * scale;
+    if (!(q > 0.0f)) return 0;
+    return (q >= (float)max) ? max : (UINT32)q;
+}
 
-#define RENDER_STATE_WIREFRAME      1		// Ⱦ߿
-#define RENDER_STATE_TEXTURE        2		// Ⱦ
-#define RENDER_STATE_COLOR          4		// Ⱦɫ
+// 定点深度 q 换回 rhw 的下界：rhw 小于它时量化结果一定小于 q，层次 z 用。
+// 留出两个单位抵消 rhw * scale 的舍入
+inline float depth_rhw_bound(UINT32 q, float scale) {
+    return (q > 2) ? (float)(q - 2) / scale : 0.0f;
+}
+
+// zbuffer 的一行里第 x 个像素做深度测试，通过时写入新的深度，返回非 0 为通过
+template <int FMT>
+inline int depth_test(void *row, int x, float rhw, float scale) {
+    if (FMT == DEPTH_16) {
+        unsigned short *z = (unsigned short*)row;
+        UINT32 q = depth_quantize(rhw, scale, DEPTH_16_MAX);
+        if (q < z[x]) return 0;
+        z[x] = (unsigned short)q;
+        return 1;
+    }
+    if (FMT == DEPTH_24) {
+        UINT32 *z = (UINT32*)row;
+        UINT32 q = depth_quantize(rhw, scale, DEPTH_24_MAX);
+        if (q < (z[x] & DEPTH_24_MAX)) return 0;
+        z[x] = (z[x] & ~DEPTH_24_MAX) | q;
+        return 1;
+    }
+    float *z = (float*)row;
+    if (rhw < z[x]) return 0;
+    z[x] = rhw;
+    return 1;
+}
+
+// 运行时按格式选择，不按格式生成内核的地方用
+inline int depth_test_format(int format, void *row, int x, float rhw, float scale) {
+    if (format == DEPTH_16) return depth_test<DEPTH_16>(row, x, rhw, scale);
+    if (format == DEPTH_24) return depth_test<DEPTH_24>(row, x, rhw, scale);
+    return depth_test<DEPTH_FLOAT>(row, x, rhw, scale);
+}
+
+#ifdef MINI3D_SSE2
+// 4 个像素的深度测试：cover 为参加测试的像素，返回通过的像素（每个 32 位全 1），通过的写入新的深度。
+// cover 之外的像素也会被读取，写回的是原值。量化与 depth_quantize 逐位一致
+template <int FMT>
+inline __m128i depth_test_sse2(void *row, int x, __m128 rhw, float scale, __m128i cover) {
+    __m128i pass, z, q;
+    if (FMT == DEPTH_FLOAT) {
+        float *zb = (float*)row + x;
+        __m128 old = _mm_loadu_ps(zb);
+        pass = _mm_and_si128(cover, _mm_castps_si128(_mm_cmpge_ps(rhw, old)));
+        if (_mm_movemask_epi8(pass) != 0)
+            _mm_storeu_ps(zb, _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(pass), rhw),
+                _mm_andnot_ps(_mm_castsi128_ps(pass), old)));
+        return pass;
+    }
+    q = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(rhw, _mm_set1_ps(scale)), _mm_setzero_ps()),
+        _mm_set1_ps((float)((FMT == DEPTH_16) ? DEPTH_16_MAX : DEPTH_24_MAX))));
+    if (FMT == DEPTH_16) {
+        unsigned short *zb = (unsigned short*)row + x;
+        const __m128i bias = _mm_set1_epi32(0x8000);
+        z = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)zb), _mm_setzero_si128());
+        pass = _mm_andnot_si128(_mm_cmpgt_epi32(z, q), cover);
+        if (_mm_movemask_epi8(pass) != 0) {
+            // SSE2 只有有符号的饱和打包：先移到有符号范围，打包之后再移回来
+            z = _mm_or_si128(_mm_and_si128(pass, q), _mm_andnot_si128(pass, z));
+            z = _mm_packs_epi32(_mm_sub_epi32(z, bias), _mm_sub_epi32(z, bias));
+            _mm_storel_epi64((__m128i*)zb, _mm_xor_si128(z, _mm_set1_epi16((short)0x8000)));
+        }
+        return pass;
+    }
+    UINT32 *zb = (UINT32*)row + x;
+    const __m128i mask = _mm_set1_epi32(DEPTH_24_MAX);
+    __m128i old = _mm_loadu_si128((const __m128i*)zb);
+    z = _mm_and_si128(old, mask);
+    pass = _mm_andnot_si128(_mm_cmpgt_epi32(z, q), cover);
+    if (_mm_movemask_epi8(pass) != 0) {
+        q = _mm_or_si128(_mm_andnot_si128(mask, old), q);
+        _mm_storeu_si128((__m128i*)zb, _mm_or_si128(_mm_and_si128(pass, q), _mm_andnot_si128(pass, old)));
+    }
+    return pass;
+}
+
+inline __m128i depth_test_format_sse2(int format, void *row, int x, __m128 rhw, float scale, __m128i cover) {
+    if (format == DEPTH_16) return depth_test_sse2<DEPTH_16>(row, x, rhw, scale, cover);
+    if (format == DEPTH_24) return depth_test_sse2<DEPTH_24>(row, x, rhw, scale, cover);
+    return depth_test_sse2<DEPTH_FLOAT>(row, x, rhw, scale, cover);
+}
+#endif
+
+#ifdef MINI3D_AVX2
+// 8 个像素的深度测试，全部参加测试，其余同 depth_test_sse2
+template <int FMT>
+inline __m256i depth_test_avx2(void *row, int x, __m256 rhw, float scale) {
+    __m256i pass, z, q;
+    if (FMT == DEPTH_FLOAT) {
+        float *zb = (float*)row + x;
+        __m256 old = _mm256_loadu_ps(zb);
+        __m256 p = _mm256_cmp_ps(rhw, old, _CMP_GE_OQ);
+        if (_mm256_movemask_ps(p) != 0) _mm256_storeu_ps(zb, _mm256_blendv_ps(old, rhw, p));
+        return _mm256_castps_si256(p);
+    }
+    q = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(rhw, _mm256_set1_ps(scale)),
+        _mm256_setzero_ps()), _mm256_set1_ps((float)((FMT == DEPTH_16) ? DEPTH_16_MAX : DEPTH_24_MAX))));
+    if (FMT == DEPTH_16) {
+        unsigned short *zb = (unsigned short*)row + x;
+        z = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)zb));
+        pass = _mm256_xor_si256(_mm256_cmpgt_epi32(z, q), _mm256_set1_epi32(-1));
+        if (_mm256_movemask_epi8(pass) != 0) {
+            z = _mm256_blendv_epi8(z, q, pass);
+            _mm_storeu_si128((__m128i*)zb, _mm_packus_epi32(_mm256_castsi256_si128(z), _mm256_extracti128_si256(z, 1)));
+        }
+        return pass;
+    }
+    UINT32 *zb = (UINT32*)row + x;
+    const __m256i mask = _mm256_set1_epi32(DEPTH_24_MAX);
+    __m256i old = _mm256_loadu_si256((const __m256i*)zb);
+    z = _mm256_and_si256(old, mask);
+    pass = _mm256_xor_si256(_mm256_cmpgt_epi32(z, q), _mm256_set1_epi32(-1));
+    if (_mm256_movemask_epi8(pass) != 0)
+        _mm256_storeu_si256((__m256i*)zb, _mm256_blendv_epi8(old, _mm256_or_si256(_mm256_andnot_si256(mask, old), q), pass));
+    return pass;
+}
+#endif
+
+#define CULL_NONE                   0       // 不剔除
+#define CULL_CW                     1       // 剔除屏幕上顺时针的三角形
+#define CULL_CCW                    2       // 剔除屏幕上逆时针的三角形
 
 #define DEVICE_KEYS_SIZE            512
 
-// Ⱦ豸
+// 保护带：x / y 在 [-GUARD_BAND * w, GUARD_BAND * w] 内的三角形不做几何裁剪，直接
+// 光栅化，屏幕外的部分由裁剪区域剪掉；只有穿过近/远平面或者超出保护带才真正裁剪
+#define GUARD_BAND                  2.0f
+// 三角形对近/远平面和保护带四条边裁剪之后最多的顶点数
+#define CLIP_VERTICES               9
+
+class Tiler;
+struct Device;
+
+// 扫描线内核：device_raster_triangle 按渲染状态每个三角形选择一次。scan_line 初始化扫描线，
+// 只计算内核用得到的属性；span 画扫描线上的 [x0, x1)，不做层次 z 测试
+typedef struct SpanKernel {
+    void (*scan_line)(const trapezoid_t *trap, scanline_t *scanline, int y);
+    void (*span)(Device *device, const scanline_t *scanline, int x0, int x1);
+} span_kernel_t;
+
+
+// 渲染管线统计：默认编译关闭，定义 MINI3D_STATS 后才会计数，热循环零开销
+#ifdef MINI3D_STATS
+typedef struct DeviceStats {
+    long primitives;            // device_draw_primitive 提交的三角形
+    long clipped;               // 完全在视锥外被丢弃的三角形
+    long guarded;               // 超出屏幕但在保护带内、直接光栅化的三角形
+    long split;                 // 穿过近/远平面或超出保护带、做了多边形裁剪的三角形
+    long culled;                // 背面、零面积或者不覆盖任何像素中心而被剔除的三角形
+    long trapezoids;            // 生成的梯形
+    long scanlines;             // 绘制的扫描线
+    long pixels;                // 扫描线访问的屏幕内像素
+    long zfail;                 // 没有通过 zbuffer 测试的像素
+    long written;               // 实际写入的像素
+    long hiztraps;              // 被层次 z 整个跳过的梯形
+    long hizpixels;             // 被层次 z 按 8 像素一段跳过的扫描线像素和 8x8 像素块中的像素
+    long shaded;                // 可见性缓存解析时着色的像素
+    long objects;               // draw_bvh 提交的物体
+    long objculled;             // 被视锥剔除、没有变换任何顶点的物体
+} device_stats_t;
+#define DEVICE_STAT(x)              x
+#else
+#define DEVICE_STAT(x)
+#endif
+
+// 渲染设备
 struct Device {
-    transform_t transform;      // 任
-    int width;                  // ڿ
-    int height;                 // ڸ߶
-    UINT32 **framebuffer;       // ػ棺framebuffer[y]  y 
-    float **zbuffer;            // Ȼ棺zbuffer[y] Ϊ y ָ
-    UINT32 **texture;           // ͬÿ
-    int tex_width;              // 
-    int tex_height;             // ߶
-    float max_u;                // ȣtex_width - 1
-    float max_v;                // ߶ȣtex_height - 1
-    int render_state;           // Ⱦ״̬
-    UINT32 background;          // ɫ
-    UINT32 foreground;          // ߿ɫ
+    transform_t transform;      // 坐标变换器
+    int width;                  // 窗口宽度
+    int height;                 // 窗口高度
+    UINT32 *framebuffer;        // 像素缓存：第 y 行从 framebuffer + y * fb_stride 开始
+    void *zbuffer;              // 深度缓存：第 y 行从 (char*)zbuffer + y * zb_pitch 开始，行首 64 字节对齐
+    int fb_stride;              // framebuffer 每行的像素数（不是字节数），自有的缓存按 16 个像素对齐
+    int zb_pitch;               // zbuffer 每行的字节数，每个像素的大小取决于 depth_format
+    int depth_format;           // 深度格式：DEPTH_FLOAT / DEPTH_16 / DEPTH_24
+    float depth_scale;          // 定点深度格式的 rhw 放大倍数
+    char *surface;              // framebuffer / zbuffer 所在的一块内存，malloc 得到的原始指针
+    float *hiz;                 // 层次 z：每个 8x8 分块的最小 rhw（最远的深度），只会偏小
+    unsigned short *hiz_count;  // 分块上次重新计算 hiz 之后又画过的像素数（按包围矩形估计）
+    int hiz_w, hiz_h;           // 层次 z 分块的列数与行数
+    unsigned char *zclear;      // 每个 8x8 分块一个标记：zbuffer 在 device_clear 之后还没有真正清零
+    texture_t tex_own;          // device_set_texture 复制进来的纹理
+    const texture_t *tex;       // 当前纹理
+    const texture_level_t *tex_level;   // 当前扫描线或像素块使用的 mip 层
+    int tex_lerp;               // 三线性过滤时与下一层混合的权重（0-255），其余情况为 0
+    sampler_t sampler;          // 纹理采样器，device_set_sampler 设置
+    const span_kernel_t *kernel;    // 当前三角形的扫描线内核
+    float tex_dy[3];            // 当前三角形 (u * rhw, v * rhw, rhw) 沿屏幕 y 的梯度，选择 mip 层用
+    int render_state;           // 渲染状态
+    int cull_mode;              // 背面剔除：CULL_NONE / CULL_CW / CULL_CCW
+    int rasterizer;             // 光栅化算法：RASTERIZER_SCANLINE / RASTERIZER_HALFSPACE
+    UINT32 background;          // 背景颜色
+    UINT32 *clear_color;        // device_clear 每一行的背景颜色，height 个
+    int clear_mode;             // clear_color 对应的 device_clear 模式，-1 为还没有计算
+    UINT32 clear_background;    // clear_color 对应的 background
+    UINT32 foreground;          // 线框颜色
+    int clip_x0, clip_y0;       // 光栅化裁剪区域左上角（包含）
+    int clip_x1, clip_y1;       // 光栅化裁剪区域右下角（不包含）
+    Tiler *tiler;               // 分块多线程光栅化，NULL 为立即绘制
+    vector_soa_t post_pos;      // draw_indexed 的模型坐标，SoA 排列，整块内存从 post_pos.x 开始
+    vector_soa_t post_clip;     // draw_indexed 变换后的齐次坐标，每个顶点只变换一次
+    vector_soa_t post_screen;   // draw_indexed 归一化后的屏幕坐标
+    int *post_cvv;              // draw_indexed 每个顶点的 cvv 检查结果
+    int post_max;               // 以上缓存的容量（顶点数）
+    int visibility;             // 可见性缓存模式：光栅化只写深度和三角形编号，device_flush 时每个像素只着色一次
+    int *vbuffer;               // 每个像素最近的三角形在 visible 中的下标，-1 为已经着色或者没有画过，width * height
+    visible_prim_t *visible;    // 上次 device_flush 之后提交的三角形
+    int visible_count;          // visible 中的三角形数
+    int visible_max;            // visible 的容量
+    int visible_id;             // 正在光栅化的三角形在 visible 中的下标
+#ifdef MINI3D_STATS
+    device_stats_t stats;       // 管线统计
+    unsigned short *overdraw;   // 每个像素被写入的次数，width * height
+#endif
     
 public:
     void draw_plane(int a, int b, int c, int d);
     void draw_box(float theta);
+    // 索引绘制：vertices 中 count 个顶点各变换一次，再按 indices 每三个索引组成一个三角形
+    void draw_indexed(const vertex_t *vertices, int count, const int *indices, int icount);
+    // 把网格的包围盒移到原点、缩放到与 draw_box 的立方体一样大，按 draw_box 的方式旋转后绘制
+    void draw_mesh(const mesh_t *mesh, float theta);
+    // 绘制 BVH 里与视锥相交的物体：先用当前的 view * projection 剔除，再按加入顺序逐个
+    // 设置世界矩阵、draw_indexed，带细节层次的物体按屏幕大小选层。
+    // 完全在视锥外的物体一个顶点也不变换。会改写 transform.world
+    void draw_bvh(const bvh_t *bvh);
+    // 按 order 回放命令列表：逐个设置渲染状态、世界矩阵，纹理只在变化时绑定，再 draw_indexed。
+    // 结束后恢复原来的渲染状态和纹理，transform.world 会被改写
+    void draw_list(const cmdlist_t *list);
     void camera_at_zero(float x, float y, float z);
     void init_texture();
 
-    // 豸ʼfb Ϊⲿ֡棬 NULL ⲿ֡棨ÿ 4 ֽڶ룩
+    // 设备初始化，fb 为外部帧缓存，非 NULL 将引用外部帧缓存（每行 width * 4 字节，紧密排列）
     void device_init(int width, int height, void *fb);
-    // ɾ豸
+    // 删除设备
     void device_destroy(Device *device);
-    // õǰ
+    // 设置当前纹理：复制 bits 并生成 mip 链
     void device_set_texture(void *bits, long pitch, int w, int h);
-    //  framebuffer  zbuffer
+    // 使用外部的纹理对象，绘制期间 tex 必须一直有效；NULL 恢复为 device_set_texture 的纹理
+    void device_bind_texture(const texture_t *tex);
+    // 设置纹理采样器：filter 为 SAMPLER_NEAREST / BILINEAR / TRILINEAR，address 为 SAMPLER_CLAMP / WRAP / MIRROR
+    void device_set_sampler(int filter, int address_u, int address_v);
+    // 清空 framebuffer 和 zbuffer
     void device_clear(int mode);
-    // 
+    // 画点
     void device_pixel(int x, int y, UINT32 color);
-    // ߶
+    // 绘制线段
     void device_draw_line(int x1, int y1, int x2, int y2, UINT32 c);
-    // ȡ
+    // 根据坐标读取纹理
     UINT32 Device_texture_read(float u, float v);
+    // 分块光栅化：threads 个工作线程，0 为关闭
+    void device_set_tiled(int threads);
+    // 深度格式：DEPTH_FLOAT / DEPTH_16 / DEPTH_24，切换之后 zbuffer 的内容作废，重新清零
+    void device_set_depth(int format);
+    // 可见性缓存模式：enable 非 0 时光栅化只写 zbuffer 和三角形编号，着色推迟到 device_flush
+    void device_set_visibility(int enable);
+    // 画完所有已提交的三角形，分块模式和可见性缓存模式下读取 framebuffer 之前必须调用
+    void device_flush();
+
+#ifdef MINI3D_STATS
+    // 清零统计计数与 overdraw
+    void device_stats_reset();
+    // 把 overdraw 转换成热度图（每像素 0x00RRGGBB），bits 为 height 行、每行 pitch 字节
+    void device_stats_heatmap(void *bits, long pitch);
+#endif
 
-    // Ⱦʵ
-    // ɨ
-    void device_draw_scanline(scanline_t *scanline);
-    // Ⱦ
+    // 渲染实现
+    // 像素矩形 [x0, x1) x [y0, y1) 覆盖的分块中还没有清零的 zbuffer 清零，读写 zbuffer 之前调用
+    void device_zclear_resolve(int y0, int y1, int x0, int x1);
+    // 同一行分块内的像素矩形 [x0, x1) x [y0, y1) 画过之后更新层次 z
+    void device_hiz_update(int y0, int y1, int x0, int x1);
+    // 绘制扫描线，hiz_test 为 0 时整条画出，不做层次 z 测试
+    void device_draw_scanline(scanline_t *scanline, int hiz_test);
+    // 扫描线 [x0, x1) 一段交给当前三角形的扫描线内核，不做层次 z 测试
+    void device_draw_span(const scanline_t *scanline, int x0, int x1);
+    // 主渲染函数
     void device_render_trap(trapezoid_t *trap);
-    //  render_state ԭʼ
+    // 边函数光栅化：按 8x8 像素块整块剔除或接受，属性由平面方程求值
+    void device_render_halfspace(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3);
+    // 可见性缓存：记录三角形的平面方程，返回它在 visible 中的下标
+    int device_visible_add(const vertex_t *t1, const vertex_t *t2, const vertex_t *t3);
+    // 可见性缓存：裁剪区域内还没有着色的像素按 vbuffer 里的三角形各着色一次
+    void device_visibility_resolve();
+    // 按 rasterizer 光栅化一个屏幕空间三角形（顶点已经 vertex_rhw_init）
+    void device_raster_triangle(const vertex_t *t1, const vertex_t *t2, const vertex_t *t3);
+    // 根据 render_state 绘制原始三角形
     void device_draw_primitive(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3);
+    // 变换顶点，得到齐次坐标、cvv 检查结果，通过检查时再归一化
+    void device_transform_vertex(post_vertex_t *q, const vertex_t *v);
+    // 批量变换 count 个顶点到 post_clip / post_cvv / post_screen
+    void device_transform_batch(const vertex_t *vertices, int count);
+    // 从 draw_indexed 的 SoA 缓存取出第 i 个变换后的顶点
+    void device_post_fetch(post_vertex_t *q, int i);
+    // 用已经变换好的顶点绘制三角形，v1-v3 提供纹理坐标和颜色，需要时做裁剪
+    void device_draw_post(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3,
+        const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3);
+    // 齐次空间裁剪：对近/远平面和保护带做多边形裁剪，再拆成三角形绘制
+    void device_clip_triangle(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3,
+        const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3);
+    // 裁剪成凸多边形，顶点属性写入 v，屏幕坐标写入 p（各 CLIP_VERTICES 个），返回顶点数，
+    // 按扇形 (0, i, i + 1) 拆成三角形；不到 3 个顶点时不可见
+    int device_clip_fan(vertex_t *v, post_vertex_t *p, const vertex_t *v1, const vertex_t *v2,
+        const vertex_t *v3, const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3);
+    // 屏幕空间剔除：按 cull_mode 剔除背面，并剔除零面积和不覆盖任何像素中心的三角形，返回非 0 为剔除
+    int device_check_cull(const point_t *p1, const point_t *p2, const point_t *p3);
+    // 绘制屏幕坐标已经算好的三角形，不再检查 cvv
+    void device_draw_triangle(const vertex_t *v1, const vertex_t *v2, const vertex_t *v3,
+        const post_vertex_t *q1, const post_vertex_t *q2, const post_vertex_t *q3);
 
 };
+
+#endif
@@ -0,0 +1,81 @@
+#include "offscreen.h"
+
+// 分配对齐的帧缓存，格式同 Win32 DIB：每像素 0x00RRGGBB
+int Offscreen::offscreen_init(int w, int h) {
+    size_t size, addr;
+    offscreen_close();
+    if (w <= 0 || h <= 0) return -1;
+    size = (size_t)w * h * 4;
+    screen_mem = (char*)malloc(size + OFFSCREEN_ALIGN);
+    if (screen_mem == NULL) return -2;
+    addr = ((size_t)screen_mem + OFFSCREEN_ALIGN - 1) & ~((size_t)OFFSCREEN_ALIGN - 1);
+    screen_fb = (unsigned char*)addr;
+    screen_w = w;
+    screen_h = h;
+    screen_pitch = w * 4;
+    memset(screen_fb, 0, size);
+    return 0;
+}
+
+int Offscreen::offscreen_close(void) {
+    if (screen_mem) free(screen_mem);
+    screen_mem = NULL;
+    screen_fb = NULL;
+    screen_w = screen_h = 0;
+    screen_pitch = 0;
+    return 0;
+}
+
+// 保存为二进制 PPM，每行转换一次再写出
+int Offscreen::offscreen_save_ppm(const char *filename) const {
+    unsigned char *line;
+    FILE *fp;
+    int x, y;
+    if (screen_fb == NULL) return -1;
+    fp = fopen(filename, "wb");
+    if (fp == NULL) return -2;
+    line = (unsigned char*)malloc(screen_w * 3);
+    assert(line);
+    fprintf(fp, "P6\n%d %d\n255\n", screen_w, screen_h);
+    for (y = 0; y < screen_h; y++) {
+        const UINT32 *src = (const UINT32*)(screen_fb + screen_pitch * y);
+        unsigned char *dst = line;
+        for (x = 0; x < screen_w; x++, dst += 3) {
+            UINT32 cc = src[x];
+            dst[0] = (unsigned char)((cc >> 16) & 0xff);
+            dst[1] = (unsigned char)((cc >> 8) & 0xff);
+            dst[2] = (unsigned char)(cc & 0xff);
+        }
+        fwrite(line, 1, screen_w * 3, fp);
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+// 保存为 RGBA 原始数据（无文件头，alpha 固定为 255）
+int Offscreen::offscreen_save_raw(const char *filename) const {
+    unsigned char *line;
+    FILE *fp;
+    int x, y;
+    if (screen_fb == NULL) return -1;
+    fp = fopen(filename, "wb");
+    if (fp == NULL) return -2;
+    line = (unsigned char*)malloc(screen_w * 4);
+    assert(line);
+    for (y = 0; y < screen_h; y++) {
+        const UINT32 *src = (const UINT32*)(screen_fb + screen_pitch * y);
+        unsigned char *dst = line;
+        for (x = 0; x < screen_w; x++, dst += 4) {
+            UINT32 cc = src[x];
+            dst[0] = (unsigned char)((cc >> 16) & 0xff);
+            dst[1] = (unsigned char)((cc >> 8) & 0xff);
+            dst[2] = (unsigned char)(cc & 0xff);
+            dst[3] = 255;
+        }
+        fwrite(line, 1, screen_w * 4, fp);
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _MINI3D_OFFSCREEN_H_
+#define _MINI3D_OFFSCREEN_H_
+
+#include "mini3d.h"
+
+#define OFFSCREEN_ALIGN             64      // 帧缓存首地址对齐（缓存行）
+
+// 离屏渲染目标：不依赖任何窗口系统，为 device 提供一块自有的对齐 FB
+class Offscreen {
+    int screen_w, screen_h;
+    char *screen_mem;           // malloc 得到的原始指针
+    unsigned char *screen_fb;   // 对齐以后的 frame buffer
+    long screen_pitch;
+
+public:
+    Offscreen() {
+        screen_w = 0, screen_h = 0;
+        screen_mem = NULL;
+        screen_fb = NULL;
+        screen_pitch = 0;
+    }
+    ~Offscreen() { offscreen_close(); }
+
+    int offscreen_init(int w, int h);                   // 分配帧缓存
+    int offscreen_close(void);                          // 释放帧缓存
+    int offscreen_save_ppm(const char *filename) const; // 保存为 PPM (P6)
+    int offscreen_save_raw(const char *filename) const; // 保存为 RGBA 原始数据
+    unsigned char *getScreenFrameBuffer() { return screen_fb; }
+    int getWidth() const { return screen_w; }
+    int getHeight() const { return screen_h; }
+    long getPitch() const { return screen_pitch; }
+};
+
+#endif
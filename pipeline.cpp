@@ -0,0 +1,140 @@
+#include "pipeline.h"
+
+#include <utility>
+
+// 交换两个设备的帧缓存：framebuffer、zbuffer、层次 z、可见性缓存和分块列表，
+// 渲染状态、变换、纹理和深度格式不动。两个设备的宽高必须相同，zbuffer 都按浮点格式分配，
+// 行距只取决于宽度和深度格式，不用交换
+static void pipeline_swap(Device *a, Device *b) {
+    std::swap(a->framebuffer, b->framebuffer);
+    std::swap(a->zbuffer, b->zbuffer);
+    std::swap(a->fb_stride, b->fb_stride);
+    std::swap(a->surface, b->surface);
+    std::swap(a->hiz, b->hiz);
+    std::swap(a->hiz_count, b->hiz_count);
+    std::swap(a->zclear, b->zclear);
+    std::swap(a->vbuffer, b->vbuffer);
+    std::swap(a->visible, b->visible);
+    std::swap(a->visible_count, b->visible_count);
+    std::swap(a->visible_max, b->visible_max);
+    std::swap(a->tiler, b->tiler);
+#ifdef MINI3D_STATS
+    std::swap(a->overdraw, b->overdraw);
+#endif
+}
+
+Pipeline::Pipeline(Device *device, int depth, int threads, pipeline_present_t present, void *user) {
+    int i;
+    assert(depth >= 1 && depth <= PIPELINE_MAX_DEPTH);
+    this->device = device;
+    this->depth = depth;
+    this->present = present;
+    this->user = user;
+    next_begin = next_raster = next_present = 0;
+    frame_count = 0;
+    recording = -1;
+    quit = false;
+    for (i = 0; i < depth; i++) {
+        slot_t *slot = &slots[i];
+        slot->target.device_init(device->width, device->height, NULL);
+        slot->target.device_set_tiled((threads > 0) ? threads : 1);
+        slot->target.device_set_visibility(device->visibility);
+        slot->state = SLOT_FREE;
+        slot->index = -1;
+    }
+    raster_thread = std::thread(&Pipeline::raster_main, this);
+    present_thread = std::thread(&Pipeline::present_main, this);
+}
+
+Pipeline::~Pipeline() {
+    int i;
+    pipeline_wait();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    cond.notify_all();
+    raster_thread.join();
+    present_thread.join();
+    for (i = 0; i < depth; i++)
+        slots[i].target.device_destroy(&slots[i].target);
+}
+
+// 槽位按轮转顺序使用，几何、光栅化、输出三个阶段各自按同样的顺序前进，帧的顺序不会乱
+void Pipeline::pipeline_begin(void) {
+    slot_t *slot;
+    assert(recording < 0);
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        slot = &slots[next_begin];
+        cond.wait(guard, [slot] { return slot->state == SLOT_FREE; });
+        slot->state = SLOT_RECORDING;
+        slot->index = frame_count++;
+        recording = next_begin;
+        next_begin = (next_begin + 1) % depth;
+    }
+    pipeline_swap(device, &slot->target);
+    device->visible_count = 0;      // 上次用这一帧时的三角形已经在光栅化线程里画完
+}
+
+// 快照在换回之前复制，frame 引用的是这一帧的缓存；target 仍然持有它们，负责释放
+void Pipeline::pipeline_end(void) {
+    slot_t *slot;
+    assert(recording >= 0);
+    slot = &slots[recording];
+    slot->frame = *device;
+    pipeline_swap(device, &slot->target);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        slot->state = SLOT_RECORDED;
+        recording = -1;
+    }
+    cond.notify_all();
+}
+
+void Pipeline::pipeline_wait(void) {
+    std::unique_lock<std::mutex> guard(lock);
+    assert(recording < 0);
+    cond.wait(guard, [this] {
+        for (int i = 0; i < depth; i++) if (slots[i].state != SLOT_FREE) return false;
+        return true;
+    });
+}
+
+void Pipeline::raster_main(void) {
+    while (1) {
+        slot_t *slot;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            slot = &slots[next_raster];
+            cond.wait(guard, [this, slot] { return quit || slot->state == SLOT_RECORDED; });
+            if (slot->state != SLOT_RECORDED) return;
+            next_raster = (next_raster + 1) % depth;
+        }
+        slot->frame.device_flush();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            slot->state = SLOT_RASTERED;
+        }
+        cond.notify_all();
+    }
+}
+
+void Pipeline::present_main(void) {
+    while (1) {
+        slot_t *slot;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            slot = &slots[next_present];
+            cond.wait(guard, [this, slot] { return quit || slot->state == SLOT_RASTERED; });
+            if (slot->state != SLOT_RASTERED) return;
+            next_present = (next_present + 1) % depth;
+        }
+        if (present) present(user, &slot->frame, slot->index);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            slot->state = SLOT_FREE;
+        }
+        cond.notify_all();
+    }
+}
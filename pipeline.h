@@ -0,0 +1,70 @@
+#ifndef _MINI3D_PIPELINE_H_
+#define _MINI3D_PIPELINE_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "mini3d.h"
+
+#define PIPELINE_MAX_DEPTH          8       // 最多同时在流水线里的帧数
+
+// 输出一帧：frame 为光栅化完成的帧，framebuffer 可读，stats 为这一帧的统计，只在回调里有效；
+// index 为帧号（从 0 开始）。在输出线程里调用
+typedef void (*pipeline_present_t)(void *user, Device *frame, int index);
+
+// 帧流水线：几何（调用线程）、光栅化、输出三个阶段各自一个线程，不同的帧在不同的阶段里同时进行。
+// 每一帧有自己的 framebuffer、zbuffer、层次 z、可见性缓存和分块的三角形列表。
+// pipeline_begin 把一个空闲帧的这些缓存换进 device，之后 device 上的 device_clear、draw_* 都只是
+// 变换、设置并记录到这一帧的分块列表里；pipeline_end 把缓存换回来，连同此时 device 的渲染状态
+// （快照）交给光栅化线程。光栅化线程按顺序对每一帧 device_flush，再交给输出线程调用 present。
+// 同时在流水线里的帧数不超过 depth，延迟最多 depth 帧：depth = 3 时第 N + 1 帧做几何的同时，
+// 第 N 帧在光栅化，第 N - 1 帧在输出；depth = 1 时三个阶段依次进行。
+// 纹理只引用不复制：换纹理、采样器、分块线程数或者可见性缓存之前先 pipeline_wait。
+// pipeline_begin 和 pipeline_end 之间不需要 device_flush，调用了也正确，只是光栅化回到了几何线程。
+class Pipeline {
+    enum { SLOT_FREE, SLOT_RECORDING, SLOT_RECORDED, SLOT_RASTERED };
+    typedef struct Slot {
+        Device target;              // 这一帧的缓存，device_init 分配，只用来持有和释放
+        Device frame;               // pipeline_end 时 device 的快照，缓存换成 target 的
+        int state;
+        int index;
+    } slot_t;
+
+    Device *device;
+    slot_t slots[PIPELINE_MAX_DEPTH];
+    int depth;
+    int next_begin;                 // 下一个交给几何阶段的槽位
+    int next_raster;                // 光栅化线程下一个等待的槽位
+    int next_present;               // 输出线程下一个等待的槽位
+    int frame_count;                // 已经开始的帧数
+    int recording;                  // pipeline_begin 之后还没有 pipeline_end 的槽位，-1 为没有
+    pipeline_present_t present;
+    void *user;
+
+    std::thread raster_thread;
+    std::thread present_thread;
+    std::mutex lock;
+    std::condition_variable cond;
+    bool quit;
+
+    void raster_main(void);
+    void present_main(void);
+
+public:
+    // depth 为同时在流水线里的帧数（1 到 PIPELINE_MAX_DEPTH），threads 为每一帧分块光栅化的线程数
+    // （同 device_set_tiled，0 按 1 处理）。device 的可见性缓存模式在创建时确定
+    Pipeline(Device *device, int depth, int threads, pipeline_present_t present, void *user);
+    // 等所有帧输出完，释放各帧的缓存
+    ~Pipeline();
+
+    // 等到有空闲的帧，之后 device 上的绘制都记录到这一帧
+    void pipeline_begin(void);
+    // 这一帧交给光栅化线程，device 换回原来的缓存
+    void pipeline_end(void);
+    // 等到已经提交的帧全部输出完
+    void pipeline_wait(void);
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "mini3d.h"
+
+//=====================================================================
+// 纹理采样：先按寻址方式把 u / v 变换到 [0, 1]，再换算成 texel 坐标。
+// 夹取保持原来的映射 u * (width - 1)，u = 0 / 1 落在两端 texel 的中心；
+// 重复和镜像用 u * width - 0.5，这样相邻的周期首尾相接。
+// 双线性过滤把 texel 坐标取成 8.8 定点数，整数部分找到 2x2 个 texel，小数部分
+// 组成四个加起来等于 256 的权重，每个通道乘权重相加后右移 8 位，不用浮点。
+// 每个通道的乘积之和不超过 255 * 256，放得进 16 位，所以标量代码可以把 R、B 两个
+// 通道放在一个 32 位数里同时算，SSE2 代码每个通道占一个 16 位 lane。
+//=====================================================================
+
+// 按寻址方式把 u 变换到 [0, 1]，比较的写法与 SSE2 的 min / max 对 NaN 的处理一致
+static inline float sampler_address(float u, int mode) {
+    if (mode == SAMPLER_WRAP) return u - floorf(u);
+    if (mode == SAMPLER_MIRROR) {
+        float t = u * 0.5f;
+        t = t - floorf(t);
+        return 1.0f - fabsf((t + t) - 1.0f);
+    }
+    u = (u > 0.0f) ? u : 0.0f;
+    return (u < 1.0f) ? u : 1.0f;
+}
+
+// 一个方向上的最近点：夹取为 round(u * (n - 1))，其余为 floor(u * n)
+static inline int sampler_nearest(float u, int mode, int n, float max) {
+    int x = (mode == SAMPLER_CLAMP) ? (int)(u * max + 0.5f) : (int)(u * (float)n);
+    return clamp(x, 0, n - 1);
+}
+
+// 一个方向上的双线性：相邻两个 texel x0、x1 与 x1 的权重 f（0-255）。
+// 定点坐标加 256 再截断，此时坐标不小于 128，截断就是向下取整，整数部分再减 1。
+// 夹取时 u 已经在 [0, 1]，x0 一定在范围内；重复时 x0 只会是 -1，镜像在边上重复最后一个 texel。
+// NaN 之类无意义的坐标截断得到很小的负数，同样落回范围内
+static inline void sampler_linear(float u, int mode, int n, float max, int *x0, int *x1, int *f) {
+    int p = (mode == SAMPLER_CLAMP) ? (int)(u * (max * 256.0f) + 256.0f) :
+        (int)(u * ((float)n * 256.0f) + 128.0f);
+    int a = (p >> 8) - 1, b;
+    *f = p & 255;
+    if (mode == SAMPLER_WRAP) {
+        a = (a < 0) ? n - 1 : a;
+        b = (a + 1 < n) ? a + 1 : 0;
+    }
+    else {
+        a = (a > 0) ? a : 0;
+        b = (a + 1 < n) ? a + 1 : n - 1;
+    }
+    *x0 = a;
+    *x1 = b;
+}
+
+// 两个颜色按 f / 256 混合（f 为 b 的权重），四舍五入
+static inline UINT32 sampler_lerp(UINT32 a, UINT32 b, int f) {
+    UINT32 g = 256 - f;
+    UINT32 rb = (a & 0xff00ff) * g + (b & 0xff00ff) * f + 0x800080;
+    UINT32 ag = ((a >> 8) & 0xff00ff) * g + ((b >> 8) & 0xff00ff) * f + 0x800080;
+    return ((rb >> 8) & 0xff00ff) | (ag & 0xff00ff00);
+}
+
+// 在一个 mip 层上读取，u / v 已经按寻址方式变换过
+static UINT32 sampler_read(const sampler_t *sampler, const texture_level_t *level, float u, float v) {
+    int x0, x1, y0, y1, fx, fy, w00, w01, w10, w11;
+    UINT32 c00, c01, c10, c11, rb, ag;
+    if (sampler->filter == SAMPLER_NEAREST) {
+        x0 = sampler_nearest(u, sampler->address_u, level->width, level->max_u);
+        y0 = sampler_nearest(v, sampler->address_v, level->height, level->max_v);
+        return level->bits[texture_offset(level, x0, y0)];
+    }
+    sampler_linear(u, sampler->address_u, level->width, level->max_u, &x0, &x1, &fx);
+    sampler_linear(v, sampler->address_v, level->height, level->max_v, &y0, &y1, &fy);
+    c00 = level->bits[texture_offset(level, x0, y0)];
+    c01 = level->bits[texture_offset(level, x1, y0)];
+    c10 = level->bits[texture_offset(level, x0, y1)];
+    c11 = level->bits[texture_offset(level, x1, y1)];
+    w11 = (fx * fy + 128) >> 8;
+    w01 = fx - w11;
+    w10 = fy - w11;
+    w00 = 256 - fx - fy + w11;
+    rb = (c00 & 0xff00ff) * w00 + (c01 & 0xff00ff) * w01 +
+        (c10 & 0xff00ff) * w10 + (c11 & 0xff00ff) * w11 + 0x800080;
+    ag = ((c00 >> 8) & 0xff00ff) * w00 + ((c01 >> 8) & 0xff00ff) * w01 +
+        ((c10 >> 8) & 0xff00ff) * w10 + ((c11 >> 8) & 0xff00ff) * w11 + 0x800080;
+    return ((rb >> 8) & 0xff00ff) | (ag & 0xff00ff00);
+}
+
+UINT32 sampler_fetch(const sampler_t *sampler, const texture_level_t *level, int lerp, float u, float v) {
+    UINT32 c;
+    u = sampler_address(u, sampler->address_u);
+    v = sampler_address(v, sampler->address_v);
+    c = sampler_read(sampler, level, u, v);
+    if (lerp == 0) return c;
+    return sampler_lerp(c, sampler_read(sampler, level + 1, u, v), lerp);
+}
+
+
+#ifdef MINI3D_SSE2
+//---------------------------------------------------------------------
+// SSE2：一次 4 个像素，每一步的运算与上面的标量代码相同
+//---------------------------------------------------------------------
+static inline __m128 sampler_floor_sse2(__m128 x) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+static inline __m128 sampler_address_sse2(__m128 u, int mode) {
+    if (mode == SAMPLER_WRAP) return _mm_sub_ps(u, sampler_floor_sse2(u));
+    if (mode == SAMPLER_MIRROR) {
+        __m128 t = _mm_mul_ps(u, _mm_set1_ps(0.5f));
+        t = _mm_sub_ps(t, sampler_floor_sse2(t));
+        t = _mm_sub_ps(_mm_add_ps(t, t), _mm_set1_ps(1.0f));
+        return _mm_sub_ps(_mm_set1_ps(1.0f), _mm_andnot_ps(_mm_set1_ps(-0.0f), t));
+    }
+    return _mm_min_ps(_mm_max_ps(u, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+static inline __m128i sampler_nearest_sse2(__m128 u, int mode, int n, float max) {
+    __m128i x = (mode == SAMPLER_CLAMP) ?
+        _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(u, _mm_set1_ps(max)), _mm_set1_ps(0.5f))) :
+        _mm_cvttps_epi32(_mm_mul_ps(u, _mm_set1_ps((float)n)));
+    return clamp_sse2(x, _mm_setzero_si128(), _mm_set1_epi32(n - 1));
+}
+
+static inline void sampler_linear_sse2(__m128 u, int mode, int n, float max, __m128i *x0, __m128i *x1, __m128i *f) {
+    __m128i p = (mode == SAMPLER_CLAMP) ?
+        _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(u, _mm_set1_ps(max * 256.0f)), _mm_set1_ps(256.0f))) :
+        _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(u, _mm_set1_ps((float)n * 256.0f)), _mm_set1_ps(128.0f)));
+    __m128i one = _mm_set1_epi32(1);
+    __m128i a = _mm_sub_epi32(_mm_srai_epi32(p, 8), one), b, m;
+    *f = _mm_and_si128(p, _mm_set1_epi32(255));
+    if (mode == SAMPLER_WRAP) {
+        m = _mm_cmpgt_epi32(_mm_setzero_si128(), a);
+        a = _mm_or_si128(_mm_and_si128(m, _mm_set1_epi32(n - 1)), _mm_andnot_si128(m, a));
+        b = _mm_add_epi32(a, one);
+        b = _mm_andnot_si128(_mm_cmpeq_epi32(b, _mm_set1_epi32(n)), b);
+    }
+    else {
+        a = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_setzero_si128(), a), a);
+        b = _mm_add_epi32(a, one);
+        b = _mm_add_epi32(b, _mm_cmpeq_epi32(b, _mm_set1_epi32(n)));
+    }
+    *x0 = a;
+    *x1 = b;
+}
+
+// 按下标读 4 个 texel。直接拼成向量，不经过内存里的数组（写 4 次再整体读一次会让
+// store forwarding 失败）
+static inline __m128i sampler_gather_sse2(const UINT32 *bits, __m128i offset) {
+    int index[4];
+    __m128i a, b, c, d;
+    _mm_storeu_si128((__m128i*)index, offset);
+    a = _mm_cvtsi32_si128((int)bits[index[0]]);
+    b = _mm_cvtsi32_si128((int)bits[index[1]]);
+    c = _mm_cvtsi32_si128((int)bits[index[2]]);
+    d = _mm_cvtsi32_si128((int)bits[index[3]]);
+    return _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b), _mm_unpacklo_epi32(c, d));
+}
+
+// 4 个像素的 32 位数展开成 16 位：lo 为像素 0、1 各重复 4 次（对应 4 个通道），hi 为像素 2、3
+static inline void sampler_expand_sse2(__m128i w, __m128i *lo, __m128i *hi) {
+    __m128i h = _mm_packs_epi32(w, w);
+    h = _mm_unpacklo_epi16(h, h);
+    *lo = _mm_unpacklo_epi32(h, h);
+    *hi = _mm_unpackhi_epi32(h, h);
+}
+
+// 两个像素（16 位一个通道）的双线性混合，权重的算法与标量相同
+static inline __m128i sampler_bilinear_sse2(__m128i c00, __m128i c01, __m128i c10, __m128i c11,
+    __m128i fx, __m128i fy) {
+    __m128i w11 = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(fx, fy), _mm_set1_epi16(128)), 8);
+    __m128i w01 = _mm_sub_epi16(fx, w11);
+    __m128i w10 = _mm_sub_epi16(fy, w11);
+    __m128i w00 = _mm_add_epi16(_mm_sub_epi16(_mm_sub_epi16(_mm_set1_epi16(256), fx), fy), w11);
+    __m128i acc = _mm_add_epi16(_mm_mullo_epi16(c00, w00), _mm_mullo_epi16(c01, w01));
+    acc = _mm_add_epi16(acc, _mm_add_epi16(_mm_mullo_epi16(c10, w10), _mm_mullo_epi16(c11, w11)));
+    return _mm_srli_epi16(_mm_add_epi16(acc, _mm_set1_epi16(128)), 8);
+}
+
+static __m128i sampler_read_sse2(const sampler_t *sampler, const texture_level_t *level, __m128 u, __m128 v) {
+    __m128i x0, x1, y0, y1, fx, fy, fxl, fxh, fyl, fyh, c00, c01, c10, c11, lo, hi;
+    __m128i zero = _mm_setzero_si128();
+    if (sampler->filter == SAMPLER_NEAREST) {
+        x0 = sampler_nearest_sse2(u, sampler->address_u, level->width, level->max_u);
+        y0 = sampler_nearest_sse2(v, sampler->address_v, level->height, level->max_v);
+        return sampler_gather_sse2(level->bits, texture_offset_sse2(level, x0, y0));
+    }
+    sampler_linear_sse2(u, sampler->address_u, level->width, level->max_u, &x0, &x1, &fx);
+    sampler_linear_sse2(v, sampler->address_v, level->height, level->max_v, &y0, &y1, &fy);
+    // 下标按行、列拆开，四个角只算两次行、两次列
+    x0 = texture_column_sse2(level, x0);
+    x1 = texture_column_sse2(level, x1);
+    y0 = texture_row_sse2(level, y0);
+    y1 = texture_row_sse2(level, y1);
+    c00 = sampler_gather_sse2(level->bits, _mm_add_epi32(y0, x0));
+    c01 = sampler_gather_sse2(level->bits, _mm_add_epi32(y0, x1));
+    c10 = sampler_gather_sse2(level->bits, _mm_add_epi32(y1, x0));
+    c11 = sampler_gather_sse2(level->bits, _mm_add_epi32(y1, x1));
+    sampler_expand_sse2(fx, &fxl, &fxh);
+    sampler_expand_sse2(fy, &fyl, &fyh);
+    lo = sampler_bilinear_sse2(_mm_unpacklo_epi8(c00, zero), _mm_unpacklo_epi8(c01, zero),
+        _mm_unpacklo_epi8(c10, zero), _mm_unpacklo_epi8(c11, zero), fxl, fyl);
+    hi = sampler_bilinear_sse2(_mm_unpackhi_epi8(c00, zero), _mm_unpackhi_epi8(c01, zero),
+        _mm_unpackhi_epi8(c10, zero), _mm_unpackhi_epi8(c11, zero), fxh, fyh);
+    return _mm_packus_epi16(lo, hi);
+}
+
+// 两组颜色按 f / 256 混合
+static inline __m128i sampler_lerp_sse2(__m128i a, __m128i b, int f) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i g = _mm_set1_epi16((short)(256 - f)), h = _mm_set1_epi16((short)f);
+    __m128i r = _mm_set1_epi16(128);
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), g),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), h));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), g),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), h));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, r), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, r), 8);
+    return _mm_packus_epi16(lo, hi);
+}
+
+__m128i sampler_fetch_sse2(const sampler_t *sampler, const texture_level_t *level, int lerp, __m128 u, __m128 v) {
+    __m128i c;
+    u = sampler_address_sse2(u, sampler->address_u);
+    v = sampler_address_sse2(v, sampler->address_v);
+    c = sampler_read_sse2(sampler, level, u, v);
+    if (lerp == 0) return c;
+    return sampler_lerp_sse2(c, sampler_read_sse2(sampler, level + 1, u, v), lerp);
+}
+#endif
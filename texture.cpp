@@ -0,0 +1,154 @@
+#include "mini3d.h"
+
+//=====================================================================
+// 纹理：完整的 mip 链放在一块内存里，每层按 4x4 texel 分块存放，
+// 一块 64 字节正好是一条缓存行，相邻像素（不管横向还是纵向）大多落在同一块里。
+// 扫描线按屏幕空间 uv 的导数选择 mip 层，远处的表面只读很小的层。
+//=====================================================================
+
+// 第 k 层的一个 texel，坐标超出范围时取边上的 texel
+static inline UINT32 texture_texel(const texture_level_t *level, int x, int y) {
+    x = (x < level->width) ? x : level->width - 1;
+    y = (y < level->height) ? y : level->height - 1;
+    return level->bits[texture_offset(level, x, y)];
+}
+
+// 2x2 个 texel 的每个通道求平均（四舍五入）
+static inline UINT32 texture_average(UINT32 a, UINT32 b, UINT32 c, UINT32 d) {
+    UINT32 rb = (a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (d & 0xff00ff) + 0x020002;
+    UINT32 ag = ((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff) + ((c >> 8) & 0xff00ff) + ((d >> 8) & 0xff00ff) + 0x020002;
+    return ((rb >> 2) & 0xff00ff) | (((ag >> 2) & 0xff00ff) << 8);
+}
+
+// 从第 first 层开始按 4x4 分块排列各层，一直到 1x1，所有层放在一块 64 字节对齐的内存里
+static void texture_layout(texture_t *tex, int w, int h, int first) {
+    int size = TEXTURE_TILE * TEXTURE_TILE;
+    long total = 0;
+    int k;
+    char *ptr;
+    assert(w > 0 && h > 0 && w <= (1 << (TEXTURE_LEVELS - 1)) && h <= (1 << (TEXTURE_LEVELS - 1)));
+    for (k = 0; k == 0 || (w >> (k - 1)) > 1 || (h >> (k - 1)) > 1; k++) {
+        texture_level_t *level = &tex->level[k];
+        int tiles_x, tiles_y;
+        level->width = (w >> k) ? (w >> k) : 1;
+        level->height = (h >> k) ? (h >> k) : 1;
+        level->max_u = (float)(level->width - 1);
+        level->max_v = (float)(level->height - 1);
+        if (k < first) continue;
+        level->shift = TEXTURE_TILE_SHIFT;
+        tiles_x = (level->width + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        tiles_y = (level->height + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        level->stride = tiles_x * size;
+        level->bits = (UINT32*)(size_t)total;
+        total += (long)tiles_y * level->stride;
+    }
+    tex->levels = k;
+    if (total == 0) return;
+    ptr = (char*)malloc(total * sizeof(UINT32) + 64);
+    assert(ptr);
+    tex->memory = ptr;
+    ptr += (64 - ((size_t)ptr & 63)) & 63;
+    for (k = first; k < tex->levels; k++)
+        tex->level[k].bits = (UINT32*)ptr + (size_t)tex->level[k].bits;
+    memset(tex->level[first].bits, 0, total * sizeof(UINT32));
+}
+
+// 分配 w x h 的纹理，每层都按 4x4 分块存放，内容为 0
+int texture_create(texture_t *tex, int w, int h) {
+    memset(tex, 0, sizeof(texture_t));
+    texture_layout(tex, w, h, 0);
+    return 0;
+}
+
+// 初始化纹理：复制 bits（h 行，每行 pitch 字节，w 个 UINT32）到分块存放的第 0 层，
+// 再逐层 2x2 平均生成整条 mip 链，直到 1x1
+int texture_init(texture_t *tex, const void *bits, long pitch, int w, int h) {
+    int x, y;
+    texture_create(tex, w, h);
+    for (y = 0; y < h; y++) {
+        const UINT32 *src = (const UINT32*)((const char*)bits + pitch * y);
+        for (x = 0; x < w; x++)
+            tex->level[0].bits[texture_offset(&tex->level[0], x, y)] = src[x];
+    }
+    texture_build_mips(tex);
+    return 0;
+}
+
+// 第 0 层直接引用 bits，逐行存放（shift 为 0），stride 为 pitch / 4，pitch 为负时行从下往上排。
+// 只为其余各层分配内存，bits 必须比纹理活得长
+int texture_init_shared(texture_t *tex, const void *bits, long pitch, int w, int h) {
+    texture_level_t *level = &tex->level[0];
+    assert(pitch % 4 == 0);
+    memset(tex, 0, sizeof(texture_t));
+    texture_layout(tex, w, h, 1);
+    level->bits = (UINT32*)bits;
+    level->shift = 0;
+    level->stride = (int)(pitch / 4);
+    texture_build_mips(tex);
+    return 0;
+}
+
+// 由第 0 层逐层 2x2 平均生成其余各层
+void texture_build_mips(texture_t *tex) {
+    int k, x, y;
+    for (k = 1; k < tex->levels; k++) {
+        const texture_level_t *src = &tex->level[k - 1];
+        texture_level_t *dst = &tex->level[k];
+        for (y = 0; y < dst->height; y++) {
+            for (x = 0; x < dst->width; x++) {
+                dst->bits[texture_offset(dst, x, y)] = texture_average(
+                    texture_texel(src, x * 2, y * 2), texture_texel(src, x * 2 + 1, y * 2),
+                    texture_texel(src, x * 2, y * 2 + 1), texture_texel(src, x * 2 + 1, y * 2 + 1));
+            }
+        }
+    }
+}
+
+// 释放纹理内存，第 0 层来自文件映射时一起解除映射
+void texture_destroy(texture_t *tex) {
+    if (tex->memory)
+        free(tex->memory);
+    if (tex->mapped)
+        file_unmap(tex->mapped, tex->mapped_size);
+    memset(tex, 0, sizeof(texture_t));
+}
+
+// 选择 mip 层：(U, V, R) = (u * rhw, v * rhw, rhw) 为某个像素上的值，dx、dy 为它们在屏幕上
+// 沿 x、y 方向的梯度。u = U / R 的导数为 (dU - u * dR) / R，乘上第 0 层的大小得到 texel 数，
+// 取两个方向里足迹较大的那个 rho，lod = log2(rho)。
+// log2 直接取 rho^2 浮点数的指数，不调用库函数；三线性过滤要的小数部分用尾数的高 8 位线性近似
+int texture_select_level(const texture_t *tex, float U, float V, float R, const float *dx, const float *dy,
+    int *lerp) {
+    const texture_level_t *level = &tex->level[0];
+    float inv, u, v, dudx, dvdx, dudy, dvdy, rx, ry, rho;
+    union { float f; int i; } bits;
+    int k;
+    if (lerp) *lerp = 0;
+    if (tex->levels <= 1 || R <= 0.0f) return 0;
+    inv = 1.0f / R;
+    u = U * inv;
+    v = V * inv;
+    dudx = (dx[0] - u * dx[2]) * inv * level->max_u;
+    dvdx = (dx[1] - v * dx[2]) * inv * level->max_v;
+    dudy = (dy[0] - u * dy[2]) * inv * level->max_u;
+    dvdy = (dy[1] - v * dy[2]) * inv * level->max_v;
+    rx = dudx * dudx + dvdx * dvdx;
+    ry = dudy * dudy + dvdy * dvdy;
+    rho = (rx > ry) ? rx : ry;
+    if (lerp) {
+        // rho^2 的位模式减去 1.0f 的位模式，右移 16 位就是 log2(rho) 的 8.8 定点数
+        int lod;
+        if (!(rho > 1.0f)) return 0;
+        bits.f = rho;
+        lod = (bits.i - (127 << 23)) >> 16;
+        k = lod >> 8;
+        if (k >= tex->levels - 1) return tex->levels - 1;
+        *lerp = lod & 255;
+        return k;
+    }
+    rho *= 2.0f;
+    if (!(rho >= 4.0f)) return 0;
+    bits.f = rho;
+    k = (((bits.i >> 23) & 255) - 127) >> 1;
+    return (k < tex->levels - 1) ? k : tex->levels - 1;
+}
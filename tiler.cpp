@@ -0,0 +1,234 @@
+#include <math.h>
+
+#include "tiler.h"
+
+Tiler::Tiler(int width, int height, int threads) {
+    int i;
+    this->width = width;
+    this->height = height;
+    this->tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    this->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    this->bins.resize(tiles_x * tiles_y);
+    for (i = 0; i < tiles_x * tiles_y; i++)
+        this->bins[i].first = this->bins[i].last = NULL;
+    arena_init(&this->arena, TILE_ARENA);
+    this->prim_count = 0;
+    this->job = NULL;
+    this->generation = 0;
+    this->pending = 0;
+    this->quit = false;
+    this->next_tile = 0;
+    for (i = 1; i < threads; i++)
+        workers.push_back(std::thread(&Tiler::worker_main, this));
+}
+
+Tiler::~Tiler() {
+    size_t i;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    cond_start.notify_all();
+    for (i = 0; i < workers.size(); i++)
+        workers[i].join();
+    arena_destroy(&arena);
+}
+
+// 把图元记录到与 [x0, x1) x [y0, y1) 相交的分块里
+void Tiler::tiler_bin(const tile_prim_t *prim, int x0, int y0, int x1, int y1) {
+    int tx, ty;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > width) x1 = width;
+    if (y1 > height) y1 = height;
+    if (x0 >= x1 || y0 >= y1) return;
+    for (ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ty++) {
+        for (tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; tx++) {
+            tile_bin_t *bin = &bins[ty * tiles_x + tx];
+            if (bin->last == NULL || bin->last->count == TILE_CHUNK) {
+                tile_chunk_t *chunk = (tile_chunk_t*)arena_alloc(&arena, sizeof(tile_chunk_t));
+                chunk->next = NULL;
+                chunk->count = 0;
+                if (bin->last == NULL) {
+                    bin->first = chunk;
+                    active.push_back(ty * tiles_x + tx);
+                }
+                else bin->last->next = chunk;
+                bin->last = chunk;
+            }
+            bin->last->prims[bin->last->count++] = prim;
+        }
+    }
+}
+
+// 三角形的包围盒：行范围与 device_render_trap 相同，列范围取顶点包围盒外扩一个像素
+void Tiler::tiler_add_triangle(const Device *device, const vertex_t *t1, const vertex_t *t2, const vertex_t *t3) {
+    tile_prim_t *prim = (tile_prim_t*)arena_alloc(&arena, sizeof(tile_prim_t));
+    float xmin, xmax, ymin, ymax;
+    xmin = xmax = t1->pos.x;
+    ymin = ymax = t1->pos.y;
+    if (t2->pos.x < xmin) xmin = t2->pos.x;
+    if (t2->pos.x > xmax) xmax = t2->pos.x;
+    if (t3->pos.x < xmin) xmin = t3->pos.x;
+    if (t3->pos.x > xmax) xmax = t3->pos.x;
+    if (t2->pos.y < ymin) ymin = t2->pos.y;
+    if (t2->pos.y > ymax) ymax = t2->pos.y;
+    if (t3->pos.y < ymin) ymin = t3->pos.y;
+    if (t3->pos.y > ymax) ymax = t3->pos.y;
+    prim->v[0] = *t1;
+    prim->v[1] = *t2;
+    prim->v[2] = *t3;
+    prim->render_state = device->render_state & ~RENDER_STATE_WIREFRAME;
+    prim->foreground = device->foreground;
+    prim->id = device->visible_id;
+    prim_count++;
+    tiler_bin(prim, (int)floorf(xmin) - 1, subpixel_ceil(subpixel_snap(ymin)),
+        (int)ceilf(xmax) + 2, subpixel_ceil(subpixel_snap(ymax)));
+}
+
+void Tiler::tiler_add_lines(const Device *device, const point_t *p1, const point_t *p2, const point_t *p3) {
+    tile_prim_t *prim = (tile_prim_t*)arena_alloc(&arena, sizeof(tile_prim_t));
+    int *lines = prim->lines;
+    int xmin, xmax, ymin, ymax, i;
+    lines[0] = (int)p1->x, lines[1] = (int)p1->y;
+    lines[2] = (int)p2->x, lines[3] = (int)p2->y;
+    lines[4] = (int)p3->x, lines[5] = (int)p3->y;
+    xmin = xmax = lines[0];
+    ymin = ymax = lines[1];
+    for (i = 2; i < 6; i += 2) {
+        if (lines[i] < xmin) xmin = lines[i];
+        if (lines[i] > xmax) xmax = lines[i];
+        if (lines[i + 1] < ymin) ymin = lines[i + 1];
+        if (lines[i + 1] > ymax) ymax = lines[i + 1];
+    }
+    prim->render_state = RENDER_STATE_WIREFRAME;
+    prim->foreground = device->foreground;
+    prim->id = -1;
+    prim_count++;
+    tiler_bin(prim, xmin, ymin, xmax + 1, ymax + 1);
+}
+
+// 领取分块并光栅化：每个分块用一个裁剪区域为该分块的设备副本来画，
+// 副本共享 framebuffer / zbuffer，统计计数最后合并回 device。
+// 可见性缓存模式下分块画完马上着色，这时分块的 zbuffer / vbuffer 还在缓存里
+void Tiler::tiler_run(Device *device) {
+#ifdef MINI3D_STATS
+    device_stats_t total;
+    memset(&total, 0, sizeof(total));
+#endif
+    while (1) {
+        int index = next_tile++;
+        if (index >= (int)active.size()) break;
+        int tile = active[index];
+        const tile_chunk_t *chunk;
+        Device local = *device;
+        int i;
+        local.tiler = NULL;
+        local.clip_x0 = (tile % tiles_x) * TILE_SIZE;
+        local.clip_y0 = (tile / tiles_x) * TILE_SIZE;
+        local.clip_x1 = local.clip_x0 + TILE_SIZE;
+        local.clip_y1 = local.clip_y0 + TILE_SIZE;
+        if (local.clip_x1 > width) local.clip_x1 = width;
+        if (local.clip_y1 > height) local.clip_y1 = height;
+#ifdef MINI3D_STATS
+        memset(&local.stats, 0, sizeof(local.stats));
+#endif
+        for (chunk = bins[tile].first; chunk != NULL; chunk = chunk->next) {
+            for (i = 0; i < chunk->count; i++) {
+                const tile_prim_t *prim = chunk->prims[i];
+                local.render_state = prim->render_state;
+                if (prim->render_state != RENDER_STATE_WIREFRAME) {
+                    local.visible_id = prim->id;
+                    local.device_raster_triangle(&prim->v[0], &prim->v[1], &prim->v[2]);
+                }
+                else {
+                    const int *p = prim->lines;
+                    local.device_draw_line(p[0], p[1], p[2], p[3], prim->foreground);
+                    local.device_draw_line(p[0], p[1], p[4], p[5], prim->foreground);
+                    local.device_draw_line(p[4], p[5], p[2], p[3], prim->foreground);
+                }
+            }
+        }
+        if (local.visibility)
+            local.device_visibility_resolve();
+#ifdef MINI3D_STATS
+        total.trapezoids += local.stats.trapezoids;
+        total.scanlines += local.stats.scanlines;
+        total.pixels += local.stats.pixels;
+        total.zfail += local.stats.zfail;
+        total.written += local.stats.written;
+        total.hiztraps += local.stats.hiztraps;
+        total.hizpixels += local.stats.hizpixels;
+        total.shaded += local.stats.shaded;
+#endif
+    }
+#ifdef MINI3D_STATS
+    // 其它线程还在复制 device，先记在 totals 里，flush 结束时再合并
+    std::lock_guard<std::mutex> guard(lock);
+    totals.trapezoids += total.trapezoids;
+    totals.scanlines += total.scanlines;
+    totals.pixels += total.pixels;
+    totals.zfail += total.zfail;
+    totals.written += total.written;
+    totals.hiztraps += total.hiztraps;
+    totals.hizpixels += total.hizpixels;
+    totals.shaded += total.shaded;
+#endif
+}
+
+void Tiler::worker_main(void) {
+    int seen = 0;
+    while (1) {
+        Device *device;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond_start.wait(guard, [&] { return quit || generation != seen; });
+            if (quit) return;
+            seen = generation;
+            device = job;
+        }
+        tiler_run(device);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--pending == 0) cond_done.notify_one();
+        }
+    }
+}
+
+void Tiler::tiler_flush(Device *device) {
+    size_t i;
+    if (prim_count == 0) return;
+    next_tile = 0;
+#ifdef MINI3D_STATS
+    memset(&totals, 0, sizeof(totals));
+#endif
+    if (!workers.empty()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            job = device;
+            pending = (int)workers.size();
+            generation++;
+        }
+        cond_start.notify_all();
+    }
+    tiler_run(device);
+    if (!workers.empty()) {
+        std::unique_lock<std::mutex> guard(lock);
+        cond_done.wait(guard, [&] { return pending == 0; });
+    }
+#ifdef MINI3D_STATS
+    device->stats.trapezoids += totals.trapezoids;
+    device->stats.scanlines += totals.scanlines;
+    device->stats.pixels += totals.pixels;
+    device->stats.zfail += totals.zfail;
+    device->stats.written += totals.written;
+    device->stats.hiztraps += totals.hiztraps;
+    device->stats.hizpixels += totals.hizpixels;
+    device->stats.shaded += totals.shaded;
+#endif
+    for (i = 0; i < active.size(); i++)
+        bins[active[i]].first = bins[active[i]].last = NULL;
+    active.clear();
+    prim_count = 0;
+    arena_reset(&arena);
+}
@@ -0,0 +1,78 @@
+#ifndef _MINI3D_TILER_H_
+#define _MINI3D_TILER_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "mini3d.h"
+
+#define TILE_SIZE                   64      // 分块大小（像素）
+#define TILE_CHUNK                  30      // 分块列表每段的图元数，一段正好 256 字节
+#define TILE_ARENA                  (1 << 20)   // 每帧图元和分块列表的初始内存
+
+// 分块后的图元：完成透视除法的三角形，或者线框的三条边
+typedef struct TilePrim {
+    vertex_t v[3];              // 屏幕空间顶点（已经 vertex_rhw_init）
+    int render_state;           // 提交时的渲染状态，只含一种图元
+    UINT32 foreground;          // 线框颜色
+    int id;                     // 可见性缓存模式下三角形在 Device::visible 中的下标
+    int lines[6];               // 线框三个端点的屏幕坐标
+} tile_prim_t;
+
+// 分块列表按段从帧内存池里分配，段内按提交顺序存放图元指针
+typedef struct TileChunk {
+    struct TileChunk *next;
+    int count;
+    const tile_prim_t *prims[TILE_CHUNK];
+} tile_chunk_t;
+typedef struct TileBin { tile_chunk_t *first, *last; } tile_bin_t;
+
+// 分块多线程光栅化：几何变换在提交线程完成，按屏幕分块记录三角形，
+// device_flush 时每个线程各自领取分块，按提交顺序对分块内的三角形做三角形设置
+// 并光栅化。设置在每个分块里重复一次，换来更小的图元记录和并行的设置。
+// 每个分块只由一个线程写 framebuffer / zbuffer，因此不需要像素级的锁，
+// 并且结果与单线程逐三角形绘制完全一致。
+// 可见性缓存模式下每个分块光栅化完之后，由同一个线程接着给分块里的像素着色。
+// 图元和分块列表都从帧内存池里分配，flush 结束时一次收回，稳定之后每帧不再 malloc。
+class Tiler {
+    int width, height;
+    int tiles_x, tiles_y;
+    arena_t arena;                          // 本帧的图元和分块列表
+    int prim_count;                         // 本帧的图元数
+    std::vector<tile_bin_t> bins;           // 每个分块引用的图元
+    std::vector<int> active;                // 有图元的分块
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable cond_start;
+    std::condition_variable cond_done;
+    std::atomic<int> next_tile;             // 下一个待领取的 active 下标
+    Device *job;                            // 当前正在光栅化的设备
+    int generation;                         // 每次 flush 加一，唤醒工作线程
+    int pending;                            // 尚未完成本次 flush 的工作线程
+    bool quit;
+#ifdef MINI3D_STATS
+    device_stats_t totals;                  // 本次 flush 各线程的统计之和
+#endif
+
+    void tiler_bin(const tile_prim_t *prim, int x0, int y0, int x1, int y1);
+    void tiler_run(Device *device);
+    void worker_main(void);
+
+public:
+    // threads 为参与光栅化的线程数（包括调用 device_flush 的线程）
+    Tiler(int width, int height, int threads);
+    ~Tiler();
+
+    // 放入一个填充三角形
+    void tiler_add_triangle(const Device *device, const vertex_t *t1, const vertex_t *t2, const vertex_t *t3);
+    // 放入一个三角形的线框
+    void tiler_add_lines(const Device *device, const point_t *p1, const point_t *p2, const point_t *p3);
+    // 光栅化所有分块并清空
+    void tiler_flush(Device *device);
+};
+
+#endif
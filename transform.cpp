@@ -1,13 +1,13 @@
 #include "mini3d.h"
 
-// £ transform = world * view * projection
+// 矩阵更新，计算 transform = world * view * projection
 void transform_update(transform_t *ts) {
     matrix_t m;
     matrix_mul(&m, &ts->world, &ts->view);
     matrix_mul(&ts->transform, &m, &ts->projection);
 }
 
-// ʼĻ
+// 初始化，设置屏幕长宽
 void transform_init(transform_t *ts, int width, int height) {
     float aspect = (float)width / ((float)height);
     matrix_set_identity(&ts->world);
@@ -18,12 +18,12 @@ void transform_init(transform_t *ts, int width, int height) {
     transform_update(ts);
 }
 
-// ʸ x  project 
+// 将矢量 x 进行 project 
 void transform_apply(const transform_t *ts, vector_t *y, const vector_t *x) {
     matrix_apply(y, x, &ts->transform);
 }
 
-// ͬ cvv ı߽׶ü
+// 检查齐次坐标同 cvv 的边界用于视锥裁剪
 int transform_check_cvv(const vector_t *v) {
     float w = v->w;
     int check = 0;
@@ -36,7 +36,18 @@ int transform_check_cvv(const vector_t *v) {
     return check;
 }
 
-// һõĻ
+// 检查齐次坐标同保护带的 x / y 边界
+int transform_check_guard(const vector_t *v) {
+    float w = v->w * GUARD_BAND;
+    int check = 0;
+    if (v->x < -w) check |= 4;
+    if (v->x > w) check |= 8;
+    if (v->y < -w) check |= 16;
+    if (v->y > w) check |= 32;
+    return check;
+}
+
+// 归一化，得到屏幕坐标
 void transform_homogenize(const transform_t *ts, vector_t *y, const vector_t *x) {
     float rhw = 1.0f / x->w;
     y->x = (x->x * rhw + 1.0f) * ts->w * 0.5f;
@@ -45,6 +56,76 @@ void transform_homogenize(const transform_t *ts, vector_t *y, const vector_t *x)
     y->w = 1.0f;
 }
 
+// 批量变换：先 matrix_apply_batch 得到齐次坐标，再一次 4 / 8 个做 cvv 检查和归一化
+void transform_project_batch(const transform_t *ts, vector_soa_t *clip, int *cvv, vector_soa_t *screen,
+    const vector_soa_t *x, int n) {
+    int i = 0;
+    matrix_apply_batch(clip, x, &ts->transform, n);
+#ifdef MINI3D_AVX2
+    {
+        __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f);
+        __m256 sw = _mm256_set1_ps(ts->w), sh = _mm256_set1_ps(ts->h);
+        __m256 b[6];
+        int k;
+        for (k = 0; k < 6; k++) b[k] = _mm256_castsi256_ps(_mm256_set1_epi32(1 << k));
+        for (; i + 8 <= n; i += 8) {
+            __m256 X = _mm256_loadu_ps(clip->x + i), Y = _mm256_loadu_ps(clip->y + i);
+            __m256 Z = _mm256_loadu_ps(clip->z + i), W = _mm256_loadu_ps(clip->w + i);
+            __m256 nw = _mm256_sub_ps(zero, W), rhw = _mm256_div_ps(one, W);
+            __m256 check = _mm256_and_ps(_mm256_cmp_ps(Z, zero, _CMP_LT_OQ), b[0]);
+            check = _mm256_or_ps(check, _mm256_and_ps(_mm256_cmp_ps(Z, W, _CMP_GT_OQ), b[1]));
+            check = _mm256_or_ps(check, _mm256_and_ps(_mm256_cmp_ps(X, nw, _CMP_LT_OQ), b[2]));
+            check = _mm256_or_ps(check, _mm256_and_ps(_mm256_cmp_ps(X, W, _CMP_GT_OQ), b[3]));
+            check = _mm256_or_ps(check, _mm256_and_ps(_mm256_cmp_ps(Y, nw, _CMP_LT_OQ), b[4]));
+            check = _mm256_or_ps(check, _mm256_and_ps(_mm256_cmp_ps(Y, W, _CMP_GT_OQ), b[5]));
+            _mm256_storeu_si256((__m256i*)(cvv + i), _mm256_castps_si256(check));
+            X = _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(X, rhw), one), sw), half);
+            Y = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(Y, rhw)), sh), half);
+            _mm256_storeu_ps(screen->x + i, X);
+            _mm256_storeu_ps(screen->y + i, Y);
+            _mm256_storeu_ps(screen->z + i, _mm256_mul_ps(Z, rhw));
+            _mm256_storeu_ps(screen->w + i, one);
+        }
+    }
+#endif
+#ifdef MINI3D_SSE2
+    {
+        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+        __m128 sw = _mm_set1_ps(ts->w), sh = _mm_set1_ps(ts->h);
+        __m128 b[6];
+        int k;
+        for (k = 0; k < 6; k++) b[k] = _mm_castsi128_ps(_mm_set1_epi32(1 << k));
+        for (; i + 4 <= n; i += 4) {
+            __m128 X = _mm_loadu_ps(clip->x + i), Y = _mm_loadu_ps(clip->y + i);
+            __m128 Z = _mm_loadu_ps(clip->z + i), W = _mm_loadu_ps(clip->w + i);
+            __m128 nw = _mm_sub_ps(zero, W), rhw = _mm_div_ps(one, W);
+            __m128 check = _mm_and_ps(_mm_cmplt_ps(Z, zero), b[0]);
+            check = _mm_or_ps(check, _mm_and_ps(_mm_cmpgt_ps(Z, W), b[1]));
+            check = _mm_or_ps(check, _mm_and_ps(_mm_cmplt_ps(X, nw), b[2]));
+            check = _mm_or_ps(check, _mm_and_ps(_mm_cmpgt_ps(X, W), b[3]));
+            check = _mm_or_ps(check, _mm_and_ps(_mm_cmplt_ps(Y, nw), b[4]));
+            check = _mm_or_ps(check, _mm_and_ps(_mm_cmpgt_ps(Y, W), b[5]));
+            _mm_storeu_si128((__m128i*)(cvv + i), _mm_castps_si128(check));
+            X = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(X, rhw), one), sw), half);
+            Y = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(Y, rhw)), sh), half);
+            _mm_storeu_ps(screen->x + i, X);
+            _mm_storeu_ps(screen->y + i, Y);
+            _mm_storeu_ps(screen->z + i, _mm_mul_ps(Z, rhw));
+            _mm_storeu_ps(screen->w + i, one);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        vector_t c = { clip->x[i], clip->y[i], clip->z[i], clip->w[i] }, p;
+        cvv[i] = transform_check_cvv(&c);
+        transform_homogenize(ts, &p, &c);
+        screen->x[i] = p.x;
+        screen->y[i] = p.y;
+        screen->z[i] = p.z;
+        screen->w[i] = p.w;
+    }
+}
+
 void vertex_rhw_init(vertex_t *v) {
     float rhw = 1.0f / v->pos.w;
     v->rhw = rhw;
@@ -79,6 +160,10 @@ void vertex_division(vertex_t *y, const vertex_t *x1, const vertex_t *x2, float
     y->rhw = (x2->rhw - x1->rhw) * inv;
 }
 
+void vertex_advance(vertex_t *y, const vertex_t *x, const vertex_t *step, float t) {
+    vertex_advance_attr<VERTEX_ATTR_ALL>(y, x, step, t);
+}
+
 void vertex_add(vertex_t *y, const vertex_t *x) {
     y->pos.x += x->pos.x;
     y->pos.y += x->pos.y;
@@ -92,89 +177,124 @@ void vertex_add(vertex_t *y, const vertex_t *x) {
     y->color.b += x->color.b;
 }
 
-//  0-2 ΣҷغϷε
+// 边的两个端点：复制顶点，屏幕坐标换成对齐后的定点坐标
+static inline void trapezoid_edge_set(edge_t *edge, const vertex_t *v1, const vertex_t *v2,
+    const int *X, const int *Y, int i1, int i2) {
+    edge->v1 = *v1;
+    edge->v2 = *v2;
+    edge->v1.pos.x = (float)X[i1] * (1.0f / SUBPIXEL_ONE);
+    edge->v1.pos.y = (float)Y[i1] * (1.0f / SUBPIXEL_ONE);
+    edge->v2.pos.x = (float)X[i2] * (1.0f / SUBPIXEL_ONE);
+    edge->v2.pos.y = (float)Y[i2] * (1.0f / SUBPIXEL_ONE);
+    edge->x1 = X[i1], edge->y1 = Y[i1];
+    edge->x2 = X[i2], edge->y2 = Y[i2];
+}
+
+// 截断之前加上的偏移，屏幕坐标（含保护带）不会小于 -SUBPIXEL_BIAS 个像素
+#define SUBPIXEL_BIAS               (1 << 20)
+
+// 根据三角形生成 0-2 个梯形，并且返回非空梯形的数量。
+// 顶点坐标先对齐到 28.4 定点，扫描线范围、长边在哪一侧都用整数判断，
+// 共享一条边的两个三角形按同一组定点端点求覆盖，边上的像素只属于其中一个。
+// rhw、u * rhw 等属性在屏幕上是线性的，整个三角形只求一次沿 x、y 的梯度
 int trapezoid_init_triangle(trapezoid_t *trap, const vertex_t *p1, const vertex_t *p2, const vertex_t *p3) {
-    const vertex_t *p;
-    float k, x;
-
-    if (p1->pos.y > p2->pos.y) p = p1, p1 = p2, p2 = p;
-    if (p1->pos.y > p3->pos.y) p = p1, p1 = p3, p3 = p;
-    if (p2->pos.y > p3->pos.y) p = p2, p2 = p3, p3 = p;
-    if (p1->pos.y == p2->pos.y && p1->pos.y == p3->pos.y) return 0;
-    if (p1->pos.x == p2->pos.x && p1->pos.x == p3->pos.x) return 0;
-
-    if (p1->pos.y == p2->pos.y) { // triangle down
-        if (p1->pos.x > p2->pos.x) p = p1, p1 = p2, p2 = p;
-        trap[0].top = p1->pos.y;
-        trap[0].bottom = p3->pos.y;
-        trap[0].left.v1 = *p1;
-        trap[0].left.v2 = *p3;
-        trap[0].right.v1 = *p2;
-        trap[0].right.v2 = *p3;
-        return (trap[0].top < trap[0].bottom) ? 1 : 0;
-    }
+    const vertex_t *v[3] = { p1, p2, p3 };
+    const vertex_t *pa, *pb, *pc;
+    vertex_t origin, dx, dy;
+    float xs[3], ys[3], inv;
+    int X[3], Y[3], a = 0, b = 1, c = 2, k, top, mid, bottom, n = 0;
+    long long cross;
 
-    if (p2->pos.y == p3->pos.y) { // triangle up
-        if (p2->pos.x > p3->pos.x) p = p2, p2 = p3, p3 = p;
-        trap[0].top = p1->pos.y;
-        trap[0].bottom = p3->pos.y;
-        trap[0].left.v1 = *p1;
-        trap[0].left.v2 = *p2;
-        trap[0].right.v1 = *p1;
-        trap[0].right.v2 = *p3;
-        return (trap[0].top < trap[0].bottom) ? 1 : 0;
+    for (k = 0; k < 3; k++) {
+        X[k] = subpixel_snap(v[k]->pos.x);
+        Y[k] = subpixel_snap(v[k]->pos.y);
     }
 
-    trap[0].top = p1->pos.y;
-    trap[0].bottom = p2->pos.y;
-    trap[1].top = p2->pos.y;
-    trap[1].bottom = p3->pos.y;
-
-    k = (p3->pos.y - p1->pos.y) / (p2->pos.y - p1->pos.y);
-    x = p1->pos.x + (p2->pos.x - p1->pos.x) * k;
-
-    if (x <= p3->pos.x) { // triangle left
-        trap[0].left.v1 = *p1;
-        trap[0].left.v2 = *p2;
-        trap[0].right.v1 = *p1;
-        trap[0].right.v2 = *p3;
-        trap[1].left.v1 = *p2;
-        trap[1].left.v2 = *p3;
-        trap[1].right.v1 = *p1;
-        trap[1].right.v2 = *p3;
+    if (Y[a] > Y[b]) k = a, a = b, b = k;
+    if (Y[a] > Y[c]) k = a, a = c, c = k;
+    if (Y[b] > Y[c]) k = b, b = c, c = k;
+
+    top = subpixel_ceil(Y[a]);
+    mid = subpixel_ceil(Y[b]);
+    bottom = subpixel_ceil(Y[c]);
+    if (top >= bottom) return 0;
+
+    // 中间的顶点 b 在长边 a-c 的左边（屏幕 y 向下）时 cross < 0，共线时没有面积
+    cross = (long long)(X[b] - X[a]) * (Y[c] - Y[a]) - (long long)(X[c] - X[a]) * (Y[b] - Y[a]);
+    if (cross == 0) return 0;
+
+    pa = v[a], pb = v[b], pc = v[c];
+    xs[0] = (float)X[a] * (1.0f / SUBPIXEL_ONE), ys[0] = (float)Y[a] * (1.0f / SUBPIXEL_ONE);
+    xs[1] = (float)X[b] * (1.0f / SUBPIXEL_ONE), ys[1] = (float)Y[b] * (1.0f / SUBPIXEL_ONE);
+    xs[2] = (float)X[c] * (1.0f / SUBPIXEL_ONE), ys[2] = (float)Y[c] * (1.0f / SUBPIXEL_ONE);
+    inv = (float)(SUBPIXEL_ONE * SUBPIXEL_ONE) / (float)cross;
+    origin = *pa;
+    origin.pos.x = xs[0];
+    origin.pos.y = ys[0];
+    memset(&dx, 0, sizeof(vertex_t));
+    memset(&dy, 0, sizeof(vertex_t));
+    triangle_plane(&dx.rhw, &dy.rhw, xs, ys, pa->rhw, pb->rhw, pc->rhw, inv);
+    triangle_plane(&dx.tc.u, &dy.tc.u, xs, ys, pa->tc.u, pb->tc.u, pc->tc.u, inv);
+    triangle_plane(&dx.tc.v, &dy.tc.v, xs, ys, pa->tc.v, pb->tc.v, pc->tc.v, inv);
+    triangle_plane(&dx.color.r, &dy.color.r, xs, ys, pa->color.r, pb->color.r, pc->color.r, inv);
+    triangle_plane(&dx.color.g, &dy.color.g, xs, ys, pa->color.g, pb->color.g, pc->color.g, inv);
+    triangle_plane(&dx.color.b, &dy.color.b, xs, ys, pa->color.b, pb->color.b, pc->color.b, inv);
+
+    if (top < mid) {
+        trap[n].top = top;
+        trap[n].bottom = mid;
+        trapezoid_edge_set(&trap[n].left, v[a], v[(cross < 0) ? b : c], X, Y, a, (cross < 0) ? b : c);
+        trapezoid_edge_set(&trap[n].right, v[a], v[(cross < 0) ? c : b], X, Y, a, (cross < 0) ? c : b);
+        trap[n].v = origin, trap[n].dx = dx, trap[n].dy = dy;
+        n++;
     }
-    else { // triangle right
-        trap[0].left.v1 = *p1;
-        trap[0].left.v2 = *p3;
-        trap[0].right.v1 = *p1;
-        trap[0].right.v2 = *p2;
-        trap[1].left.v1 = *p1;
-        trap[1].left.v2 = *p3;
-        trap[1].right.v1 = *p2;
-        trap[1].right.v2 = *p3;
+    if (mid < bottom) {
+        trap[n].top = mid;
+        trap[n].bottom = bottom;
+        trapezoid_edge_set(&trap[n].left, v[(cross < 0) ? b : a], v[c], X, Y, (cross < 0) ? b : a, c);
+        trapezoid_edge_set(&trap[n].right, v[(cross < 0) ? a : b], v[c], X, Y, (cross < 0) ? a : b, c);
+        trap[n].v = origin, trap[n].dx = dx, trap[n].dy = dy;
+        n++;
     }
 
-    return 2;
+    return n;
 }
 
-//  Y  Y Ķ
-void trapezoid_edge_interp(trapezoid_t *trap, float y) {
-    float s1 = trap->left.v2.pos.y - trap->left.v1.pos.y;
-    float s2 = trap->right.v2.pos.y - trap->right.v1.pos.y;
-    float t1 = (y - trap->left.v1.pos.y) / s1;
-    float t2 = (y - trap->right.v1.pos.y) / s2;
-    vertex_interp(&trap->left.v, &trap->left.v1, &trap->left.v2, t1);
-    vertex_interp(&trap->right.v, &trap->right.v1, &trap->right.v2, t2);
+// 一条边在第 y 条扫描线上的整数位置。端点 (X1, Y1)、(X2, Y2) 为 28.4 定点，
+// 像素中心 Yc = 16 * y + 8 处边的横坐标为 X1 + (Yc - Y1) * dX / dY，
+// 第一个像素中心不在它左边的像素 x = ceil(N / D)，其中
+// N = (Yc - Y1) * dX + (X1 - 8) * dY，D = 16 * dY，余数 r = x * D - N
+static void trapezoid_edge_init(edge_t *edge, int y) {
+    int x1 = edge->x1, y1 = edge->y1, dx = edge->x2 - x1, dy = edge->y2 - y1;
+    int d = dy * SUBPIXEL_ONE, step = dx * SUBPIXEL_ONE;
+    long long num = (long long)(y * SUBPIXEL_ONE + SUBPIXEL_ONE / 2 - y1) * dx +
+        (long long)(x1 - SUBPIXEL_ONE / 2) * dy;
+    // 两个商都用 double 的倒数估计（53 位尾数放得下 num，不做整数除法），加上偏移再截断就是
+    // 向下取整，然后用余数修正：x 修正到向上取整，dx 修正到向下取整。估计几乎总是准的，
+    // 修正的分支都很好预测
+    double inv = 1.0 / (double)d;
+    long long x = (long long)((double)num * inv + SUBPIXEL_BIAS) - SUBPIXEL_BIAS, r = x * d - num;
+    int q = (int)((double)step * inv + SUBPIXEL_BIAS) - SUBPIXEL_BIAS, dr = step - q * d;
+    while (r < 0) x++, r += d;
+    while (r >= d) x--, r -= d;
+    while (dr < 0) q--, dr += d;
+    while (dr >= d) q++, dr -= d;
+    edge->x = (int)x;
+    edge->r = (int)r;
+    edge->dx = q;
+    edge->dr = dr;
+    edge->den = d;
 }
 
-// ߵĶ˵㣬ʼɨߵͲ
-void trapezoid_init_scan_line(const trapezoid_t *trap, scanline_t *scanline, int y) {
-    float width = trap->right.v.pos.x - trap->left.v.pos.x;
-    scanline->x = (int)(trap->left.v.pos.x + 0.5f);
-    scanline->w = (int)(trap->right.v.pos.x + 0.5f) - scanline->x;
-    scanline->y = y;
-    scanline->v = trap->left.v;
-    if (trap->left.v.pos.x >= trap->right.v.pos.x) scanline->w = 0;
-    vertex_division(&scanline->step, &trap->left.v, &trap->right.v, width);
+// 左右两条边的整数步进从第 y 条扫描线开始
+void trapezoid_edge_start(trapezoid_t *trap, int y) {
+    trapezoid_edge_init(&trap->left, y);
+    trapezoid_edge_init(&trap->right, y);
 }
 
+// 由左右两边的整数位置初始化扫描线：覆盖范围为 [left.x, right.x)，
+// 起点的属性按平面方程在第一个像素的中心求值，步长就是沿 x 的梯度。
+// 每条扫描线直接求值，不从上一行累加，从哪一行开始画结果都一样
+void trapezoid_init_scan_line(const trapezoid_t *trap, scanline_t *scanline, int y) {
+    trapezoid_scan_line_attr<VERTEX_ATTR_ALL>(trap, scanline, y);
+}
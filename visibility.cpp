@@ -0,0 +1,215 @@
+#include "mini3d.h"
+
+//=====================================================================
+// 可见性缓存：光栅化只做深度测试，通过测试的像素在 vbuffer 里记下三角形的编号，
+// 纹理坐标、颜色都不求；device_flush 时每个像素按最后留下的三角形着色一次。
+// 被后画的三角形盖住的像素不再做透视除法、读纹理，着色次数就是可见的像素数。
+// 重心坐标不逐像素存放：三角形提交时按光栅化用的 28.4 定点坐标求一次属性的平面方程，
+// 着色时在像素中心直接求值，vbuffer 每个像素只占 4 字节。
+// 解析按 8x8 分块进行，device_clear 之后没有画过的分块直接跳过，着色过的像素置为 -1，
+// 所以中途 device_flush 之后接着画也不会重复着色。线框不经过可见性缓存，直接画在
+// framebuffer 上，可能被之后才着色的像素盖住。
+//=====================================================================
+
+// 打开时分配 vbuffer，全部置为 -1；关闭时释放。切换之前先把已经提交的三角形画完
+void Device::device_set_visibility(int enable) {
+    int i, n = this->width * this->height;
+    device_flush();
+    if (enable && this->vbuffer == NULL) {
+        this->vbuffer = (int*)malloc(sizeof(int) * n);
+        assert(this->vbuffer);
+        for (i = 0; i < n; i++) this->vbuffer[i] = -1;
+    }
+    if (!enable && this->vbuffer) {
+        free(this->vbuffer);
+        this->vbuffer = NULL;
+    }
+    this->visibility = enable ? 1 : 0;
+}
+
+// 记录三角形的平面方程，原点放在对齐后的第一个顶点，再减去半个像素，
+// 着色时直接用像素的整数坐标求值
+int Device::device_visible_add(const vertex_t *t1, const vertex_t *t2, const vertex_t *t3) {
+    const vertex_t *v[3] = { t1, t2, t3 };
+    visible_prim_t *prim;
+    float xs[3], ys[3], inv;
+    long long cross;
+    int X[3], Y[3], k;
+
+    if (this->visible_count >= this->visible_max) {
+        this->visible_max = (this->visible_max > 0) ? this->visible_max * 2 : 1024;
+        this->visible = (visible_prim_t*)realloc(this->visible, sizeof(visible_prim_t) * this->visible_max);
+        assert(this->visible);
+    }
+    prim = &this->visible[this->visible_count];
+
+    for (k = 0; k < 3; k++) {
+        X[k] = subpixel_snap(v[k]->pos.x);
+        Y[k] = subpixel_snap(v[k]->pos.y);
+        xs[k] = (float)X[k] * (1.0f / SUBPIXEL_ONE);
+        ys[k] = (float)Y[k] * (1.0f / SUBPIXEL_ONE);
+    }
+    cross = (long long)(X[1] - X[0]) * (Y[2] - Y[0]) - (long long)(X[2] - X[0]) * (Y[1] - Y[0]);
+
+    prim->v = *t1;
+    prim->v.pos.x = xs[0] - 0.5f;
+    prim->v.pos.y = ys[0] - 0.5f;
+    prim->render_state = this->render_state;
+    memset(&prim->dx, 0, sizeof(vertex_t));
+    memset(&prim->dy, 0, sizeof(vertex_t));
+    // 零面积的三角形已经被 device_check_cull 剔除，这里只是防止除零
+    if (cross != 0) {
+        vertex_t *dx = &prim->dx, *dy = &prim->dy;
+        inv = (float)(SUBPIXEL_ONE * SUBPIXEL_ONE) / (float)cross;
+        triangle_plane(&dx->rhw, &dy->rhw, xs, ys, t1->rhw, t2->rhw, t3->rhw, inv);
+        triangle_plane(&dx->tc.u, &dy->tc.u, xs, ys, t1->tc.u, t2->tc.u, t3->tc.u, inv);
+        triangle_plane(&dx->tc.v, &dy->tc.v, xs, ys, t1->tc.v, t2->tc.v, t3->tc.v, inv);
+        triangle_plane(&dx->color.r, &dy->color.r, xs, ys, t1->color.r, t2->color.r, t3->color.r, inv);
+        triangle_plane(&dx->color.g, &dy->color.g, xs, ys, t1->color.g, t2->color.g, t3->color.g, inv);
+        triangle_plane(&dx->color.b, &dy->color.b, xs, ys, t1->color.b, t2->color.b, t3->color.b, inv);
+    }
+    return this->visible_count++;
+}
+
+
+//---------------------------------------------------------------------
+// 解析：属性按 (v + dy * fy) + dx * fx 的顺序求值，标量和 SSE2 的结果逐位一致，
+// 一个像素不论是单独着色还是四个一组着色，颜色都相同
+//---------------------------------------------------------------------
+
+// 按像素 (x, y) 中心的导数选择 mip 层
+static void visibility_level(Device *device, const visible_prim_t *prim, int x, int y) {
+    const vertex_t *v = &prim->v, *dx = &prim->dx, *dy = &prim->dy;
+    float fx = (float)x - v->pos.x, fy = (float)y - v->pos.y;
+    float gx[3] = { dx->tc.u, dx->tc.v, dx->rhw };
+    float gy[3] = { dy->tc.u, dy->tc.v, dy->rhw };
+    int lerp = 0;
+    int k = texture_select_level(device->tex, (v->tc.u + dy->tc.u * fy) + dx->tc.u * fx,
+        (v->tc.v + dy->tc.v * fy) + dx->tc.v * fx, (v->rhw + dy->rhw * fy) + dx->rhw * fx, gx, gy,
+        (device->sampler.filter == SAMPLER_TRILINEAR) ? &lerp : NULL);
+    device->tex_level = &device->tex->level[k];
+    device->tex_lerp = lerp;
+}
+
+// 一个像素着色
+static UINT32 visibility_shade(Device *device, const visible_prim_t *prim, int x, int y) {
+    const vertex_t *v = &prim->v, *dx = &prim->dx, *dy = &prim->dy;
+    float fx = (float)x - v->pos.x, fy = (float)y - v->pos.y;
+    float rhw = (v->rhw + dy->rhw * fy) + dx->rhw * fx;
+    float w = 1.0f / rhw;
+    if (prim->render_state & RENDER_STATE_TEXTURE) {
+        float u = ((v->tc.u + dy->tc.u * fy) + dx->tc.u * fx) * w;
+        float t = ((v->tc.v + dy->tc.v * fy) + dx->tc.v * fx) * w;
+        return device->Device_texture_read(u, t);
+    }
+    else {
+        float r = ((v->color.r + dy->color.r * fy) + dx->color.r * fx) * w;
+        float g = ((v->color.g + dy->color.g * fy) + dx->color.g * fx) * w;
+        float b = ((v->color.b + dy->color.b * fy) + dx->color.b * fx) * w;
+        int R = (int)(r * 255.0f);
+        int G = (int)(g * 255.0f);
+        int B = (int)(b * 255.0f);
+        R = clamp(R, 0, 255);
+        G = clamp(G, 0, 255);
+        B = clamp(B, 0, 255);
+        return (R << 16) | (G << 8) | (B);
+    }
+}
+
+#ifdef MINI3D_SSE2
+// 平面方程在 4 个像素上求值，fx 为四个像素的横向偏移
+static inline __m128 visibility_eval(float a, float gx, float gy, float fy, __m128 fx) {
+    return _mm_add_ps(_mm_set1_ps(a + gy * fy), _mm_mul_ps(_mm_set1_ps(gx), fx));
+}
+
+// 同一个三角形的 4 个相邻像素一起着色
+static __m128i visibility_shade_sse2(Device *device, const visible_prim_t *prim, int x, int y) {
+    const vertex_t *v = &prim->v, *dx = &prim->dx, *dy = &prim->dy;
+    __m128 fx = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+    float fy = (float)y - v->pos.y;
+    __m128 w;
+    const __m128i zero = _mm_setzero_si128();
+    fx = _mm_sub_ps(fx, _mm_set1_ps(v->pos.x));
+    w = _mm_div_ps(_mm_set1_ps(1.0f), visibility_eval(v->rhw, dx->rhw, dy->rhw, fy, fx));
+    if (prim->render_state & RENDER_STATE_TEXTURE) {
+        const texture_level_t *level = device->tex_level;
+        __m128 u = _mm_mul_ps(visibility_eval(v->tc.u, dx->tc.u, dy->tc.u, fy, fx), w);
+        __m128 t = _mm_mul_ps(visibility_eval(v->tc.v, dx->tc.v, dy->tc.v, fy, fx), w);
+        __m128i tx, ty;
+        int index[4];
+        UINT32 texel[4];
+        if (device->sampler.filter | device->sampler.address_u | device->sampler.address_v)
+            return sampler_fetch_sse2(&device->sampler, level, device->tex_lerp, u, t);
+        u = _mm_add_ps(_mm_mul_ps(u, _mm_set1_ps(level->max_u)), _mm_set1_ps(0.5f));
+        t = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(level->max_v)), _mm_set1_ps(0.5f));
+        tx = clamp_sse2(_mm_cvttps_epi32(u), zero, _mm_set1_epi32(level->width - 1));
+        ty = clamp_sse2(_mm_cvttps_epi32(t), zero, _mm_set1_epi32(level->height - 1));
+        _mm_storeu_si128((__m128i*)index, texture_offset_sse2(level, tx, ty));
+        texel[0] = level->bits[index[0]];
+        texel[1] = level->bits[index[1]];
+        texel[2] = level->bits[index[2]];
+        texel[3] = level->bits[index[3]];
+        return _mm_loadu_si128((const __m128i*)texel);
+    }
+    else {
+        const __m128 s = _mm_set1_ps(255.0f);
+        const __m128i hi = _mm_set1_epi32(255);
+        __m128 r = _mm_mul_ps(visibility_eval(v->color.r, dx->color.r, dy->color.r, fy, fx), w);
+        __m128 g = _mm_mul_ps(visibility_eval(v->color.g, dx->color.g, dy->color.g, fy, fx), w);
+        __m128 b = _mm_mul_ps(visibility_eval(v->color.b, dx->color.b, dy->color.b, fy, fx), w);
+        __m128i R = clamp_sse2(_mm_cvttps_epi32(_mm_mul_ps(r, s)), zero, hi);
+        __m128i G = clamp_sse2(_mm_cvttps_epi32(_mm_mul_ps(g, s)), zero, hi);
+        __m128i B = clamp_sse2(_mm_cvttps_epi32(_mm_mul_ps(b, s)), zero, hi);
+        return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(R, 16), _mm_slli_epi32(G, 8)), B);
+    }
+}
+#endif
+
+// 第 y 行 [x0, x1) 的像素着色，[x0, x1) 在同一个 8x8 分块里。
+// 纹理的 mip 层在这一段里每换一个三角形选择一次，与分块方式无关
+static void visibility_resolve_span(Device *device, int y, int x0, int x1) {
+    UINT32 *framebuffer = device->framebuffer + y * device->fb_stride;
+    int *vbuffer = device->vbuffer + y * device->width;
+    int x = x0, last = -1;
+    while (x < x1) {
+        const visible_prim_t *prim;
+        int id = vbuffer[x];
+        if (id < 0) {
+            x++;
+            continue;
+        }
+        prim = &device->visible[id];
+        if (id != last && (prim->render_state & RENDER_STATE_TEXTURE))
+            visibility_level(device, prim, x, y);
+        last = id;
+#ifdef MINI3D_SSE2
+        if (x + 4 <= x1 && vbuffer[x + 1] == id && vbuffer[x + 2] == id && vbuffer[x + 3] == id) {
+            _mm_storeu_si128((__m128i*)(framebuffer + x), visibility_shade_sse2(device, prim, x, y));
+            _mm_storeu_si128((__m128i*)(vbuffer + x), _mm_set1_epi32(-1));
+            DEVICE_STAT(device->stats.shaded += 4);
+            x += 4;
+            continue;
+        }
+#endif
+        framebuffer[x] = visibility_shade(device, prim, x, y);
+        vbuffer[x] = -1;
+        DEVICE_STAT(device->stats.shaded++);
+        x++;
+    }
+}
+
+// 裁剪区域内的像素按 8x8 分块着色，device_clear 之后还没有画过的分块整块跳过
+void Device::device_visibility_resolve() {
+    int tx, ty, y;
+    for (ty = this->clip_y0 / HIZ_SIZE; ty * HIZ_SIZE < this->clip_y1; ty++) {
+        int y0 = (ty * HIZ_SIZE < this->clip_y0) ? this->clip_y0 : ty * HIZ_SIZE;
+        int y1 = ((ty + 1) * HIZ_SIZE > this->clip_y1) ? this->clip_y1 : (ty + 1) * HIZ_SIZE;
+        for (tx = this->clip_x0 / HIZ_SIZE; tx * HIZ_SIZE < this->clip_x1; tx++) {
+            int x0 = (tx * HIZ_SIZE < this->clip_x0) ? this->clip_x0 : tx * HIZ_SIZE;
+            int x1 = ((tx + 1) * HIZ_SIZE > this->clip_x1) ? this->clip_x1 : (tx + 1) * HIZ_SIZE;
+            if (this->zclear[ty * this->hiz_w + tx]) continue;
+            for (y = y0; y < y1; y++)
+                visibility_resolve_span(this, y, x0, x1);
+        }
+    }
+}
@@ -2,9 +2,9 @@
 #include "window.h"
 
 int Window::device_exit;
-int Window::device_keys[DEVICE_KEYS_SIZE];	// ǰ̰״̬
+int Window::device_keys[DEVICE_KEYS_SIZE];	// 当前键盘按下状态
 
-// ʼڲñ
+// 初始化窗口并设置标题
 int Window::screen_init(int w, int h, const TCHAR *title) {
     WNDCLASS wc = { CS_BYTEALIGNCLIENT, (WNDPROC) win_events, 0, 0, 0,
         NULL, NULL, NULL, NULL, _T("SCREEN3.1415926") };
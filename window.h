@@ -6,20 +6,20 @@
 #include <windows.h>
 #include <tchar.h>
 
-// Win32 ڼͼλƣΪ device ṩһ DibSection  FB
+// Win32 窗口及图形绘制：为 device 提供一个 DibSection 的 FB
 class Window {
     int screen_w, screen_h;
     int screen_mx, screen_my, screen_mb;
-    HWND screen_handle;		//  HWND
-    HDC screen_dc;			// ׵ HDC
+    HWND screen_handle;		// 主窗口 HWND
+    HDC screen_dc;			// 配套的 HDC
     HBITMAP screen_hb;		// DIB
-    HBITMAP screen_ob;		// ϵ BITMAP
+    HBITMAP screen_ob;		// 老的 BITMAP
     unsigned char *screen_fb;	// frame buffer
     long screen_pitch;
 
 public:
     static int device_exit;
-    static int device_keys[DEVICE_KEYS_SIZE];	// ǰ̰״̬
+    static int device_keys[DEVICE_KEYS_SIZE];	// 当前键盘按下状态
 
 public:
     Window() {
@@ -34,12 +34,12 @@ public:
         memset(device_keys, 0, sizeof(int) * DEVICE_KEYS_SIZE);
     }
 
-    int screen_init(int w, int h, const TCHAR *title);	// Ļʼ
-    int screen_close(void);								// رĻ
-    void screen_update(void);							// ʾ FrameBuffer
+    int screen_init(int w, int h, const TCHAR *title);	// 屏幕初始化
+    int screen_close(void);								// 关闭屏幕
+    void screen_update(void);							// 显示 FrameBuffer
     unsigned char *getScreenFrameBuffer() { return screen_fb; }
 
     // win32 event handler
     static LRESULT win_events(HWND, UINT, WPARAM, LPARAM);
-    void win_dispatch(void);							// Ϣ
+    void win_dispatch(void);							// 处理消息
 };